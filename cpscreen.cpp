@@ -150,37 +150,29 @@ LLIMG *llimg_cpscreen (const RECT *source) {
   bmi.bmiHeader.biCompression = BI_RGB;
   bmi.bmiHeader.biBitCount = 24;
 
-  int line_bytes = 4*(((3 * bmi.bmiHeader.biWidth)+3)/4); /* BGR, long aligned*/
-  int bgr_size = line_bytes * bmi.bmiHeader.biHeight;
+  int line_bytes = llimg_stride (bmi.bmiHeader.biWidth, 24);
 
-  unsigned char *data = (unsigned char *) malloc (bgr_size);
-  if (!data) {
+  // Read it straight into an llimg, whose rows are at DIB stride
+
+  llimg = llimg_create_base ();
+  llimg->width = bmi.bmiHeader.biWidth;
+  llimg->height = bmi.bmiHeader.biHeight;
+  llimg->dib_height = bmi.bmiHeader.biHeight;
+  llimg->bits_per_pixel = bmi.bmiHeader.biBitCount;
+  if (llimg_alloc_data (llimg)) {
+    llimg_release_llimg (llimg);
     DeleteObject (hbm_screen);
     return NULL;
   }  
   success = GetDIBits (hdc, (HBITMAP) hbm_screen,
-    0, bmi.bmiHeader.biHeight, data, &bmi, DIB_RGB_COLORS);
+    0, bmi.bmiHeader.biHeight, llimg->data, &bmi, DIB_RGB_COLORS);
 
   if (!success) {
     showLastSysError ("GetDIBits, data request");
+    llimg_release_llimg (llimg);
     return NULL;
   }
 
-  // Move it into an llimg  
-
-  llimg = llimg_create_base ();
-  llimg->width = bmi.bmiHeader.biWidth;
-  llimg->height = bmi.bmiHeader.biHeight;
-  llimg->dib_height = bmi.bmiHeader.biHeight;
-  llimg->bits_per_pixel = bmi.bmiHeader.biBitCount;
-  llimg->data = data;
-  llimg->line = (unsigned char **)                    
-    malloc (llimg->height * sizeof (unsigned char *));
-  llimg->line[0] = llimg->data;                       
-  for (int y = 1; y < llimg->height; y++)  
-    llimg->line[y] = llimg->line[y - 1] + line_bytes;
-
-  
   DeleteObject (hbm_screen);
 
   // Flip the image to make it raster instead of cartesian
@@ -37,16 +37,29 @@
 
 struct bgr_color { unsigned char blue, green, red, reserved ; } ;
 
+/* pixels that more than one image shows (see share.cpp) */
+
+struct LLBUF {
+    long refs ;                /* the images on it */
+    unsigned char * data ;     /* the raster they all point into */
+} ;
+
 typedef struct LLIMG_s {
 
-    unsigned char * data ;     /* the raster data array -  malloc'd */
+    unsigned char * data ;     /* the raster data array - llimg_pool_get */
     unsigned char **line ;     /* an array of pointers to rows -  malloc'd */
     void * log_palette ;       /* holder for the windows LOGICALPALETTE */
     void * hpalette ;          /* holder for the windows HPALETTE */
     long height ;              /* normal, positive height (vs. dib_height) */
-    unsigned char rotation ;   /* times to rot ClockWise; 3 => counter CW */
+    unsigned char rotation ;   /* LLIMG_ORIENT_... to show it through, */
+                               /* which reduce and resize apply as they */
+                               /* go; 0 when it shows as it is */
     long client;
     long client1;
+    long full_width ;          /* size of the full image, for an image */
+    long full_height ;         /* decoded scaled down; 0 when it's full */
+    struct LLBUF * buf ;       /* NULL when data is the image's own, else */
+                               /* data and line point into buf->data */
 
     /* ... */
 
@@ -67,6 +80,30 @@ typedef struct LLIMG_s {
 
 
 
+/* * * * * * * * * * * * * * * * * * * * * * */
+/* pixel data and scratch rows come from the pool (see pool.cpp), */
+/* and rasters are laid out by llimg_alloc_data */
+
+#define LLIMG_ALIGN 64     /* where every block starts, a cache line */
+#define LLIMG_SLACK 64     /* bytes after a raster's last row that a */
+                           /* vector load running off a row may read */
+
+/* bytes from row to row: a DIB's, rounded up to a long */
+#define llimg_stride(width, bits_per_pixel)          \
+  (4 * (((long) (width) * (bits_per_pixel) + 31) / 32))
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void * llimg_pool_get (long bytes) ;
+void llimg_pool_put (void *block) ;
+void llimg_pool_cap (long bytes) ;
+int llimg_alloc_data (LLIMG *llimg) ;
+void llimg_free_data (LLIMG *llimg) ;  /* the last image on a buf frees it */
+#ifdef __cplusplus
+}
+#endif
+
 /* * * * * * * * * * * * * * * * * * * * * * */
 /* frees pointer content for stack based Images */
 
@@ -78,8 +115,7 @@ typedef struct LLIMG_s {
       break;                                      \
     if ((llimg)->line)                            \
       free ((void *) ((llimg)->line));            \
-    if ((llimg)->data)                            \
-      free ((void *) ((llimg)->data));            \
+    llimg_free_data ((llimg));                    \
   } while (0);                                    \
 }
 
@@ -94,8 +130,7 @@ typedef struct LLIMG_s {
       break;                                      \
     if ((llimg)->line)                            \
       free ((void *) ((llimg)->line));            \
-    if ((llimg)->data)                            \
-      free ((void *) ((llimg)->data));            \
+    llimg_free_data ((llimg));                    \
     free ((void *) (llimg));                      \
   } while (0);                                    \
 }
@@ -118,11 +153,13 @@ typedef struct LLIMG_s {
 
 #define llimg_make_line_array(llimg)                             \
 {                                                                \
-  int line_bytes, y;                                             \
+  long line_bytes;                                               \
+  int y;                                                         \
   do {                                                           \
     if (!(llimg))                                                \
       break;                                                     \
-    line_bytes = ((llimg)->width * (llimg)->bits_per_pixel) / 8; \
+    line_bytes = llimg_stride ((llimg)->width,                   \
+                               (llimg)->bits_per_pixel);         \
     if (line_bytes <= 0)                                         \
       break;                                                     \
     (llimg)->line = (unsigned char **)                           \
@@ -137,6 +174,65 @@ typedef struct LLIMG_s {
 
 static LLIMG * llimg_create_base () { LLIMG *llimg; llimg = (LLIMG *) malloc (sizeof (LLIMG)); llimg_zero_llimg (llimg); return (llimg); }
 
+/* * * * * * * * * * * * * * * * * * * * * * */
+/* the eight orientations, numbered as the Exif orientation tag numbers */
+/* them: the transform that shows the stored image upright */
+
+enum {
+  LLIMG_ORIENT_NORMAL = 1,
+  LLIMG_ORIENT_FLIP_H,      /* mirrored left to right */
+  LLIMG_ORIENT_180,
+  LLIMG_ORIENT_FLIP_V,      /* mirrored top to bottom */
+  LLIMG_ORIENT_TRANSPOSE,   /* rows become columns */
+  LLIMG_ORIENT_CW,          /* a quarter turn clockwise */
+  LLIMG_ORIENT_TRANSVERSE,  /* transposed and turned a half */
+  LLIMG_ORIENT_CCW          /* a quarter turn counter clockwise */
+};
+
+/* stores a row of a w by h image where the transform puts it (see */
+/* rotate.cpp), for kernels that turn their output as they make it */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void llimg_orient_row (LLIMG *oriented, int transform,
+                       const unsigned char *row, int y, int w, int h) ;
+#ifdef __cplusplus
+}
+#endif
+
+/* * * * * * * * * * * * * * * * * * * * * * */
+/* what an 8 bit image reduces and resizes to (see palette.cpp) */
+
+enum {
+  LLIMG_KEEP_GRAY = 1,      /* 8 bit, its index its gray level */
+  LLIMG_KEEP_INDEX          /* 8 bit, on the same color table */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void llimg_keep_palette (int on) ;
+int llimg_palette_kind (const LLIMG *image) ;
+const unsigned char * llimg_inverse_palette (const LLIMG *image) ;
+void llimg_release_inverse (const unsigned char *inverse) ;
+void llimg_index_row (const unsigned char *inverse, const unsigned char *bgr,
+                      unsigned char *out, int n) ;
+#ifdef __cplusplus
+}
+#endif
+
+/* * * * * * * * * * * * * * * * * * * * * * */
+/* whether the fixed factor reductions are used (see reduce.cpp) */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void llimg_reduce_fixed (int on) ;
+#ifdef __cplusplus
+}
+#endif
+
 #endif
 
 
@@ -0,0 +1,97 @@
+/*******************************************************************************
+ * Copyright 2002, 2003, 2004, 2005, 2006, 2012 Kent Stork
+ *
+ * ll_simd.h is part of Osiva.
+ *
+ * Osiva is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Osiva is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Osiva.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+/*/////////////////////////////////////////////////////////////////////////
+//
+// file: ll_simd.h
+//
+// Picks the vector instruction sets the image kernels are built with,
+// and asks the processor which of them it has.  A set is built in when
+// the compiler was told it may target it:
+//
+//   LLIMG_SSE2   x64 builds, /arch:SSE2 (or -msse2) x86 builds
+//   LLIMG_SSSE3  /arch:AVX or later (or -mssse3) builds
+//   LLIMG_AVX2   /arch:AVX2 (or -mavx2) builds
+//
+// or, with LLIMG_SIMD defined (snapshot.dsp does), on any x86 Visual C++
+// that has the intrinsics: SSE2 from VC6 with the Processor Pack, SSSE3
+// from VC 2008, AVX2 from VC 2012.  Each kernel still checks llimg_cpu
+// (simd.cpp) before it takes a vector path, so the program runs on any
+// processor.
+//
+// Define LLIMG_NO_SIMD to build the plain C kernels only.  Every
+// vector path has a plain C twin that gives bit identical results.
+//
+// synopsis:
+//
+//  #include "ll_simd.h"
+//
+//  #ifdef LLIMG_SSE2
+//    if (llimg_cpu () & LLIMG_CPU_SSE2) {
+//      ... SSE2 ...
+//    }
+//  #endif
+//
+//////////////////////////////////////////////////////////////////////// */
+
+
+#ifndef LL_SIMD_H
+#define LL_SIMD_H
+
+#ifndef LLIMG_NO_SIMD
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || \
+    (defined(_M_IX86) && defined(LLIMG_SIMD))
+#define LLIMG_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(LLIMG_SSE2) && (defined(__SSSE3__) || defined(__AVX__) || \
+    (defined(_MSC_VER) && _MSC_VER >= 1500 && defined(LLIMG_SIMD)))
+#define LLIMG_SSSE3
+#include <tmmintrin.h>
+#endif
+
+#if defined(LLIMG_SSSE3) && (defined(__AVX2__) || \
+    (defined(_MSC_VER) && _MSC_VER >= 1700 && defined(LLIMG_SIMD)))
+#define LLIMG_AVX2
+#include <immintrin.h>
+#endif
+
+#endif /* LLIMG_NO_SIMD */
+
+/* llimg_cpu's sets */
+#define LLIMG_CPU_SSE2   1
+#define LLIMG_CPU_SSSE3  2
+#define LLIMG_CPU_AVX2   4
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int llimg_cpu (void) ;              /* the sets the processor (and OS) run */
+void llimg_cpu_limit (int sets) ;   /* keeps llimg_cpu to sets, for tests */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
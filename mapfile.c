@@ -0,0 +1,251 @@
+/*******************************************************************************
+ * Copyright 2002, 2003, 2004, 2005, 2006, 2012 Kent Stork
+ *
+ * mapfile.c is part of Osiva.
+ *
+ * Osiva is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Osiva is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Osiva.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// File: mapfile.c
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include "mapfile.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// The fallback: read the whole file into a malloc'd buffer
+
+static int
+read_file (const char *path, struct LLMAP *map)
+{
+  FILE *fp;
+  unsigned char *buffer;
+  long size;
+
+  fp = fopen (path, "rb");
+  if (!fp)
+    return -1;
+  fseek (fp, 0L, SEEK_END);
+  size = ftell (fp);
+  fseek (fp, 0L, SEEK_SET);
+  if (size < 0) {
+    fclose (fp);
+    return -1;
+  }
+
+  buffer = (unsigned char *) malloc (size > 0 ? size : 1);
+  if (!buffer) {
+    fclose (fp);
+    return -1;
+  }
+  size = (long) fread (buffer, 1, size, fp);
+  fclose (fp);
+
+  map->data = buffer;
+  map->size = size;
+  map->mapped = 0;
+  return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Map the file when we can.  An empty file can't be mapped, nor can some
+// network files; those are read instead.
+
+#ifdef _WIN32
+
+int
+llimg_map_file (const char *path, struct LLMAP *map)
+{
+  HANDLE file, mapping;
+  DWORD size;
+  void *view;
+
+  memset (map, 0, sizeof (*map));
+
+  // Sequential scan tells the cache manager to read well ahead
+  file = CreateFile (path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                     OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return -1;
+
+  view = NULL;
+  size = GetFileSize (file, NULL);
+  if (size != 0 && size != 0xFFFFFFFF) {
+    mapping = CreateFileMapping (file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping) {
+      view = MapViewOfFile (mapping, FILE_MAP_READ, 0, 0, 0);
+      // The view holds on to the mapping and the file
+      CloseHandle (mapping);
+    }
+  }
+  CloseHandle (file);
+
+  if (!view)
+    return read_file (path, map);
+
+  map->data = (const unsigned char *) view;
+  map->size = (long) size;
+  map->mapped = 1;
+  return 0;
+}
+
+void
+llimg_unmap_file (struct LLMAP *map)
+{
+  if (map->mapped)
+    UnmapViewOfFile ((void *) map->data);
+  else
+    free ((void *) map->data);
+  map->data = NULL;
+  map->size = 0;
+}
+
+#else
+
+int
+llimg_map_file (const char *path, struct LLMAP *map)
+{
+  struct stat st;
+  void *view;
+  int fd;
+
+  memset (map, 0, sizeof (*map));
+
+  fd = open (path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+
+  view = MAP_FAILED;
+  if (fstat (fd, &st) == 0 && st.st_size > 0)
+    view = mmap (NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping holds on to the file
+  close (fd);
+
+  if (view == MAP_FAILED)
+    return read_file (path, map);
+
+#ifdef MADV_SEQUENTIAL
+  madvise (view, (size_t) st.st_size, MADV_SEQUENTIAL);
+#endif
+#ifdef MADV_WILLNEED
+  madvise (view, (size_t) st.st_size, MADV_WILLNEED);
+#endif
+
+  map->data = (const unsigned char *) view;
+  map->size = (long) st.st_size;
+  map->mapped = 1;
+  return 0;
+}
+
+void
+llimg_unmap_file (struct LLMAP *map)
+{
+  if (map->mapped)
+    munmap ((void *) map->data, (size_t) map->size);
+  else
+    free ((void *) map->data);
+  map->data = NULL;
+  map->size = 0;
+}
+
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Kept files, newest first.  A file read again after it changed goes in
+// front of its old copy, which stays until its holders let go.
+
+static struct LLKEPT *kept_files = NULL;
+
+struct LLKEPT *
+llimg_keep_file (const char *path)
+{
+  struct LLKEPT *kept;
+  struct LLMAP map;
+  struct stat st;
+  unsigned char *data;
+
+  if (stat (path, &st) != 0)
+    return NULL;
+  for (kept = kept_files; kept; kept = kept->next) {
+    if (!strcmp (kept->path, path)) {
+      if (kept->size != (long) st.st_size || kept->stamp != (long) st.st_mtime)
+        break;
+      kept->refs++;
+      return kept;
+    }
+  }
+
+  if (llimg_map_file (path, &map) != 0)
+    return NULL;
+  kept = (struct LLKEPT *) malloc (sizeof (struct LLKEPT));
+  data = (unsigned char *) malloc (map.size > 0 ? map.size : 1);
+  if (kept)
+    kept->path = (char *) malloc (strlen (path) + 1);
+  if (!kept || !data || !kept->path) {
+    if (kept)
+      free (kept->path);
+    free (kept);
+    free (data);
+    llimg_unmap_file (&map);
+    return NULL;
+  }
+  memcpy (data, map.data, map.size);
+  strcpy (kept->path, path);
+  kept->data = data;
+  kept->size = map.size;
+  kept->refs = 1;
+  kept->stamp = (long) st.st_mtime;
+  kept->next = kept_files;
+  kept_files = kept;
+  llimg_unmap_file (&map);
+  return kept;
+}
+
+void
+llimg_unkeep_file (struct LLKEPT *kept)
+{
+  struct LLKEPT **link;
+
+  if (!kept || --kept->refs > 0)
+    return;
+  for (link = &kept_files; *link; link = &(*link)->next) {
+    if (*link == kept) {
+      *link = kept->next;
+      break;
+    }
+  }
+  free ((void *) kept->data);
+  free (kept->path);
+  free (kept);
+}
@@ -0,0 +1,93 @@
+/*******************************************************************************
+ * Copyright 2002, 2003, 2004, 2005, 2006, 2012 Kent Stork
+ *
+ * mapfile.h is part of Osiva.
+ *
+ * Osiva is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Osiva is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Osiva.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+///////////////////////////////////////////////////////////////////////////
+//
+// File: mapfile.h
+//
+// Read-only view of a whole file, for the decoders to read in place.
+// The file is memory mapped where that works (a file mapping on
+// Windows, mmap elsewhere) with a hint that it will be read front to
+// back, so the system can read ahead of the decoder.  If it can't be
+// mapped it is read into a malloc'd buffer instead.
+//
+// Synopsis:
+//
+// #include "mapfile.h"
+//
+//   LLMAP map;
+//   if (llimg_map_file (path, &map) == 0) {
+//     ... map.data [0 .. map.size - 1] ...
+//     llimg_unmap_file (&map);
+//   }
+//
+// A file's bytes can also be kept after the view goes, for decoding
+// again later.  Windows on the same file share one copy; it is freed
+// when the last lets go.  A file changed since it was kept is read
+// afresh.  Kept files are only touched on the window thread.
+//
+//   LLKEPT *kept = llimg_keep_file (path);
+//   if (kept) {
+//     ... kept->data [0 .. kept->size - 1] ...
+//     llimg_unkeep_file (kept);
+//   }
+//
+
+
+#ifndef MAPFILE_H
+#define MAPFILE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct LLMAP {
+  const unsigned char *data;  // The file's bytes
+  long size;                  // How many
+  int mapped;                 // 0 when data is a malloc'd copy
+};
+
+// Returns 0 and fills in *map, else -1
+int llimg_map_file (const char *path, struct LLMAP *map);
+
+// Releases the view; map->data is no longer good
+void llimg_unmap_file (struct LLMAP *map);
+
+struct LLKEPT {
+  const unsigned char *data;  // The file's bytes, a copy
+  long size;                  // How many
+  int refs;                   // Holders of this copy
+  char *path;                 // The file, as it was named
+  long stamp;                 // Its modified time when read
+  struct LLKEPT *next;
+};
+
+// The bytes of path, shared with anyone already keeping them; NULL if
+// it doesn't read
+struct LLKEPT *llimg_keep_file (const char *path);
+
+// Lets go of kept; its bytes go with the last holder
+void llimg_unkeep_file (struct LLKEPT *kept);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
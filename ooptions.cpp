@@ -74,6 +74,11 @@ int OOptions::default_options () {
 
   reduction = 8;
 
+  pool_mb = 64;
+  budget_mb = 512;
+  keep_source = 0;
+  keep_palette = 1;
+
   osvi.dwOSVersionInfoSize = sizeof (OSVERSIONINFO);
   GetVersionEx (&osvi);
   
@@ -61,6 +61,11 @@ public:
 
   int reduction;           // rd: global reduction denominator 2-9
 
+  int pool_mb;             // pm: MB of let go image memory kept for reuse
+  int budget_mb;           // bm: MB of images held before full sizes go, 0 any
+  int keep_source;         // ks: flag -- keep files' bytes, decode as shown
+  int keep_palette;        // kp: flag -- 8 bit images reduce to 8 bit
+
   OSVERSIONINFO osvi;
 
   int default_options ();
@@ -0,0 +1,247 @@
+/*******************************************************************************
+ * Copyright 2002, 2003, 2004, 2005, 2006, 2012 Kent Stork
+ *
+ * palette.cpp is part of Osiva.
+ *
+ * Osiva is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Osiva is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Osiva.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// File: palette.cpp
+//
+// Keeping 8 bit images 8 bit as they are reduced and resized.  The
+// kernels average in BGR, as they must, and then look each average up
+// in an inverse of the image's color table: a cube of 32 levels a side
+// holding, for each cell, the table entry nearest its center.  An
+// entry whose color falls in a cell gets that cell, so that flat areas
+// keep their index.  The cube takes some milliseconds to make, so the
+// last few are kept, found by their color table; the reductions and
+// resizes of one image, which come one after another, make it once.
+// Each user holds the cube it was given until llimg_release_inverse,
+// so one pushed off the cache meanwhile is freed by its last user.
+// The decoders resize too, so the cache is locked.
+//
+// A gray JPEG's table is its own inverse, each index its own level, so
+// those are averaged as they lie and need no cube at all.
+//
+// Both are on unless llimg_keep_palette turns them off, when 8 bit
+// images come out 24 bit as they used to.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "ll_image.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#define CUBE_BITS 5
+#define CUBE_SIDE (1 << CUBE_BITS)
+#define CUBE_SHIFT (8 - CUBE_BITS)
+#define CUBE_SLOTS 4
+
+struct inverse_cube {
+  struct bgr_color color[256];     /* the table it inverts */
+  int refs;                        /* the cache, if on it, and each user */
+  unsigned char cell[CUBE_SIDE * CUBE_SIDE * CUBE_SIDE];
+};
+
+static struct inverse_cube *cube_cache[CUBE_SLOTS];
+static int cube_next = 0;
+static int keep_palette = 1;
+
+#ifdef _WIN32
+static volatile LONG cube_busy = 0;
+#define CUBE_LOCK() while (InterlockedExchange (&cube_busy, 1)) Sleep (0)
+#define CUBE_UNLOCK() InterlockedExchange (&cube_busy, 0)
+#else
+static pthread_mutex_t cube_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define CUBE_LOCK() pthread_mutex_lock (&cube_mutex)
+#define CUBE_UNLOCK() pthread_mutex_unlock (&cube_mutex)
+#endif
+
+#define CUBE_CELL(b, g, r) ((((r) >> CUBE_SHIFT) << (2 * CUBE_BITS))  \
+                            | (((g) >> CUBE_SHIFT) << CUBE_BITS)      \
+                            | ((b) >> CUBE_SHIFT))
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Sets whether 8 bit images stay 8 bit (1) or go 24 bit (0)
+
+extern "C" void
+llimg_keep_palette (int on)
+{
+  keep_palette = on;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// What an 8 bit image reduces or resizes to: LLIMG_KEEP_GRAY if its
+// table is the gray ramp, LLIMG_KEEP_INDEX if it is any other, or 0
+// when it is to go to 24 bit
+
+extern "C" int
+llimg_palette_kind (const LLIMG *image)
+{
+  int i;
+
+  if (!keep_palette || image->bits_per_pixel != 8)
+    return 0;
+  for (i = 0; i < 256; i++) {
+    if (image->color[i].blue != i || image->color[i].green != i
+        || image->color[i].red != i)
+      return LLIMG_KEEP_INDEX;
+  }
+  return LLIMG_KEEP_GRAY;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Makes the cube for color, as said at the top
+
+static struct inverse_cube *
+cube_build (const struct bgr_color *color)
+{
+  struct inverse_cube *cube;
+  unsigned char entry[256];
+  int n, i, j, b, g, r, db, dg, dr, d, best, best_d;
+  int half = (1 << CUBE_SHIFT) / 2;
+  unsigned char *cp;
+
+  cube = (struct inverse_cube *) malloc (sizeof (struct inverse_cube));
+  if (!cube)
+    return NULL;
+  memcpy (cube->color, color, sizeof (cube->color));
+
+  // Each color once, at its first index
+  n = 0;
+  for (i = 0; i < 256; i++) {
+    for (j = 0; j < n; j++) {
+      if (color[entry[j]].blue == color[i].blue
+          && color[entry[j]].green == color[i].green
+          && color[entry[j]].red == color[i].red)
+        break;
+    }
+    if (j == n)
+      entry[n++] = (unsigned char) i;
+  }
+
+  cp = cube->cell;
+  for (r = 0; r < CUBE_SIDE; r++) {
+    for (g = 0; g < CUBE_SIDE; g++) {
+      for (b = 0; b < CUBE_SIDE; b++) {
+        best = 0;
+        best_d = 0x7fffffff;
+        for (j = 0; j < n; j++) {
+          dr = color[entry[j]].red - ((r << CUBE_SHIFT) + half);
+          dg = color[entry[j]].green - ((g << CUBE_SHIFT) + half);
+          db = color[entry[j]].blue - ((b << CUBE_SHIFT) + half);
+          d = dr * dr + dg * dg + db * db;
+          if (d < best_d) {
+            best_d = d;
+            best = entry[j];
+          }
+        }
+        *cp++ = (unsigned char) best;
+      }
+    }
+  }
+
+  // The table's own colors come back as themselves, the first index
+  // winning a cell two share
+  for (j = n - 1; j >= 0; j--) {
+    i = entry[j];
+    cube->cell[CUBE_CELL (color[i].blue, color[i].green, color[i].red)] =
+      (unsigned char) i;
+  }
+  return cube;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// The inverse of image's color table, found again or made; NULL if
+// there is no memory for it.  Let go with llimg_release_inverse.
+
+extern "C" const unsigned char *
+llimg_inverse_palette (const LLIMG *image)
+{
+  struct inverse_cube *cube, *old;
+  int i;
+
+  CUBE_LOCK ();
+  for (i = 0; i < CUBE_SLOTS; i++) {
+    cube = cube_cache[i];
+    if (cube && !memcmp (cube->color, image->color, sizeof (cube->color))) {
+      cube->refs++;
+      CUBE_UNLOCK ();
+      return cube->cell;
+    }
+  }
+  CUBE_UNLOCK ();
+
+  cube = cube_build (image->color);
+  if (!cube)
+    return NULL;
+  cube->refs = 2;
+  CUBE_LOCK ();
+  old = cube_cache[cube_next];
+  cube_cache[cube_next] = cube;
+  cube_next = (cube_next + 1) % CUBE_SLOTS;
+  if (old && --old->refs)
+    old = NULL;
+  CUBE_UNLOCK ();
+  free (old);
+  return cube->cell;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Lets go of an inverse from llimg_inverse_palette; NULL is all right
+
+extern "C" void
+llimg_release_inverse (const unsigned char *inverse)
+{
+  struct inverse_cube *cube;
+
+  if (!inverse)
+    return;
+  cube = (struct inverse_cube *)
+    (inverse - offsetof (struct inverse_cube, cell));
+  CUBE_LOCK ();
+  if (--cube->refs)
+    cube = NULL;
+  CUBE_UNLOCK ();
+  free (cube);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// The indices of n BGR pixels, through an inverse from above
+
+extern "C" void
+llimg_index_row (const unsigned char *inverse, const unsigned char *bgr,
+                 unsigned char *out, int n)
+{
+  int x;
+
+  for (x = 0; x < n; x++, bgr += 3)
+    out[x] = inverse[CUBE_CELL (bgr[0], bgr[1], bgr[2])];
+}
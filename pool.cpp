@@ -0,0 +1,275 @@
+/*******************************************************************************
+ * Copyright 2002, 2003, 2004, 2005, 2006, 2012 Kent Stork
+ *
+ * pool.cpp is part of Osiva.
+ *
+ * Osiva is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Osiva is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Osiva.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// File: pool.cpp
+//
+// Where image rasters and the kernels' scratch rows come from.  A drag
+// that resizes a window makes and drops an image of nearly the same size
+// every step; rather than go back to the heap each time, blocks that
+// are let go are kept on a list for their size class and handed out
+// again.  Sizes are rounded up to a quarter of their power of two, so
+// an image a few pixels off the last one still fits its block.  No more
+// than the cap is kept, and blocks under POOL_MIN are not kept at all.
+//
+// Every block carries a header with its size, so llimg_pool_put needs
+// only the pointer.  Pixel data anywhere in the program comes from here
+// (llimg_free_data gives it back), so it is not to be free()'d.
+//
+// Blocks start on a cache line (LLIMG_ALIGN), and llimg_alloc_data, the
+// one place rasters are laid out, leaves LLIMG_SLACK bytes after the
+// last row so a vector load may run off the end of any row.  Rows keep
+// the DIB stride, since the data is painted as it lies.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ll_image.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#define POOL_MIN (16 * 1024)       /* smaller blocks go straight back */
+#define POOL_CLASSES (4 * 17)      /* quarter octaves, to 2 GB */
+#define POOL_CAP (64L * 1024 * 1024)
+
+union pool_head {
+  struct {
+    size_t bytes;                  /* the block, rounded to its class */
+    union pool_head *next;         /* on the free list */
+    void *raw;                     /* what malloc gave */
+  } h;
+  char line[LLIMG_ALIGN];          /* the block starts a cache line on */
+};
+
+static union pool_head *pool_free[POOL_CLASSES];
+static size_t pool_held = 0;       /* bytes on the free lists */
+static size_t pool_cap = POOL_CAP;
+
+// Decoder threads get and put too
+#ifdef _WIN32
+static volatile LONG pool_busy = 0;
+#define POOL_LOCK() while (InterlockedExchange (&pool_busy, 1)) Sleep (0)
+#define POOL_UNLOCK() InterlockedExchange (&pool_busy, 0)
+#else
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define POOL_LOCK() pthread_mutex_lock (&pool_mutex)
+#define POOL_UNLOCK() pthread_mutex_unlock (&pool_mutex)
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// The class bytes falls in, with bytes rounded up to it; -1 if it is
+// too small or too big to keep
+
+static int
+pool_class (size_t *bytes)
+{
+  size_t base = POOL_MIN, size;
+  int c;
+
+  if (*bytes < POOL_MIN)
+    return -1;
+  for (c = 0; c < POOL_CLASSES; c++) {
+    size = base + (c % 4 + 1) * (base / 4);
+    if (*bytes <= size) {
+      *bytes = size;
+      return c;
+    }
+    if (c % 4 == 3)
+      base *= 2;
+  }
+  return -1;
+}
+
+// Frees kept blocks, the biggest first, until held is under cap
+static void
+pool_trim (size_t cap)
+{
+  union pool_head *head;
+  int c;
+
+  for (c = POOL_CLASSES - 1; c >= 0 && pool_held > cap; c--) {
+    while (pool_free[c] && pool_held > cap) {
+      head = pool_free[c];
+      pool_free[c] = head->h.next;
+      pool_held -= head->h.bytes;
+      free (head->h.raw);
+    }
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// A block of at least bytes, or NULL.  Its contents are whatever they
+// were.
+
+extern "C" void *
+llimg_pool_get (long bytes)
+{
+  union pool_head *head = NULL;
+  size_t size;
+  void *raw;
+  int c;
+
+  if (bytes < 0)
+    return NULL;
+  size = (size_t) bytes;
+  c = pool_class (&size);
+  if (c >= 0) {
+    POOL_LOCK ();
+    head = pool_free[c];
+    if (head) {
+      pool_free[c] = head->h.next;
+      pool_held -= head->h.bytes;
+    }
+    POOL_UNLOCK ();
+  }
+  if (!head) {
+    raw = malloc (sizeof (union pool_head) + size + LLIMG_ALIGN - 1);
+    if (!raw)
+      return NULL;
+    head = (union pool_head *)
+      (((size_t) raw + LLIMG_ALIGN - 1) & ~(size_t) (LLIMG_ALIGN - 1));
+    head->h.bytes = size;
+    head->h.raw = raw;
+  }
+  return head + 1;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Takes back a block from llimg_pool_get; NULL is all right
+
+extern "C" void
+llimg_pool_put (void *block)
+{
+  union pool_head *head;
+  size_t size;
+  int c;
+
+  if (!block)
+    return;
+  head = (union pool_head *) block - 1;
+  size = head->h.bytes;
+  c = pool_class (&size);
+  if (c < 0 || head->h.bytes > pool_cap) {
+    free (head->h.raw);
+    return;
+  }
+  POOL_LOCK ();
+  pool_trim (pool_cap - head->h.bytes);
+  head->h.next = pool_free[c];
+  pool_free[c] = head;
+  pool_held += head->h.bytes;
+  POOL_UNLOCK ();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Sets how many bytes of let go blocks may be kept; 0 keeps none
+
+extern "C" void
+llimg_pool_cap (long bytes)
+{
+  POOL_LOCK ();
+  pool_cap = bytes > 0 ? (size_t) bytes : 0;
+  pool_trim (pool_cap);
+  POOL_UNLOCK ();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Lays out llimg's raster, width by height at bits_per_pixel as they are
+// set: rows at DIB stride from a cache line, with LLIMG_SLACK after the
+// last.  Fills in data and line, or leaves them NULL; 0 or -1.
+
+extern "C" int
+llimg_alloc_data (LLIMG *llimg)
+{
+  long stride, height;
+  int y;
+
+  stride = llimg_stride (llimg->width, llimg->bits_per_pixel);
+  height = llimg->height < 0 ? -llimg->height : llimg->height;
+  llimg->data = (unsigned char *)
+    llimg_pool_get (stride * height + LLIMG_SLACK);
+  llimg->line = (unsigned char **) malloc ((height ? height : 1)
+                                           * sizeof (unsigned char *));
+  if (!llimg->data || !llimg->line) {
+    llimg_pool_put (llimg->data);
+    free (llimg->line);
+    llimg->data = NULL;
+    llimg->line = NULL;
+    return -1;
+  }
+  for (y = 0; y < height; y++)
+    llimg->line[y] = llimg->data + y * stride;
+  return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Lets go of llimg's pixels.  A shared buf (see share.cpp) goes with
+// the last image on it.
+
+extern "C" void
+llimg_free_data (LLIMG *llimg)
+{
+  if (llimg->buf) {
+    if (--llimg->buf->refs <= 0) {
+      llimg_pool_put ((void *) (llimg->buf->data));
+      free ((void *) (llimg->buf));
+    }
+  }
+  else
+    llimg_pool_put ((void *) (llimg->data));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// A heap image with a raster of its own, not yet set.  The color table
+// is zero.
+
+LLIMG *
+llimg_alloc (int width, int height, int bits_per_pixel)
+{
+  LLIMG *llimg;
+
+  if (width <= 0 || height <= 0)
+    return NULL;
+  llimg = llimg_create_base ();
+  if (!llimg)
+    return NULL;
+  llimg->width = width;
+  llimg->height = height;
+  llimg->dib_height = -height;
+  llimg->bits_per_pixel = bits_per_pixel;
+  if (llimg_alloc_data (llimg)) {
+    free (llimg);
+    return NULL;
+  }
+  return llimg;
+}
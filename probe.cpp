@@ -0,0 +1,361 @@
+/*******************************************************************************
+ * Copyright 2002, 2003, 2004, 2005, 2006, 2012 Kent Stork
+ *
+ * probe.cpp is part of Osiva.
+ *
+ * Osiva is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Osiva is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Osiva.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// File: probe.cpp
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "probe.h"
+
+#define EXIF_MAX 0x10000    /* the most of an APP1 segment looked at */
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Big or little endian (TIFF "MM" or "II") unsigned values
+
+static unsigned
+get16 (const unsigned char *p, int motorola)
+{
+  if (motorola)
+    return (p[0] << 8) | p[1];
+  return p[0] | (p[1] << 8);
+}
+
+static unsigned long
+get32 (const unsigned char *p, int motorola)
+{
+  if (motorola)
+    return ((unsigned long) get16 (p, 1) << 16) | get16 (p + 2, 1);
+  return get16 (p, 0) | ((unsigned long) get16 (p + 2, 0) << 16);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Finds the orientation tag in IFD0 of an Exif APP1 segment, and the
+// thumbnail JPEG that IFD1 points to.  The segment is at pos in the
+// file.  Leaves the orientation 1 (normal) if there isn't a good one.
+
+static void
+read_exif (const unsigned char *seg, int len, long pos, struct LLPROBE *probe)
+{
+  const unsigned char *tiff, *ep;
+  int motorola, entries, i, tlen, tag;
+  unsigned long ifd, offset, length;
+  unsigned value;
+
+  if (len < 6 + 8 || memcmp (seg, "Exif\0\0", 6))
+    return;
+  tiff = seg + 6;
+  tlen = len - 6;
+  if (tiff[0] == 'M' && tiff[1] == 'M')
+    motorola = 1;
+  else if (tiff[0] == 'I' && tiff[1] == 'I')
+    motorola = 0;
+  else
+    return;
+  if (get16 (tiff + 2, motorola) != 42)
+    return;
+
+  ifd = get32 (tiff + 4, motorola);
+  if (ifd + 2 > (unsigned long) tlen)
+    return;
+  entries = get16 (tiff + ifd, motorola);
+  ep = tiff + ifd + 2;
+  for (i = 0; i < entries; i++, ep += 12) {
+    if (ep + 12 > tiff + tlen)
+      return;
+    if (get16 (ep, motorola) != 0x0112)
+      continue;
+    value = get16 (ep + 8, motorola);   // SHORT, left justified
+    if (value >= 1 && value <= 8)
+      probe->orientation = value;
+  }
+
+  // IFD1, after IFD0's entries, describes the thumbnail
+  ifd += 2 + 12 * entries;
+  if (ifd + 4 > (unsigned long) tlen)
+    return;
+  ifd = get32 (tiff + ifd, motorola);
+  if (ifd == 0 || ifd + 2 > (unsigned long) tlen)
+    return;
+  entries = get16 (tiff + ifd, motorola);
+  ep = tiff + ifd + 2;
+  offset = length = 0;
+  for (i = 0; i < entries; i++, ep += 12) {
+    if (ep + 12 > tiff + tlen)
+      break;
+    tag = get16 (ep, motorola);
+    if (tag == 0x0201)        // JPEGInterchangeFormat
+      offset = get32 (ep + 8, motorola);
+    else if (tag == 0x0202)   // JPEGInterchangeFormatLength
+      length = get32 (ep + 8, motorola);
+  }
+  if (length < 4 || offset > (unsigned long) tlen
+      || length > (unsigned long) tlen - offset)
+    return;
+  if (tiff[offset] != 0xFF || tiff[offset + 1] != 0xD8)
+    return;
+  probe->thumb_offset = pos + 6 + (long) offset;
+  probe->thumb_length = (long) length;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Walks the markers after SOI up to the first SOFn
+
+static int
+probe_jpeg (FILE *fp, struct LLPROBE *probe)
+{
+  unsigned char hdr[8];
+  unsigned char *seg;
+  int marker, len, c;
+  long pos;
+
+  probe->format = LLIMG_FMT_JPEG;
+  probe->orientation = 1;
+
+  for (;;) {
+    // Markers may be padded with any number of 0xFF's
+    c = getc (fp);
+    if (c != 0xFF)
+      return -1;
+    while ((c = getc (fp)) == 0xFF)
+      ;
+    if (c == EOF)
+      return -1;
+    marker = c;
+
+    // Standalone markers have no length
+    if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7))
+      continue;
+    if (marker == 0xD9 || marker == 0xDA)   // EOI or SOS before any SOF
+      return -1;
+
+    if (fread (hdr, 1, 2, fp) != 2)
+      return -1;
+    len = ((hdr[0] << 8) | hdr[1]) - 2;
+    if (len < 0)
+      return -1;
+
+    // SOFn, but not DHT (C4), JPG (C8) or DAC (CC)
+    if (marker >= 0xC0 && marker <= 0xCF
+        && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+      if (len < 6 || fread (hdr, 1, 6, fp) != 6)
+        return -1;
+      probe->height = (hdr[1] << 8) | hdr[2];
+      probe->width = (hdr[3] << 8) | hdr[4];
+      probe->bits_per_pixel = 8 * hdr[5];
+      probe->progressive = (marker == 0xC2 || marker == 0xC6
+                            || marker == 0xCA || marker == 0xCE);
+      return 0;
+    }
+
+    // APP1 may be the Exif block, with the orientation and a thumbnail
+    if (marker == 0xE1 && probe->orientation == 1 && !probe->thumb_length) {
+      pos = ftell (fp);
+      c = len < EXIF_MAX ? len : EXIF_MAX;
+      seg = new unsigned char[c];
+      if (fread (seg, 1, c, fp) != (size_t) c) {
+        delete [] seg;
+        return -1;
+      }
+      read_exif (seg, c, pos, probe);
+      delete [] seg;
+      len -= c;
+    }
+
+    if (len && fseek (fp, len, SEEK_CUR))
+      return -1;
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Reads the logical screen descriptor, then skips the color table and
+// any extensions to the first image descriptor, which is where the
+// decoder gets its size and the interlace flag.
+
+static int
+probe_gif (FILE *fp, struct LLPROBE *probe)
+{
+  unsigned char hdr[9];
+  int c, n;
+
+  probe->format = LLIMG_FMT_GIF;
+  probe->orientation = 1;
+  probe->bits_per_pixel = 8;
+
+  // Logical screen descriptor, after the 6 byte signature
+  if (fread (hdr, 1, 7, fp) != 7)
+    return -1;
+  probe->width = hdr[0] | (hdr[1] << 8);
+  probe->height = hdr[2] | (hdr[3] << 8);
+  probe->progressive = 0;
+  if (hdr[4] & 0x80)
+    fseek (fp, 3 * (1 << ((hdr[4] & 7) + 1)), SEEK_CUR);
+
+  for (;;) {
+    c = getc (fp);
+    if (c == 0x2C) {
+      if (fread (hdr, 1, 9, fp) != 9)
+        return 0;   // Keep the screen size
+      probe->width = hdr[4] | (hdr[5] << 8);
+      probe->height = hdr[6] | (hdr[7] << 8);
+      probe->progressive = (hdr[8] & 0x40) != 0;
+      return 0;
+    }
+    if (c != 0x21)
+      return 0;
+    // Extension: label, then sub-blocks to a zero length one
+    getc (fp);
+    while ((n = getc (fp)) > 0) {
+      if (fseek (fp, n, SEEK_CUR))
+        return 0;
+    }
+    if (n == EOF)
+      return 0;
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// The codec table, JPEG and GIF to start with
+
+extern "C" {
+LLIMG * read_jpeg_file_scaled ( char * filename, int max_w, int max_h );
+LLIMG * read_jpeg_data_scaled ( const unsigned char * data, long size,
+                                int max_w, int max_h );
+}
+LLIMG * read_gif_file ( char * filename );
+LLIMG * expandGif (unsigned char *idata, int filebytes);
+
+static LLIMG *
+read_jpeg (char *path, int max_w, int max_h)
+{
+  return read_jpeg_file_scaled (path, max_w, max_h);
+}
+
+static LLIMG *
+read_gif (char *path, int, int)
+{
+  return read_gif_file (path);
+}
+
+static LLIMG *
+read_jpeg_data (const unsigned char *data, long size, int max_w, int max_h)
+{
+  return read_jpeg_data_scaled (data, size, max_w, max_h);
+}
+
+// The decoder only reads its input
+static LLIMG *
+read_gif_data (const unsigned char *data, long size, int, int)
+{
+  return expandGif ((unsigned char *) data, (int) size);
+}
+
+static const unsigned char jpeg_magic[] = { 0xFF, 0xD8 };
+static const unsigned char gif87_magic[] = "GIF87a";
+static const unsigned char gif89_magic[] = "GIF89a";
+
+static struct LLCODEC codecs[LLIMG_CODECS_MAX] = {
+  { LLIMG_FMT_JPEG, "JPEG", jpeg_magic, 2, probe_jpeg, read_jpeg,
+    read_jpeg_data },
+  { LLIMG_FMT_GIF, "GIF", gif87_magic, 6, probe_gif, read_gif,
+    read_gif_data },
+  { LLIMG_FMT_GIF, "GIF", gif89_magic, 6, probe_gif, read_gif,
+    read_gif_data }
+};
+static int n_codecs = 3;
+
+int
+llimg_register_codec (const struct LLCODEC *codec)
+{
+  int i, n, found = 0;
+
+  if (codec->magic_len < 1 || codec->magic_len > LLIMG_SNIFF_BYTES)
+    return -1;
+  // The first of the format's entries takes the codec, the rest go
+  for (i = n = 0; i < n_codecs; i++) {
+    if (codecs[i].format != codec->format)
+      codecs[n++] = codecs[i];
+    else if (!found++)
+      codecs[n++] = *codec;
+  }
+  n_codecs = n;
+  if (found)
+    return 0;
+  if (n_codecs == LLIMG_CODECS_MAX)
+    return -1;
+  codecs[n_codecs++] = *codec;
+  return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// One read of the leading bytes picks the codec; only its header reader
+// runs, and only if it has one.
+
+int
+llimg_probe (const char *path, struct LLPROBE *probe)
+{
+  unsigned char head[LLIMG_SNIFF_BYTES];
+  const struct LLCODEC *codec;
+  FILE *fp;
+  int i, n, ret = -1;
+
+  memset (probe, 0, sizeof (struct LLPROBE));
+  if (!path || !*path)
+    return -1;
+  fp = fopen (path, "rb");
+  if (!fp)
+    return -1;
+
+  n = (int) fread (head, 1, LLIMG_SNIFF_BYTES, fp);
+  codec = NULL;
+  for (i = 0; i < n_codecs; i++) {
+    if (codecs[i].magic_len <= n
+        && !memcmp (head, codecs[i].magic, codecs[i].magic_len)) {
+      codec = &codecs[i];
+      break;
+    }
+  }
+
+  if (codec) {
+    probe->format = codec->format;
+    probe->orientation = 1;
+    if (!codec->probe)
+      ret = 0;
+    else if (!fseek (fp, codec->magic_len, SEEK_SET))
+      ret = codec->probe (fp, probe);
+  }
+
+  fclose (fp);
+  if (ret)
+    memset (probe, 0, sizeof (struct LLPROBE));
+  else
+    probe->codec = codec;
+  return ret;
+}
@@ -0,0 +1,97 @@
+/*******************************************************************************
+ * Copyright 2002, 2003, 2004, 2005, 2006, 2012 Kent Stork
+ *
+ * probe.h is part of Osiva.
+ *
+ * Osiva is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Osiva is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Osiva.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+///////////////////////////////////////////////////////////////////////////
+//
+// File: probe.h
+//
+// Reads just enough of an image file to say what it is and how big,
+// without decoding any of it: the markers of a JPEG up to its SOF, or
+// the header of a GIF up to its first image descriptor.  A JPEG's Exif
+// block also gives its orientation and where its thumbnail is.
+//
+// What a file is comes from its leading bytes, matched against a table
+// of codecs.  Each codec has a signature, an optional header reader and
+// the decoder to run; JPEG and GIF are built in, and others are added
+// with llimg_register_codec.  A file no codec claims is unknown, and no
+// decoder is tried on it.
+//
+// Synopsis:
+//
+// #include "probe.h"
+//
+//   LLPROBE probe;
+//   if (llimg_probe (path, &probe) == 0 && probe.codec->read)
+//     llimg = probe.codec->read (path, 0, 0);
+//
+
+
+#ifndef PROBE_H
+#define PROBE_H
+
+#include <stdio.h>
+#include "ll_image.h"
+
+enum { LLIMG_FMT_NONE, LLIMG_FMT_JPEG, LLIMG_FMT_GIF, LLIMG_FMT_LAYOUT };
+
+#define LLIMG_SNIFF_BYTES 32  // The most leading bytes a signature may use
+#define LLIMG_CODECS_MAX  16
+
+struct LLPROBE;
+
+struct LLCODEC {
+  int format;                   // LLIMG_FMT_..., or a new number
+  const char *name;
+  const unsigned char *magic;   // Signature at the start of the file
+  int magic_len;
+  // Fills in *probe from the header, fp just past the signature; 0 or -1.
+  // NULL when the signature says all there is to know.
+  int (*probe) (FILE *fp, struct LLPROBE *probe);
+  // Decodes the file, at least max_w by max_h when those aren't 0.
+  // NULL for a file that isn't an image.
+  LLIMG *(*read) (char *path, int max_w, int max_h);
+  // Decodes the file's bytes, already in memory, as read does.  NULL
+  // when the codec only reads files.
+  LLIMG *(*read_data) (const unsigned char *data, long size,
+                       int max_w, int max_h);
+};
+
+struct LLPROBE {
+  const struct LLCODEC *codec;  // Who handles it, NULL when unknown
+  int format;          // LLIMG_FMT_...
+  long width;          // Size the decoder will produce
+  long height;
+  int bits_per_pixel;  // As the decoder will produce, 8 or 24 (32: CMYK)
+  int progressive;     // Progressive JPEG, or interlaced GIF
+  int orientation;     // EXIF orientation, 1 - 8; 1 when there is none
+  long thumb_offset;   // Where the EXIF thumbnail JPEG is in the file,
+  long thumb_length;   // and how long; 0 when there is none
+};
+
+// Returns 0 and fills in *probe for a file some codec claims, else -1
+int llimg_probe (const char *path, struct LLPROBE *probe);
+
+// Adds a codec, or replaces every one with the same format (GIF has
+// one for each of its two signatures, so a new GIF codec's magic would
+// be "GIF8"); 0 or -1.  The codec is copied, but its magic and name
+// must stay put.
+int llimg_register_codec (const struct LLCODEC *codec);
+
+#endif
@@ -14,19 +14,13 @@
 //       is that the raster rows have to have a long aligned number
 //       of bytes (the number must be divisible by 4). This is a
 //       requirement of the Win32 API to display the raster array
-//       directly. The solution (for these stolen reading routines)
-//       is to find the place where the raster buffer is malloc'd,
-//       and to over allocate at that time if necessary, allocating
-//       4*((width+3)/4)*height, instead of the usual width*height.
-//
-//       Later, once the decompression code does its thing, we go
-//       back into the raster block and move the rows into long
-//       alignment.
-//
-//       By the way, the VC++ optimizations screw up the movement
-//       loop. Use "default" c/c++ optimizations settings for this.
-//       Do not use the "speed optimizations" that is preset for the
-//       release versions.
+//       directly. The raster comes from llimg_alloc_data at that
+//       stride, 4*((width+3)/4), and the decoder writes each row
+//       straight into its place: strings go out through a row
+//       pointer that nextRow moves down a stride at a time (or by
+//       the interlace passes), so nothing is moved afterwards.
+//       Only the pad bytes at the end of each row are cleared once
+//       the image is done.
 //
 /////////////////////////////////////////////////////////////////////////
 */
@@ -60,6 +54,7 @@
 #include <string.h>
 
 #include "ll_image.h"
+#include "mapfile.h"
 
 typedef int boolean;
 typedef unsigned char byte ;
@@ -67,7 +62,10 @@ typedef unsigned char byte ;
 #define True 1
 #define False 0
 
-#define NEXTBYTE (*dataptr++)
+/* Past the end of the file reads as zeros; dataptr still moves on, so
+ * the truncation checks against filesize see it.
+ */
+#define NEXTBYTE (g->dataptr < g->RawEnd ? *g->dataptr++ : (g->dataptr++, 0))
 #define EXTENSION     0x21
 #define IMAGESEP      0x2c
 #define TRAILER       0x3b
@@ -76,12 +74,20 @@ typedef unsigned char byte ;
 
 #define DEBUG False
 
+#ifdef _MSC_VER
+typedef unsigned __int64 bitbuf_t;
+#else
+typedef unsigned long long bitbuf_t;
+#endif
+
+
+/* All of the decoder's state, one per de_gif call */
 
-static 
-int BitOffset = 0,         /* Bit Offset of next code */
-XC = 0, YC = 0,            /* Output X and Y coords of current pixel */
-Pass = 0,                  /* Used by output routine if interlaced pic */
-OutCount = 0,              /* Decompressor output 'stack count' */
+struct gif_ctx {
+
+int BitCount,              /* Bits waiting in BitBuf */
+XC, YC,                    /* Output X and Y coords of current pixel */
+Pass,                      /* Used by output routine if interlaced pic */
 RWidth, RHeight,           /* screen dimensions */
 Width, Height,             /*  image dimensions */
 LeftOfs, TopOfs,           /* image offset */
@@ -95,34 +101,55 @@ Code,                      /* Value returned by ReadCode */
 MaxCode,                   /* limiting value for current code size */
 ClearCode,                 /* GIF clear code */
 EOFCode,                   /* GIF end-of-information code */
-CurCode, OldCode, InCode,  /* Decompressor variables */
+OldCode,                   /* Previous code, -1 after a clear */
 FirstFree,                 /* First free code, generated per GIF spec */
 FreeCode,                  /* Decompressor,next free slot in hash table */
-FinChar,                   /* Decompressor variable */
 BitMask,                   /* AND mask for data size */
 ReadMask,                  /* Code AND mask for current code size */
 Misc;                      /* miscellaneous bits (interlace, local cmap)*/
 
-static int numcols, normaspect ;
-static char * comment ;
+int numcols, normaspect ;
+char * comment ;
+
+boolean Interlace, HasColormap;
+
+/* The caller's copy of the file, and the image we decode it into */
+
+byte *RawGIF;      /* The heap array to hold it, raw */
+byte *RawEnd;      /* One past its last byte */
+byte *pic8;        /* xv's standard 8 bit image, rows long aligned */
+int   Stride;      /* bytes per pic8 row */
 
+/* The string table.  Each code also knows its string's length and first
+ * character, so a string can be written backwards straight into place.
+ */
+unsigned short Prefix[4096];
+byte Suffix[4096];
+unsigned short Length[4096];
+byte First[4096];
+
+/* Strings that cross a row, or run off the image, are built here */
+byte Stack[4096];
 
-static boolean Interlace, HasColormap;
+/* The code input: the raster data sub-blocks, read in place at
+ * dataptr and fed 64 bits at a time.
+ */
+int BlockLeft;     /* bytes left in the current sub-block */
+boolean BlockEnd;  /* the terminating empty sub-block has been read */
+bitbuf_t BitBuf;
 
-/* The following three items are large malloc's */
+/* Start of the output row YC */
+byte *Row;
 
-static byte *RawGIF;      /* The heap array to hold it, raw */
-static byte *Raster;      /* The raster data stream, unblocked */
-static byte *pic8;        /* xv's standard 8 bit image */
+int   gif89;
 
-/* The hash table used by the decompressor */
-static int Prefix[4096];
-static int Suffix[4096];
+int   filesize;
+char *bname;
 
-/* An output array used by the decompressor */
-static int OutCode[4097];
+byte *dataptr;
+
+};
 
-static int   gif89 = 0;
 static char *id87 = "GIF87a";
 static char *id89 = "GIF89a";
 
@@ -133,33 +160,33 @@ static int EGApalette[16][3] = {
   {255,100,100}, {255,100,255}, {255,255,100}, {255,255,255} };
 
 
-  static int   readImage   (LLIMG *);
-  static int   readCode    (void);
-  static void  doInterlace (int);
-  static void * gifError    (char *);
-  static void  gifWarning  (char *);
-
-  static int   filesize;
-  static char *bname;
+  static int   readImage   (struct gif_ctx *, LLIMG *);
+  static int   readCode    (struct gif_ctx *);
+  static void  putString   (struct gif_ctx *, int, int);
+  static void  nextRow     (struct gif_ctx *);
+  static void  nextBlock   (struct gif_ctx *);
+  static void * gifError    (struct gif_ctx *, char *);
+  static void  gifWarning  (struct gif_ctx *, char *);
 
-  static byte *dataptr;
 
 /*///////////////////////////////////////////////////////////////////////
  *
 /////////////////////////////////////////////////////////////////////////
 */
 
-int 
-de_gif (unsigned char *gifdata, int gifbytes, LLIMG *hImage)
+static int 
+decode_gif (struct gif_ctx *g, unsigned char *gifdata, int gifbytes,
+            LLIMG *hImage)
 {
  register byte ch, *origptr;
  register int i, block;
  int aspect, gotimage;
 
  /* initialize variables */
- BitOffset = XC = YC = Pass = OutCount = gotimage = 0;
- RawGIF = Raster = pic8 = NULL;
- gif89 = 0;
+ g->BitCount = g->XC = g->YC = g->Pass = gotimage = 0;
+ g->BitBuf = 0;
+ g->RawGIF = g->pic8 = NULL;
+ g->gif89 = 0;
 
 
  llimg_zero_llimg (hImage);
@@ -169,54 +196,58 @@ de_gif (unsigned char *gifdata, int gifbytes, LLIMG *hImage)
  hImage->data = NULL;
  hImage->line = NULL;
 
- comment = (char *) NULL;
+ g->comment = (char *) NULL;
+
+ g->dataptr = g->RawGIF = gifdata;
+ g->filesize = gifbytes;
+ g->RawEnd = gifdata + gifbytes;
 
- dataptr = RawGIF = gifdata;
- filesize = gifbytes;
+ origptr = g->dataptr;
 
- origptr = dataptr;
+ if (gifbytes < 13)              /* signature and screen descriptor */
+  return 1;
 
- if (strncmp ((char *) dataptr, id87, (size_t) 6) == 0)
-  gif89 = 0;
- else if (strncmp ((char *) dataptr, id89, (size_t) 6) == 0)
-  gif89 = 1;
+ if (strncmp ((char *) g->dataptr, id87, (size_t) 6) == 0)
+  g->gif89 = 0;
+ else if (strncmp ((char *) g->dataptr, id89, (size_t) 6) == 0)
+  g->gif89 = 1;
  else
   return 1;
 
- dataptr += 6;
+ g->dataptr += 6;
 
  /* Get variables from the GIF screen descriptor */
 
  ch = NEXTBYTE;
- RWidth = ch + 0x100 * NEXTBYTE;        /* screen dimensions... not used. */
+ g->RWidth = ch + 0x100 * NEXTBYTE;        /* screen dimensions... not used. */
  ch = NEXTBYTE;
- RHeight = ch + 0x100 * NEXTBYTE;
+ g->RHeight = ch + 0x100 * NEXTBYTE;
 
  ch = NEXTBYTE;
- HasColormap = ((ch & COLORMAPMASK) ? True : False);
+ g->HasColormap = ((ch & COLORMAPMASK) ? True : False);
 
- BitsPerPixel = (ch & 7) + 1;
- numcols = ColorMapSize = 1 << BitsPerPixel;
- BitMask = ColorMapSize - 1;
+ g->BitsPerPixel = (ch & 7) + 1;
+ g->numcols = g->ColorMapSize = 1 << g->BitsPerPixel;
+ g->BitMask = g->ColorMapSize - 1;
 
- Background = NEXTBYTE;         /* background color... not used. */
+ g->Background = NEXTBYTE;         /* background color... not used. */
 
  aspect = NEXTBYTE;
  if (aspect)
    {
-    if (!gif89)
+    if (!g->gif89)
      return (1);
     else
-     normaspect = (aspect + 15) / 64;   /* gif89 aspect ratio */
+     g->normaspect = (aspect + 15) / 64;   /* gif89 aspect ratio */
     if (DEBUG)
-     fprintf (stderr, "GIF89 aspect = %f\n", normaspect);
+     fprintf (stderr, "GIF89 aspect = %f\n", g->normaspect);
    }
 
 
  /* Read in global colormap. */
 
- if (HasColormap)
-  for (i = 0; i < ColorMapSize; i++)
+ if (g->HasColormap)
+  for (i = 0; i < g->ColorMapSize; i++)
     {
      hImage->color[i].red = NEXTBYTE;
      hImage->color[i].green = NEXTBYTE;
@@ -271,16 +302,16 @@ de_gif (unsigned char *gifdata, int gifbytes, LLIMG *hImage)
              aspnum = NEXTBYTE;
              aspden = NEXTBYTE;
              if (aspden > 0 && aspnum > 0)
-              normaspect = aspnum / aspden;
+              g->normaspect = aspnum / aspden;
              else
                {
-                normaspect = 1;
+                g->normaspect = 1;
                 aspnum = aspden = 1;
                }
 
              if (DEBUG)
               fprintf (stderr, "GIF87 aspect extension: %d:%d = %f\n\n",
-                       aspnum, aspden, normaspect);
+                       aspnum, aspden, g->normaspect);
             }
           else
             {
@@ -303,7 +334,7 @@ de_gif (unsigned char *gifdata, int gifbytes, LLIMG *hImage)
           byte *ptr1, *cmt, *cmt1, *sp;
 
           cmtlen = 0;
-          ptr1 = dataptr;       /* remember start of comments */
+          ptr1 = g->dataptr;       /* remember start of comments */
 
           /* figure out length of comment */
           do
@@ -320,39 +351,39 @@ de_gif (unsigned char *gifdata, int gifbytes, LLIMG *hImage)
             {                   /* build into one un-blocked comment */
              cmt = (byte *) malloc ((size_t) (cmtlen + 1));
              if (!cmt)
-              gifWarning ("couldn't malloc space for comments\n");
+              gifWarning (g, "couldn't malloc space for comments\n");
              else
                {
                 sp = cmt;
                 do
                   {
-                   sbsize = (*ptr1++);
+                   sbsize = (ptr1 < g->RawEnd) ? *ptr1++ : 0;
                    for (j = 0; j < sbsize; j++, sp++, ptr1++)
-                    *sp = *ptr1;
+                    *sp = (ptr1 < g->RawEnd) ? *ptr1 : 0;
                   }
                 while (sbsize);
                 *sp = '\0';
 
-                if (comment)
+                if (g->comment)
                   {             /* have to strcat onto old comments */
-                   cmt1 = (byte *) malloc (strlen (comment) + cmtlen + 2);
+                   cmt1 = (byte *) malloc (strlen (g->comment) + cmtlen + 2);
                    if (!cmt1)
                      {
-                      gifWarning ("couldn't malloc space for comments\n");
+                      gifWarning (g, "couldn't malloc space for comments\n");
                       free (cmt);
                      }
                    else
                      {
-                      strcpy ((char *) cmt1, (char *) comment);
+                      strcpy ((char *) cmt1, (char *) g->comment);
                       strcat ((char *) cmt1, (char *) "\n");
                       strcat ((char *) cmt1, (char *) cmt);
-                      free (comment);
+                      free (g->comment);
                       free (cmt);
-                      comment = (char *) cmt1;
+                      g->comment = (char *) cmt1;
                      }
                   }
                 else
-                 comment = (char *) cmt;
+                 g->comment = (char *) cmt;
                }                /* if (cmt) */
             }                   /* if cmtlen>0 */
          }                      /* comment extension */
@@ -486,7 +517,7 @@ de_gif (unsigned char *gifdata, int gifbytes, LLIMG *hImage)
        if (DEBUG)
         fprintf (stderr, "imagesep (got=%d)  ", gotimage);
        if (DEBUG)
-        fprintf (stderr, "  at start: offset=0x%lx\n", dataptr - RawGIF);
+        fprintf (stderr, "  at start: offset=0x%lx\n", g->dataptr - g->RawGIF);
 
        if (gotimage)
          {                      /* just skip over remaining images */
@@ -521,17 +552,17 @@ de_gif (unsigned char *gifdata, int gifbytes, LLIMG *hImage)
              ch = ch1 = NEXTBYTE;
              while (ch--)
               NEXTBYTE;
-             if ((dataptr - RawGIF) > filesize)
+             if ((g->dataptr - g->RawGIF) > g->filesize)
               break;            /* EOF */
             }
           while (ch1);
          }
 
-       else if (readImage (hImage))
+       else if (readImage (g, hImage))
         gotimage = 1;
 
        if (DEBUG)
-        fprintf (stderr, "  at end:   dataptr=0x%lx\n", dataptr - RawGIF);
+        fprintf (stderr, "  at end:   dataptr=0x%lx\n", g->dataptr - g->RawGIF);
 
       }                         /* block == IMAGESEP */
 
@@ -551,15 +582,15 @@ de_gif (unsigned char *gifdata, int gifbytes, LLIMG *hImage)
         fprintf (stderr, "block type 0x%02x  ", block);
 
        /* don't mention bad block if file was trunc'd, as it's all bogus */
-       if ((dataptr - origptr) < filesize)
+       if ((g->dataptr - origptr) < g->filesize)
          {
           sprintf (str, "Unknown block type (0x%02x) at offset 0x%lx",
-                   block, (dataptr - origptr) - 1);
+                   block, (g->dataptr - origptr) - 1);
 
           if (!gotimage)
            return (1);
           else
-           gifWarning (str);
+           gifWarning (g, str);
          }
 
        break;
@@ -569,9 +600,6 @@ de_gif (unsigned char *gifdata, int gifbytes, LLIMG *hImage)
      fprintf (stderr, "\n");
    }
 
- free (Raster);
- Raster = NULL;
-
  if (!gotimage)
   return (1);
 
@@ -579,39 +607,62 @@ de_gif (unsigned char *gifdata, int gifbytes, LLIMG *hImage)
 }
 
 
+/*///////////////////////////////////////////////////////////////////////
+ *
+/////////////////////////////////////////////////////////////////////////
+*/
+
+/* Each call decodes with its own context, so any number can run at once */
+
+int 
+de_gif (unsigned char *gifdata, int gifbytes, LLIMG *hImage)
+{
+  struct gif_ctx *g;
+  int ret;
+
+  g = (struct gif_ctx *) calloc (1, sizeof (struct gif_ctx));
+  if (!g)
+    return 1;
+  ret = decode_gif (g, gifdata, gifbytes, hImage);
+  free (g->comment);
+  free (g);
+  return ret;
+}
+
+
 /*///////////////////////////////////////////////////////////////////////
  *
 /////////////////////////////////////////////////////////////////////////
 */
 
 static int 
-readImage (LLIMG * hImage)
+readImage (struct gif_ctx *g, LLIMG * hImage)
 {
- register byte ch, ch1, *ptr1, *picptr, *cp, *op, *np;
- int i, y, npixels, maxpixels, aWidth, padbytes;
+ register byte ch;
+ int i, y, len, npixels, maxpixels, aWidth, padbytes;
 
  npixels = maxpixels = 0;
 
  /* read in values from the image descriptor */
 
  ch = NEXTBYTE;
- LeftOfs = ch + 0x100 * NEXTBYTE;
+ g->LeftOfs = ch + 0x100 * NEXTBYTE;
  ch = NEXTBYTE;
- TopOfs = ch + 0x100 * NEXTBYTE;
+ g->TopOfs = ch + 0x100 * NEXTBYTE;
  ch = NEXTBYTE;
- Width = ch + 0x100 * NEXTBYTE;
+ g->Width = ch + 0x100 * NEXTBYTE;
  ch = NEXTBYTE;
- Height = ch + 0x100 * NEXTBYTE;
+ g->Height = ch + 0x100 * NEXTBYTE;
 
- hImage->width = Width;
- hImage->height = Height;
+ hImage->width = g->Width;
+ hImage->height = g->Height;
 
- Misc = NEXTBYTE;
- Interlace = ((Misc & INTERLACEMASK) ? True : False);
+ g->Misc = NEXTBYTE;
+ g->Interlace = ((g->Misc & INTERLACEMASK) ? True : False);
 
- if (Misc & 0x80)
+ if (g->Misc & 0x80)
    {
-    for (i = 0; i < 1 << ((Misc & 7) + 1); i++)
+    for (i = 0; i < 1 << ((g->Misc & 7) + 1); i++)
       {
        hImage->color[i].red = NEXTBYTE;
        hImage->color[i].green = NEXTBYTE;
@@ -620,7 +671,7 @@ readImage (LLIMG * hImage)
    }
 
 
- if (!HasColormap && !(Misc & 0x80))
+ if (!g->HasColormap && !(g->Misc & 0x80))
    {
     /* no global or local colormap */
     /* // SetISTR(ISTR_WARNING, "%s:  %s", bname, */
@@ -633,11 +684,13 @@ readImage (LLIMG * hImage)
   * and compute decompressor constant values, based on this code size.
   */
 
- CodeSize = NEXTBYTE;
+ g->CodeSize = NEXTBYTE;
+ if (g->CodeSize < 1 || g->CodeSize > 8)
+  return ((int) gifError (g, "bad LZW code size"));
 
- ClearCode = (1 << CodeSize);
- EOFCode = ClearCode + 1;
- FreeCode = FirstFree = ClearCode + 2;
+ g->ClearCode = (1 << g->CodeSize);
+ g->EOFCode = g->ClearCode + 1;
+ g->FreeCode = g->FirstFree = g->ClearCode + 2;
 
  /* The GIF spec has it that the code size is the code size used to
   * compute the above values is the code size given in the file, but the
@@ -645,40 +698,10 @@ readImage (LLIMG * hImage)
   * the file plus one. (thus the ++).
   */
 
- CodeSize++;
- InitCodeSize = CodeSize;
- MaxCode = (1 << CodeSize);
- ReadMask = MaxCode - 1;
-
-
-
-
- /* UNBLOCK:
-  * Read the raster data.  Here we just transpose it from the GIF array
-  * to the Raster array, turning it from a series of blocks into one long
-  * data stream, which makes life much easier for readCode().
-  */
-
- if (!(Raster = (byte *) calloc ((size_t) filesize + 256, (size_t) 1)))
-  return ((int) gifError ("not enough memory to rasterize gif file"));
-
- ptr1 = Raster;
- do
-   {
-    ch = ch1 = NEXTBYTE;
-    while (ch--)
-      {
-       *ptr1 = NEXTBYTE;
-       ptr1++;
-      }
-    if ((dataptr - RawGIF) > filesize)
-      {
-       /* // SetISTR(ISTR_WARNING,"%s:  %s", bname, */
-       /* //     "This GIF file seems to be truncated.  Winging it."); */
-       break;
-      }
-   }
- while (ch1);
+ g->CodeSize++;
+ g->InitCodeSize = g->CodeSize;
+ g->MaxCode = (1 << g->CodeSize);
+ g->ReadMask = g->MaxCode - 1;
 
 
 
@@ -687,7 +710,7 @@ readImage (LLIMG * hImage)
    {
     fprintf (stderr,
              "xv: LoadGIF() - picture is %dx%d, %d bits, %sinterlaced\n",
-             Width, Height, BitsPerPixel, Interlace ? "" : "non-");
+             g->Width, g->Height, g->BitsPerPixel, g->Interlace ? "" : "non-");
    }
 
 
@@ -696,128 +719,99 @@ readImage (LLIMG * hImage)
  /* KWS: Allocate enough room to long align the rows, since this is to be used */
  /* to directly view as a Microsoft DIB, which needs long aligned rows */
 
- maxpixels = Width * Height;
- aWidth = 4 * ((Width + 3) / 4);        /* // KWS */
- picptr = pic8 = (byte *) malloc ((size_t) (aWidth * Height));
- if (!pic8)
-  return ((int) gifError ("couldn't malloc 'pic8'"));
+ maxpixels = g->Width * g->Height;
+ aWidth = 4 * ((g->Width + 3) / 4);        /* // KWS */
+ g->Stride = aWidth;
+ hImage->width = g->Width;
+ hImage->height = g->Height;
+ hImage->dib_height = -g->Height;
+ if (llimg_alloc_data (hImage))
+  return ((int) gifError (g, "couldn't malloc 'pic8'"));
+ g->pic8 = hImage->data;
+
+ /* An interlaced image that comes up short leaves holes, not garbage */
+ if (g->Interlace)
+  memset (g->pic8, 0, (size_t) (aWidth * g->Height));
 
 
  /* Decompress the file, continuing until you see the GIF EOF code.
-  * One obvious enhancement is to add checking for corrupt files here.
+  * Codes below ClearCode stand for themselves; each new code is an old
+  * string plus one character, and is entered with its length and first
+  * character before it is written, which covers the KwKwK case too.
   */
 
- Code = readCode ();
- while (Code != EOFCode)
+ for (i = 0; i < g->ClearCode; i++)
    {
-    /* Clear code sets everything back to its initial value, then reads the
-     * immediately subsequent code as uncompressed data.
+    g->Prefix[i] = 0;
+    g->Suffix[i] = g->First[i] = (byte) i;
+    g->Length[i] = 1;
+   }
+
+ g->BlockLeft = 0;
+ g->BlockEnd = False;
+ g->Row = g->pic8;
+ g->OldCode = -1;
+
+ g->Code = readCode (g);
+ while (g->Code != g->EOFCode)
+   {
+    /* Clear code sets everything back to its initial value; the next
+     * code has no string before it.
      */
 
-    if (Code == ClearCode)
+    if (g->Code == g->ClearCode)
       {
-       CodeSize = InitCodeSize;
-       MaxCode = (1 << CodeSize);
-       ReadMask = MaxCode - 1;
-       FreeCode = FirstFree;
-       Code = readCode ();
-       CurCode = OldCode = Code;
-       FinChar = CurCode & BitMask;
-       if (!Interlace)
-        *picptr++ = FinChar;
-       else
-        doInterlace (FinChar);
-       npixels++;
+       g->CodeSize = g->InitCodeSize;
+       g->MaxCode = (1 << g->CodeSize);
+       g->ReadMask = g->MaxCode - 1;
+       g->FreeCode = g->FirstFree;
+       g->OldCode = -1;
       }
     else
       {
-       /* If not a clear code, must be data: save same as CurCode and InCode */
-
-       /* if we're at maxcode and didn't get a clear, stop loading */
-       if (FreeCode >= 4096)
-         {                      /* printf("freecode blew up\n"); */
-          break;
-         }
-
-       CurCode = InCode = Code;
-
-       /* If greater or equal to FreeCode, not in the hash table yet;
-        * repeat the last character decoded
-        */
-
-       if (CurCode >= FreeCode)
+       if (g->OldCode < 0)
          {
-          CurCode = OldCode;
-          if (OutCount > 4096)
-            {                   /* printf("outcount1 blew up\n"); */
-             break;
-            }
-          OutCode[OutCount++] = FinChar;
+          if (g->Code >= g->ClearCode)
+           break;                        /* corrupt file */
          }
-
-       /* Unless this code is raw data, pursue the chain pointed to by CurCode
-        * through the hash table to its end; each code in the chain puts its
-        * associated output code on the output queue.
-        */
-
-       while (CurCode > BitMask)
+       else
          {
-          if (OutCount > 4096)
-           break;               /* corrupt file */
-          OutCode[OutCount++] = Suffix[CurCode];
-          CurCode = Prefix[CurCode];
-         }
+          if (g->Code > g->FreeCode)
+           break;                        /* corrupt file */
 
-       if (OutCount > 4096)
-         {                      /* printf("outcount blew up\n"); */
-          break;
+          /* A full table is left alone until the next clear */
+          if (g->FreeCode < 4096)
+            {
+             g->Prefix[g->FreeCode] = g->OldCode;
+             g->Suffix[g->FreeCode] = (g->Code == g->FreeCode) ?
+               g->First[g->OldCode] : g->First[g->Code];
+             g->Length[g->FreeCode] = g->Length[g->OldCode] + 1;
+             g->First[g->FreeCode] = g->First[g->OldCode];
+
+             /* If we reach the current MaxCode value, increment the code
+              * size unless it's already 12.
+              */
+
+             g->FreeCode++;
+             if (g->FreeCode >= g->MaxCode && g->CodeSize < 12)
+               {
+                g->CodeSize++;
+                g->MaxCode *= 2;
+                g->ReadMask = g->MaxCode - 1;
+               }
+            }
          }
 
-       /* The last code in the chain is treated as raw data. */
-
-       FinChar = CurCode & BitMask;
-       OutCode[OutCount++] = FinChar;
-
-       /* Now we put the data out to the Output routine.
-        * It's been stacked LIFO, so deal with it that way...
-        */
-
        /* safety thing:  prevent exceeding range of 'pic8' */
-       if (npixels + OutCount > maxpixels)
-        OutCount = maxpixels - npixels;
-
-       npixels += OutCount;
-       if (!Interlace)
-        for (i = OutCount - 1; i >= 0; i--)
-         *picptr++ = OutCode[i];
-       else
-        for (i = OutCount - 1; i >= 0; i--)
-         doInterlace (OutCode[i]);
-       OutCount = 0;
+       len = g->Length[g->Code];
+       if (len > maxpixels - npixels)
+        len = maxpixels - npixels;
 
-       /* Build the hash table on-the-fly. No table is stored in the file. */
-
-       Prefix[FreeCode] = OldCode;
-       Suffix[FreeCode] = FinChar;
-       OldCode = InCode;
-
-       /* Point to the next slot in the table.  If we exceed the current
-        * MaxCode value, increment the code size unless it's already 12.  If it
-        * is, do nothing: the next code decompressed better be CLEAR
-        */
-
-       FreeCode++;
-       if (FreeCode >= MaxCode)
-         {
-          if (CodeSize < 12)
-            {
-             CodeSize++;
-             MaxCode *= 2;
-             ReadMask = (1 << CodeSize) - 1;
-            }
-         }
+       putString (g, g->Code, len);
+       npixels += len;
+       g->OldCode = g->Code;
       }
-    Code = readCode ();
+    g->Code = readCode (g);
     if (npixels >= maxpixels)
      break;
    }
@@ -826,42 +820,33 @@ readImage (LLIMG * hImage)
    {
     /* // SetISTR(ISTR_WARNING,"%s:  %s", bname, */
     /* //    "This GIF file seems to be truncated.  Winging it."); */
-    if (!Interlace)             /* clear->EOBuffer */
-     memset ((char *) pic8 + npixels, 0, (size_t) (maxpixels - npixels));
+    if (!g->Interlace)             /* clear->EOBuffer */
+     memset (g->Row + g->XC, 0,
+             (size_t) (g->pic8 + aWidth * g->Height - (g->Row + g->XC)));
    }
 
- /* // Long align if we need to, by moving and filling */
- /* // The space was already made during the malloc of pic8 */
+ /* Skip whatever is left of the raster data, up to its terminator */
 
- if (Width != aWidth)
+ g->dataptr += g->BlockLeft;
+ g->BlockLeft = 0;
+ while (!g->BlockEnd)
    {
-    padbytes = aWidth - Width;
-    op = pic8 + (Height - 1) * Width;
-    np = pic8 + (Height - 1) * aWidth;
-    for (y = Height - 1; y >= 0; y--)
-      {
-       memmove (np, op, Width);
-       memset (np + Width, 0, padbytes);
-       op -= Width;
-       np -= aWidth;
-      }
-   }                            /* // Width !='d aWidth */
-
- /* fill in the PICINFO structure */
- /* Which is now the LLIMG structure */
-
- hImage->width = Width;
- hImage->height = Height;
- hImage->dib_height = -Height;
- hImage->data = pic8;
- hImage->line = (byte **) malloc (hImage->height * sizeof (byte *));
- cp = hImage->data;
- for (y = 0; y < hImage->height; y++)
+    nextBlock (g);
+    g->dataptr += g->BlockLeft;
+    g->BlockLeft = 0;
+   }
+
+ /* // Long align: the rows were written aWidth apart, clear the pad */
+
+ if (g->Width != aWidth)
    {
-    hImage->line[y] = cp;
-    cp += aWidth;
+    padbytes = aWidth - g->Width;
+    for (y = 0; y < g->Height; y++)
+     memset (g->pic8 + y * aWidth + g->Width, 0, padbytes);
    }
 
+ /* hImage, the LLIMG that was the PICINFO, was filled in with pic8 */
+
  return 1;
 }
 
@@ -872,26 +857,37 @@ readImage (LLIMG * hImage)
 */
 
 /* Fetch the next code from the raster data stream.  The codes can be
- * any length from 3 to 12 bits, packed into 8-bit bytes, so we have to
- * maintain our location in the Raster array as a BIT Offset.  We compute
- * the byte Offset into the raster array by dividing this by 8, pick up
- * three bytes, compute the bit Offset into our 24-bit chunk, shift to
- * bring the desired code to the bottom, then mask it off and return it. 
+ * any length from 3 to 12 bits, packed into 8-bit bytes, low bits first.
+ * BitBuf holds the bits not yet used; when it runs short it is topped up
+ * to 57 or more bits straight from the sub-blocks, so most codes cost a
+ * mask and a shift.  Past the end of the data the stream reads as zeros.
  */
 
 static int 
-readCode ()
+readCode (struct gif_ctx *g)
 {
-  int RawCode, ByteOffset;
+  int code;
+
+  if (g->BitCount < g->CodeSize)
+    {
+      while (g->BitCount <= 56)
+        {
+          if (!g->BlockLeft && !g->BlockEnd)
+            nextBlock (g);
+          if (g->BlockLeft)
+            {
+              g->BitBuf |= (bitbuf_t) *g->dataptr++ << g->BitCount;
+              g->BlockLeft--;
+            }
+          g->BitCount += 8;
+        }
+    }
 
-  ByteOffset = BitOffset / 8;
-  RawCode = Raster[ByteOffset] + (Raster[ByteOffset + 1] << 8);
-  if (CodeSize >= 8)
-    RawCode += (((int) Raster[ByteOffset + 2]) << 16);
-  RawCode >>= (BitOffset % 8);
-  BitOffset += CodeSize;
+  code = (int) g->BitBuf & g->ReadMask;
+  g->BitBuf >>= g->CodeSize;
+  g->BitCount -= g->CodeSize;
 
-  return (RawCode & ReadMask);
+  return code;
 }
 
 
@@ -900,70 +896,123 @@ readCode ()
 /////////////////////////////////////////////////////////////////////////
 */
 
+/* Start the next raster data sub-block.  Each is a count byte and that
+ * many bytes of data; a zero count, or the end of the file, ends them.
+ * A block the file cuts short is trimmed to what is there.
+ */
+
 static void 
-doInterlace (int Index)
+nextBlock (struct gif_ctx *g)
 {
- static byte *ptr = NULL;
- static int oldYC = -1;
+  int n;
 
- if (oldYC != YC)
-   {
-    ptr = pic8 + YC * Width;
-    oldYC = YC;
-   }
+  if (g->dataptr >= g->RawEnd)
+    {
+      g->BlockEnd = True;
+      return;
+    }
 
- if (YC < Height)
-  *ptr++ = Index;
+  n = NEXTBYTE;
+  if (n == 0)
+    g->BlockEnd = True;
+  else if (n > g->RawEnd - g->dataptr)
+    n = (int) (g->RawEnd - g->dataptr);
+  g->BlockLeft = n;
+}
 
- /* Update the X-coordinate, and if it overflows, update the Y-coordinate */
 
- if (++XC == Width)
-   {
+/*///////////////////////////////////////////////////////////////////////
+ *
+/////////////////////////////////////////////////////////////////////////
+*/
 
-    /* deal with the interlace as described in the GIF
-     * spec.  Put the decoded scan line out to the screen if we haven't gone
-     * past the bottom of it
-     */
+/* Write the first len characters of code's string at (XC, YC).  A
+ * whole string that fits in the row is written backwards, from its last
+ * character, straight into place.  One that crosses a row or is cut
+ * short is built in Stack and copied out a row at a time.
+ */
 
-    XC = 0;
+static void 
+putString (struct gif_ctx *g, int code, int len)
+{
+  register byte *p;
+  register const unsigned short *prefix;
+  register const byte *suffix;
+  int n;
 
-    switch (Pass)
-      {
-      case 0:
-       YC += 8;
-       if (YC >= Height)
-         {
-          Pass++;
-          YC = 4;
-         }
-       break;
+  prefix = g->Prefix;
+  suffix = g->Suffix;
+  n = g->Length[code];
 
-      case 1:
-       YC += 8;
-       if (YC >= Height)
-         {
-          Pass++;
-          YC = 2;
-         }
-       break;
+  if (n == len && g->XC + len <= g->Width)
+    {
+      p = g->Row + g->XC + len;
+      g->XC += len;
+      while (--n > 0)
+        {
+          *--p = suffix[code];
+          code = prefix[code];
+        }
+      *--p = (byte) code;
+      if (g->XC == g->Width)
+        nextRow (g);
+      return;
+    }
 
-      case 2:
-       YC += 4;
-       if (YC >= Height)
-         {
-          Pass++;
-          YC = 1;
-         }
-       break;
+  p = g->Stack + n;
+  while (--n > 0)
+    {
+      *--p = suffix[code];
+      code = prefix[code];
+    }
+  *--p = (byte) code;
 
-      case 3:
-       YC += 2;
-       break;
+  while (len > 0)
+    {
+      n = g->Width - g->XC;
+      if (n > len)
+        n = len;
+      memcpy (g->Row + g->XC, p, n);
+      p += n;
+      len -= n;
+      g->XC += n;
+      if (g->XC == g->Width)
+        nextRow (g);
+    }
+}
 
-      default:
-       break;
-      }
-   }
+
+/*///////////////////////////////////////////////////////////////////////
+ *
+/////////////////////////////////////////////////////////////////////////
+*/
+
+/* Move the output to the start of the next row.  An interlaced image
+ * comes in four passes, as described in the GIF spec; a pass with no
+ * rows in a short image is skipped.
+ */
+
+static const int pass_start[4] = { 0, 4, 2, 1 };
+static const int pass_step[4] = { 8, 8, 4, 2 };
+
+static void 
+nextRow (struct gif_ctx *g)
+{
+  g->XC = 0;
+
+  if (!g->Interlace)
+    g->YC++;
+  else
+    {
+      g->YC += pass_step[g->Pass];
+      while (g->YC >= g->Height && g->Pass < 3)
+        {
+          g->Pass++;
+          g->YC = pass_start[g->Pass];
+        }
+    }
+
+  g->Row = g->pic8 + g->YC * g->Stride;
 }
 
 
@@ -973,16 +1022,14 @@ doInterlace (int Index)
 */
 
 static void *
-gifError (char *st)
+gifError (struct gif_ctx *g, char *st)
 {
-  gifWarning (st);
-  if (Raster != NULL)
-    free (Raster);
-  if (comment)
-    free (comment);
-  if (pic8 != NULL)
-    free (pic8);
-  comment = (char *) NULL;
+  gifWarning (g, st);
+  if (g->comment)
+    free (g->comment);
+  llimg_pool_put (g->pic8);
+  g->pic8 = NULL;
+  g->comment = (char *) NULL;
   return NULL;
 }
 
@@ -993,7 +1040,7 @@ gifError (char *st)
 */
 
 static void 
-gifWarning (char *st)
+gifWarning (struct gif_ctx *g, char *st)
 {
   /* // SetISTR(ISTR_WARNING,"%s:  %s", bname, st); */
 }
@@ -1026,21 +1073,13 @@ expandGif (unsigned char *idata, int filebytes)
 
 LLIMG * read_gif_file (char *filename){
   LLIMG * llimg = NULL;
-  FILE *fp = NULL;
-  unsigned char *file_buffer = NULL;
-  int file_length;
-  fp = fopen (filename, "rb");
-  if (!fp) {
+  struct LLMAP map;
+  if (llimg_map_file (filename, &map) != 0) {
     return NULL;
   }
-  fseek (fp, 0L, 2);
-  file_length = ftell (fp);
-  fseek (fp, 0L, 0);
-  file_buffer = new unsigned char[file_length];
-  int nread = fread (file_buffer, 1, file_length, fp);
-  fclose (fp);
-  llimg = expandGif (file_buffer, file_length);
-  delete [] file_buffer;
+  /* The decoder only reads its input, so it can work in the mapping */
+  llimg = expandGif ((unsigned char *) map.data, (int) map.size);
+  llimg_unmap_file (&map);
   return llimg;
 }
 
@@ -5,31 +5,73 @@
 //
 // Based on the example from the jpeg6b library: example.c
 //
-// Contains the single public function:
+// Contains the public functions:
 //
 //   LLIMG *read_jpeg_file (char * filename)
+//   LLIMG *read_jpeg_file_scaled (char * filename, int max_w, int max_h)
+//   LLIMG *read_jpeg_file_progressive (char * filename, int max_w, int max_h,
+//                        void (*shown) (LLIMG *llimg, void *client),
+//                        void *client)
+//   LLIMG *read_jpeg_thumbnail (char * filename, long offset, long length,
+//                        long full_w, long full_h)
 //
-//   Returns a pointer to a malloc'd Hybrid_Image
+//   Return a pointer to a malloc'd Hybrid_Image
 //   The caller takes ownership of the LLIMG.
 //   The LLIMG may be free'd by the caller with llimg_release_llimg(LLIMG *)
 //
+//   read_jpeg_file_scaled returns the smallest image, keeping the aspect,
+//   that is at least max_w by max_h (or the full image if it isn't that
+//   big).  The library's DCT scaling does most of the reduction while
+//   decoding, at 1/2, 1/4 or 1/8; the box resampler does the rest.  The
+//   LLIMG's full_width and full_height hold the full image size.
+//
+//   read_jpeg_file_progressive reads like read_jpeg_file_scaled, but a
+//   progressive JPEG is put out a scan at a time, coarse first, and
+//   shown (llimg, client) is called as each one is ready.  It is the
+//   same LLIMG each time, refined in place, and the finished image is
+//   that one again, returned rather than shown.  If the file goes bad
+//   after a scan was shown, that image is returned as it is.
+//
+//   read_jpeg_thumbnail decodes the Exif thumbnail JPEG that is length
+//   bytes at offset in the file (see LLPROBE), cut to the shape of the
+//   full_w by full_h image and marked as a scaled read of it.
+//
 ///////////////////////////////////////////////////////////////////////
 
 
 #include <stdio.h>
 #include <setjmp.h>
-#include "jpeglib.h"
 
 /* The required jpeg6b library headers are: */
 /*   jpeglib.h */
 /*   jconfig.h */
 /*   jmorecfg.h */
+/* kept here for jpeg6b_r.lib.  LLIMG_SYSTEM_JPEG takes the installed
+ * library's own instead, which the tests build against elsewhere.
+ */
+#ifdef LLIMG_SYSTEM_JPEG
+#include <jpeglib.h>
+#else
+#include "jpeglib.h"
+#endif
 
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "ll_image.h"
+#include "ll_simd.h"
+#include "mapfile.h"
 
+#ifdef _WIN32
 #include <windows.h>
+#endif
+
+/* Most scanlines asked of the library at once */
+#define READ_BATCH 16
+
+/* From resizer.cpp */
+extern int
+llimg_resample (LLIMG *image, int new_width, int new_height, LLIMG *resized);
 
 
 ///////////////////////////////////////////////////////////////////////
@@ -67,27 +109,200 @@ my_error_exit (j_common_ptr cinfo)
 
 ///////////////////////////////////////////////////////////////////////
 //
+// Microsoft DIB format stores the color data as BGR instead of RGB.
+// Used when the library can't give us BGR itself.
+
+static void rgb_to_bgr (unsigned char *cp, int width) {
+  unsigned char temp;
+  int x = 0;
+
+#ifdef LLIMG_SSSE3
+  /* Sixteen pixels, three vectors, a step: four pixels at a time are
+   * lined up at the bottom of a register, swapped, and packed back.
+   */
+  if (llimg_cpu () & LLIMG_CPU_SSSE3) {
+    const __m128i swap = _mm_setr_epi8 (2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9,
+                                        -1, -1, -1, -1);
+    __m128i a, b, c, p0, p1, p2, p3;
+
+    for (; x + 16 <= width; x += 16, cp += 48) {
+      a = _mm_loadu_si128 ((const __m128i *) cp);
+      b = _mm_loadu_si128 ((const __m128i *) (cp + 16));
+      c = _mm_loadu_si128 ((const __m128i *) (cp + 32));
+      p0 = _mm_shuffle_epi8 (a, swap);
+      p1 = _mm_shuffle_epi8 (_mm_alignr_epi8 (b, a, 12), swap);
+      p2 = _mm_shuffle_epi8 (_mm_alignr_epi8 (c, b, 8), swap);
+      p3 = _mm_shuffle_epi8 (_mm_srli_si128 (c, 4), swap);
+      _mm_storeu_si128 ((__m128i *) cp,
+                        _mm_or_si128 (p0, _mm_slli_si128 (p1, 12)));
+      _mm_storeu_si128 ((__m128i *) (cp + 16),
+        _mm_or_si128 (_mm_srli_si128 (p1, 4), _mm_slli_si128 (p2, 8)));
+      _mm_storeu_si128 ((__m128i *) (cp + 32),
+        _mm_or_si128 (_mm_srli_si128 (p2, 8), _mm_slli_si128 (p3, 4)));
+    }
+  }
+#endif
 
+  for (; x < width; x++, cp += 3) {
+    temp = cp[0];
+    cp[0] = cp[2];
+    cp[2] = temp;
+  }
+}
 
-LLIMG * read_jpeg_file ( char * filename ) {
+
+///////////////////////////////////////////////////////////////////////
+//
+// Create a gray scale color table if it's a grayscale image
+
+static void gray_palette (LLIMG *llimg) {
+  int c;
+
+  if (llimg->bits_per_pixel != 8)
+    return;
+  for (c = 0; c < 256; c++) {
+    llimg->color[c].blue = c;
+    llimg->color[c].green = c;
+    llimg->color[c].red = c;
+  }
+}
+
+
+///////////////////////////////////////////////////////////////////////
+//
+// A data source that hands the library a whole buffer at once: the
+// mapped file, so it decodes straight out of the mapping with no stdio
+// buffer copy, or the file's bytes kept in memory.
+
+
+METHODDEF(void)
+map_init_source (j_decompress_ptr cinfo)
+{
+  (void) cinfo;
+}
+
+METHODDEF(boolean)
+map_fill_input_buffer (j_decompress_ptr cinfo)
+{
+  /* Out of data: the file is truncated.  Insert a fake EOI marker, as
+   * jdatasrc.c does, so the library finishes with what it has.
+   */
+  static const JOCTET fake_eoi[2] = { (JOCTET) 0xFF, (JOCTET) JPEG_EOI };
+
+  cinfo->src->next_input_byte = fake_eoi;
+  cinfo->src->bytes_in_buffer = 2;
+  return TRUE;
+}
+
+METHODDEF(void)
+map_skip_input_data (j_decompress_ptr cinfo, long num_bytes)
+{
+  if (num_bytes <= 0)
+    return;
+  if ((size_t) num_bytes > cinfo->src->bytes_in_buffer) {
+    map_fill_input_buffer (cinfo);
+    return;
+  }
+  cinfo->src->next_input_byte += num_bytes;
+  cinfo->src->bytes_in_buffer -= num_bytes;
+}
+
+METHODDEF(void)
+map_term_source (j_decompress_ptr cinfo)
+{
+  (void) cinfo;
+}
+
+static void
+jpeg_buffer_src (j_decompress_ptr cinfo, const JOCTET *data, long size)
+{
+  struct jpeg_source_mgr *src;
+
+  src = (struct jpeg_source_mgr *)
+    (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_PERMANENT,
+                                sizeof (struct jpeg_source_mgr));
+  src->init_source = map_init_source;
+  src->fill_input_buffer = map_fill_input_buffer;
+  src->skip_input_data = map_skip_input_data;
+  src->resync_to_restart = jpeg_resync_to_restart; /* use default method */
+  src->term_source = map_term_source;
+  src->next_input_byte = data;
+  src->bytes_in_buffer = size;
+  cinfo->src = src;
+}
+
+
+
+///////////////////////////////////////////////////////////////////////
+//
+// Read all the rows of an output pass into the image
+
+static void read_rows (j_decompress_ptr cinfo, LLIMG *llimg, int swap_rb) {
+  JSAMPROW dest_array[READ_BATCH];
+  int y, i, n, batch;
+
+  /* jpeg_read_scanlines fills up to rec_outbuf_height rows a call
+   * (several when it upsamples), so hand it that many at a time.
+   */
+  batch = cinfo->rec_outbuf_height;
+  if (batch < 1)
+    batch = 1;
+  if (batch > READ_BATCH)
+    batch = READ_BATCH;
+  while (cinfo->output_scanline < cinfo->output_height) {
+    y = cinfo->output_scanline;
+    n = cinfo->output_height - y;
+    if (n > batch)
+      n = batch;
+    for (i = 0; i < n; i++)
+      dest_array[i] = llimg->line[y + i];
+    n = jpeg_read_scanlines(cinfo, dest_array, n);
+
+    if (swap_rb)
+      for (i = 0; i < n; i++)
+        rgb_to_bgr (dest_array[i], llimg->width);
+  }
+}
+
+
+///////////////////////////////////////////////////////////////////////
+//
+// Resample the decoded image into view, in place of what view held, so
+// that whoever is showing view sees the new pixels.  0 or -1.
+
+static int resample_into (LLIMG *llimg, LLIMG *view, int w, int h) {
+  LLIMG fresh;
+
+  if (llimg_resample (llimg, w, h, &fresh) != 0)
+    return -1;
+  llimg_prune_llimg (view);
+  *view = fresh;
+  return 0;
+}
+
+
+///////////////////////////////////////////////////////////////////////
+//
+
+
+static LLIMG * decode_jpeg_data ( const JOCTET *data, long size,
+                                  int max_w, int max_h,
+                                  void (*shown) (LLIMG *llimg, void *client),
+                                  void *client ) {
   
   struct jpeg_decompress_struct cinfo;
   // struct jpeg_error_mgr jerr;
   struct my_error_mgr jerr;
  
   
-  FILE * infile;		/* source file */
-  int row_stride;		/* physical row width in output buffer */
-  
   LLIMG *llimg = NULL;
-  int line_bytes, y, x;
-  unsigned char *dest_array[1], *cp0, *cp2, temp;
-  
-  
-  if ((infile = fopen(filename, "rb")) == NULL) {
-    fprintf(stderr, "can't open %s\n", filename);
-    return NULL;
-  }
+  LLIMG *scaled;
+  LLIMG * volatile view = NULL;	/* what shown gets, llimg or resampled */
+  LLIMG * volatile decoded = NULL;	/* for the error exit */
+  LLIMG * volatile showing = NULL;
+  int n, swap_rb;
+  int full_w, full_h, want_w, want_h, denom;
+  clock_t start, pass;
   
   /* Step 1: allocate and initialize JPEG decompression object */
 
@@ -101,7 +316,15 @@ LLIMG * read_jpeg_file ( char * filename ) {
      * We need to clean up the JPEG object, close the input file, and return.
      */
     jpeg_destroy_decompress(&cinfo);
-    fclose(infile);
+    /* A scan that was shown stays; there's no more to it */
+    if (showing) {
+      if (decoded != showing)
+        llimg_release_llimg (decoded);
+      return showing;
+    }
+    if (view != decoded)
+      llimg_release_llimg (view);
+    llimg_release_llimg (decoded);
     return NULL;
   }
  
@@ -112,14 +335,60 @@ LLIMG * read_jpeg_file ( char * filename ) {
   
   /* Step 2: specify data source (eg, a file) */
   
-  jpeg_stdio_src(&cinfo, infile);
+  jpeg_buffer_src(&cinfo, data, size);
   
   /* Step 3: read file parameters with jpeg_read_header() */
   
   (void) jpeg_read_header(&cinfo, TRUE);
   
   /* Step 4: set parameters for decompression */
-  
+
+  /* For a scaled read, work out the size wanted and let the library
+   * scale down by as much as it can without going under it.
+   */
+  full_w = cinfo.image_width;
+  full_h = cinfo.image_height;
+  want_w = full_w;
+  want_h = full_h;
+  if (max_w > 0 && max_h > 0) {
+    if ((double) max_w * full_h >= (double) max_h * full_w) {
+      want_w = max_w;
+      want_h = (int) (((double) full_h * max_w + full_w - 1) / full_w);
+    }
+    else {
+      want_h = max_h;
+      want_w = (int) (((double) full_w * max_h + full_h - 1) / full_h);
+    }
+    if (want_w >= full_w || want_h >= full_h) {
+      want_w = full_w;
+      want_h = full_h;
+    }
+  }
+  for (denom = 8; denom > 1; denom /= 2) {
+    if ((full_w + denom - 1) / denom >= want_w
+        && (full_h + denom - 1) / denom >= want_h)
+      break;
+  }
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = denom;
+
+  /* Ask for BGR straight from the color converter when the library can
+   * (libjpeg-turbo, and others with the JCS_EXT_ color spaces), else
+   * swap to BGR as the rows come in.  LLIMG_JPEG_SWAP swaps anyway, so
+   * the swap can be checked against such a library.
+   */
+  swap_rb = (cinfo.out_color_space == JCS_RGB);
+#if defined(JCS_EXTENSIONS) && !defined(LLIMG_JPEG_SWAP)
+  if (swap_rb) {
+    cinfo.out_color_space = JCS_EXT_BGR;
+    swap_rb = 0;
+  }
+#endif
+
+  /* Show a progressive JPEG scan by scan when asked to */
+
+  cinfo.buffered_image = shown && jpeg_has_multiple_scans(&cinfo);
+
   /* Step 5: Start decompressor */
   
   (void) jpeg_start_decompress(&cinfo);
@@ -131,55 +400,59 @@ LLIMG * read_jpeg_file ( char * filename ) {
   * In this example, we need to make an output work buffer of the right size.
   */ 
   
-  /* JSAMPLEs per row in output buffer */
-  row_stride = cinfo.output_width * cinfo.output_components;  
-  
-  line_bytes = 4*((row_stride+3)/4);  /* DIB requires long alignment */
   llimg = llimg_create_base();
   llimg->width = cinfo.output_width;
   llimg->height = cinfo.output_height;
   llimg->dib_height = -llimg->height;
   llimg->bits_per_pixel = cinfo.output_components * 8;
   
-  llimg->data = malloc(llimg->height * line_bytes);
-  if ( !llimg->data ) return NULL;
-  
-  llimg->line = (unsigned char **)                    
-    malloc (llimg->height * sizeof (unsigned char *));
-  llimg->line[0] = (llimg)->data;                       
-  for (y = 1; y < llimg->height; y++)  
-    llimg->line[y] = llimg->line[y - 1] + line_bytes;
+  /* Rows at DIB stride, which needs long alignment */
+  if (llimg_alloc_data (llimg)) {
+    jpeg_destroy_decompress(&cinfo);
+    llimg_release_llimg (llimg);
+    return NULL;
+  }
+  gray_palette (llimg);
+  decoded = llimg;
     
   /* Step 6: while (scan lines remain to be read) */
   /*           jpeg_read_scanlines(...); */
   
-  /* Here we use the library's state variable cinfo.output_scanline as the
-  * loop counter, so that we don't have to keep track ourselves.
-  */
-  y = 0;
-  while (cinfo.output_scanline < cinfo.output_height) {
-  /* jpeg_read_scanlines expects an array of pointers to scanlines.
-  * Here the array is only one element long, but you could ask for
-  * more than one scanline at a time if that's more convenient.
-    */
-    dest_array[0] = llimg->line[y++];
-    (void) jpeg_read_scanlines(&cinfo, dest_array, 1);
-
-    if (cinfo.output_components != 3)
-      continue;
-
-    /* Microsoft DIB format stores the color data as BGR instead of RGB */
-
-    cp0 = dest_array[0];
-    cp2 = cp0 + 2;
-    for ( x=0; x < llimg->width; x++){
-      temp = *cp0;
-      *cp0 = *cp2;
-      *cp2 = temp;
-      cp0 += 3;
-      cp2 += 3;
+  if (!cinfo.buffered_image) {
+    read_rows (&cinfo, llimg, swap_rb);
+  }
+  else {
+    /* Put out a pass for the first scan, then for whatever scans have
+     * come in by the time the input has had as long again as the last
+     * pass took, so that the passes no more than double the decode.
+     */
+    view = llimg;
+    if (llimg->width != want_w || llimg->height != want_h)
+      view = llimg_create_base();
+    for (;;) {
+      start = clock ();
+      (void) jpeg_start_output(&cinfo, cinfo.input_scan_number);
+      read_rows (&cinfo, llimg, swap_rb);
+      (void) jpeg_finish_output(&cinfo);
+      if (jpeg_input_complete(&cinfo))
+        break;
+
+      if (view == llimg || resample_into (llimg, view, want_w, want_h) == 0) {
+        if (view->width != full_w || view->height != full_h) {
+          view->full_width = full_w;
+          view->full_height = full_h;
+        }
+        showing = view;
+        (*shown) (view, client);
+      }
+      pass = clock () - start;
+
+      start = clock ();
+      do
+        n = jpeg_consume_input(&cinfo);
+      while (n != JPEG_REACHED_EOI && n != JPEG_SUSPENDED
+             && (n != JPEG_SCAN_COMPLETED || clock () - start < pass));
     }
-
   }
   
   /* Step 7: Finish decompression */
@@ -189,22 +462,144 @@ LLIMG * read_jpeg_file ( char * filename ) {
   /* Step 8: Release JPEG decompression object */
   
   jpeg_destroy_decompress(&cinfo);
-  
-  fclose(infile);
 
-  /* Create a gray scale color table if it's a grayscale image */
+  /* Finish a scaled read with the box resampler */
 
-  if (llimg->bits_per_pixel == 8 ) {
-    int c;
-    for (c = 0; c < 256; c++) {
-      llimg->color[c].blue = c;
-      llimg->color[c].green = c;
-      llimg->color[c].red = c;
+  if (llimg->width != want_w || llimg->height != want_h) {
+    scaled = view ? view : llimg_create_base();
+    if (resample_into (llimg, scaled, want_w, want_h) == 0) {
+      llimg_release_llimg (llimg);
+      llimg = scaled;
     }
+    else if (scaled != showing) {
+      llimg_release_llimg (scaled);
+    }
+  }
+  if (llimg->width != full_w || llimg->height != full_h) {
+    llimg->full_width = full_w;
+    llimg->full_height = full_h;
   }
   
   return llimg;
 }
 
 
+///////////////////////////////////////////////////////////////////////
+//
+
+static LLIMG * decode_jpeg_file ( char * filename, int max_w, int max_h,
+                                  void (*shown) (LLIMG *llimg, void *client),
+                                  void *client ) {
+  struct LLMAP infile;		/* source file, mapped */
+  LLIMG *llimg;
+
+  if (llimg_map_file(filename, &infile) != 0) {
+    fprintf(stderr, "can't open %s\n", filename);
+    return NULL;
+  }
+  llimg = decode_jpeg_data (infile.data, infile.size, max_w, max_h,
+                            shown, client);
+  llimg_unmap_file(&infile);
+  return llimg;
+}
+
+
+///////////////////////////////////////////////////////////////////////
+//
+// Cut a thumbnail to the shape of the full image.  Exif thumbnails are
+// often 160 by 120 whatever the camera's shape, with the picture
+// centered between black bars.
+
+static void crop_to_shape (LLIMG *llimg, long full_w, long full_h) {
+  long w, h, x0, y0, y;
+  int bytes, line_bytes;
+
+  w = llimg->width;
+  h = llimg->height;
+  if ((double) full_w * h > (double) full_h * w)
+    h = (long) ((double) w * full_h / full_w + 0.5);
+  else
+    w = (long) ((double) h * full_w / full_h + 0.5);
+  if (w < 1 || h < 1 || (w == llimg->width && h == llimg->height))
+    return;
+  x0 = (llimg->width - w) / 2;
+  y0 = (llimg->height - h) / 2;
+
+  /* Rows only get shorter and move up, so copy them down in place */
+  bytes = llimg->bits_per_pixel / 8;
+  line_bytes = llimg_stride (w, llimg->bits_per_pixel);
+  for (y = 0; y < h; y++)
+    memmove (llimg->data + y*line_bytes, llimg->line[y0 + y] + x0*bytes,
+             w*bytes);
+  llimg->width = w;
+  llimg->height = h;
+  llimg->dib_height = -h;
+  for (y = 1; y < h; y++)
+    llimg->line[y] = llimg->line[y - 1] + line_bytes;
+}
+
 
+///////////////////////////////////////////////////////////////////////
+//
+
+LLIMG * read_jpeg_file ( char * filename ) {
+  return decode_jpeg_file (filename, 0, 0, NULL, NULL);
+}
+
+
+///////////////////////////////////////////////////////////////////////
+//
+
+LLIMG * read_jpeg_file_scaled ( char * filename, int max_w, int max_h ) {
+  return decode_jpeg_file (filename, max_w, max_h, NULL, NULL);
+}
+
+
+///////////////////////////////////////////////////////////////////////
+//
+// The same from a JPEG file's bytes, kept in memory
+
+LLIMG * read_jpeg_data_scaled ( const unsigned char * data, long size,
+                                int max_w, int max_h ) {
+  return decode_jpeg_data (data, size, max_w, max_h, NULL, NULL);
+}
+
+
+///////////////////////////////////////////////////////////////////////
+//
+
+LLIMG * read_jpeg_file_progressive ( char * filename, int max_w, int max_h,
+                                     void (*shown) (LLIMG *llimg,
+                                                    void *client),
+                                     void *client ) {
+  return decode_jpeg_file (filename, max_w, max_h, shown, client);
+}
+
+
+///////////////////////////////////////////////////////////////////////
+//
+
+LLIMG * read_jpeg_thumbnail ( char * filename, long offset, long length,
+                              long full_w, long full_h ) {
+  struct LLMAP infile;
+  LLIMG *llimg;
+
+  if (llimg_map_file(filename, &infile) != 0)
+    return NULL;
+  llimg = NULL;
+  if (offset >= 0 && length > 0 && offset <= infile.size - length)
+    llimg = decode_jpeg_data (infile.data + offset, length, 0, 0,
+                              NULL, NULL);
+  llimg_unmap_file(&infile);
+  if (!llimg)
+    return NULL;
+
+  if (full_w > 0 && full_h > 0) {
+    crop_to_shape (llimg, full_w, full_h);
+    if (llimg->width != full_w || llimg->height != full_h) {
+      llimg->full_width = full_w;
+      llimg->full_height = full_h;
+    }
+  }
+  return llimg;
+}
@@ -28,133 +28,424 @@
 #include <string.h>
 
 #include "ll_image.h"
+#include "ll_simd.h"
 
 /////////////////////////////////////////////////////////////////////////////
 //
+// Box reduction kernels
+//
+// Both reductions below run the same way: the "reduction" source rows
+// under an output row are added down into one row of 16 bit column sums
+// (still interleaved BGR, so a whole row is one long run of bytes to add,
+// which the SSE2/AVX2 loops do 16 or 32 at a time), then each output
+// pixel adds the "reduction" column sums under it across and divides by
+// the area.
+//
+// The divide is a multiply and shift by a reciprocal chosen so that it
+// gives exactly the quotient for every sum the area can produce, as long
+// as the sums stay under 2^15 (areas up to 11 x 11).  Larger areas just
+// divide.  Either way the output is the same as dividing a long sum.
+
+#define REDUCE_MAX        255    /* 255 rows of 255 still fit 16 bits */
+#define REDUCE_RECIP_MAX  11     /* 255 * 11 * 11 < 2^15 */
+
+static void
+reduce_recip (int area, unsigned int *mul, int *shift)
+{
+  int s = 0;
+  while ((1 << s) < area)
+    s++;
+  *shift = 15 + s;
+  *mul = (unsigned int) (((1u << *shift) + area - 1) / area);
+}
+
+///////////////////////////////////////////////////////////////////////
+//
+// sums[i] += src[i] for n bytes
 
-// Desc: 8 bit "true color" definitions: 3 red, 3 green, 2 blue
+static void
+reduce_add_row (unsigned short *sums, const unsigned char *src, int n)
+{
+  int i = 0;
+
+#if defined(LLIMG_AVX2)
+  if (llimg_cpu () & LLIMG_CPU_AVX2) {
+    for (; i + 32 <= n; i += 32) {
+      __m256i lo = _mm256_cvtepu8_epi16 (
+        _mm_loadu_si128 ((const __m128i *) (src + i)));
+      __m256i hi = _mm256_cvtepu8_epi16 (
+        _mm_loadu_si128 ((const __m128i *) (src + i + 16)));
+      __m256i *sp = (__m256i *) (sums + i);
+      _mm256_storeu_si256 (sp,
+                           _mm256_add_epi16 (_mm256_loadu_si256 (sp), lo));
+      _mm256_storeu_si256 (sp + 1,
+                           _mm256_add_epi16 (_mm256_loadu_si256 (sp + 1), hi));
+    }
+  }
+#endif
+#if defined(LLIMG_SSE2)
+  if (llimg_cpu () & LLIMG_CPU_SSE2) {
+    __m128i zero = _mm_setzero_si128 ();
+    for (; i + 16 <= n; i += 16) {
+      __m128i b = _mm_loadu_si128 ((const __m128i *) (src + i));
+      __m128i *sp = (__m128i *) (sums + i);
+      _mm_storeu_si128 (sp, _mm_add_epi16 (_mm_loadu_si128 (sp),
+                                           _mm_unpacklo_epi8 (b, zero)));
+      _mm_storeu_si128 (sp + 1, _mm_add_epi16 (_mm_loadu_si128 (sp + 1),
+                                               _mm_unpackhi_epi8 (b, zero)));
+    }
+  }
+#endif
+  for (; i < n; i++)
+    sums[i] += src[i];
+}
+
+///////////////////////////////////////////////////////////////////////
+//
+// Adds each reduction wide footprint of the BGR column sums across and
+// stores width averaged BGR pixels.
+
+static void
+reduce_store_row (const unsigned short *sums, int reduction, int width,
+                  unsigned char *rp)
+{
+  unsigned int b, g, r, mul;
+  int x, i, shift;
+  int area = reduction * reduction;
+
+  if (reduction <= REDUCE_RECIP_MAX) {
+    reduce_recip (area, &mul, &shift);
+    for (x = 0; x < width; x++) {
+      b = g = r = 0;
+      for (i = 0; i < reduction; i++) {
+        b += *sums++;
+        g += *sums++;
+        r += *sums++;
+      }
+      *rp++ = (unsigned char) ((b * mul) >> shift);
+      *rp++ = (unsigned char) ((g * mul) >> shift);
+      *rp++ = (unsigned char) ((r * mul) >> shift);
+    }
+  }
+  else {
+    for (x = 0; x < width; x++) {
+      b = g = r = 0;
+      for (i = 0; i < reduction; i++) {
+        b += *sums++;
+        g += *sums++;
+        r += *sums++;
+      }
+      *rp++ = (unsigned char) (b / area);
+      *rp++ = (unsigned char) (g / area);
+      *rp++ = (unsigned char) (r / area);
+    }
+  }
+}
+
+// The same for a row of gray column sums, one byte a pixel
+
+static void
+reduce_gray_row (const unsigned short *sums, int reduction, int width,
+                 unsigned char *rp)
+{
+  unsigned int v, mul;
+  int x, i, shift;
+  int area = reduction * reduction;
+
+  if (reduction <= REDUCE_RECIP_MAX) {
+    reduce_recip (area, &mul, &shift);
+    for (x = 0; x < width; x++) {
+      v = 0;
+      for (i = 0; i < reduction; i++)
+        v += *sums++;
+      *rp++ = (unsigned char) ((v * mul) >> shift);
+    }
+  }
+  else {
+    for (x = 0; x < width; x++) {
+      v = 0;
+      for (i = 0; i < reduction; i++)
+        v += *sums++;
+      *rp++ = (unsigned char) (v / area);
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////
+//
+// Fixed factor kernels
+//
+// The options and the icon bar only ever ask for factors 2 through 9,
+// so each of those gets its own instance of reduce_fixed, with the
+// footprint width and the reciprocal known to the compiler.  The
+// footprint loop then unrolls, and with SSE2 the power of two factors
+// skip the reciprocal altogether: the column sums are added in pairs, pairs of
+// pairs, and so on, a whole row at a time, and each footprint's total
+// is then a shift away from its average.  Same output as
+// reduce_store_row either way.  llimg_reduce_fixed turns them off, so
+// tests/reducebench.cpp can weigh them against the runtime kernel.
+
+#define REDUCE_FIXED_MAX 9
+
+static int reduce_fixed_on = 1;
+
+typedef void (*reduce_row_fn) (unsigned short *sums, int width,
+                               unsigned char *rp);
+
+///////////////////////////////////////////////////////////////////////
+//
+// sums[i] += sums[i + step] for i + step < n
+
+static void
+reduce_pair_row (unsigned short *sums, int n, int step)
+{
+  int i = 0;
+
+#if defined(LLIMG_SSE2)
+  // Each load of sums + i + step is done before the store over it
+  if (llimg_cpu () & LLIMG_CPU_SSE2) {
+    for (; i + step + 8 <= n; i += 8) {
+      __m128i *sp = (__m128i *) (sums + i);
+      _mm_storeu_si128 (sp, _mm_add_epi16 (_mm_loadu_si128 (sp),
+        _mm_loadu_si128 ((const __m128i *) (sums + i + step))));
+    }
+  }
+#endif
+  for (; i + step < n; i++)
+    sums[i] += sums[i + step];
+}
+
+template <int R> struct reduce_fixed {
+  enum {
+    AREA = R * R,
+    LOG = AREA <= 1 ? 0 : AREA <= 2 ? 1 : AREA <= 4 ? 2 : AREA <= 8 ? 3 :
+          AREA <= 16 ? 4 : AREA <= 32 ? 5 : AREA <= 64 ? 6 : 7,
+    SHIFT = 15 + LOG,
+    MUL = ((1 << SHIFT) + AREA - 1) / AREA,
+    POW2 = (R & (R - 1)) == 0
+  };
+
+  static void
+  store (unsigned short *sums, int width, unsigned char *rp)
+  {
+    unsigned int b, g, r;
+    int x, i, step, pairs = 0;
+
+    // Added in pairs only when that is done a vector at a time; a pair
+    // at a time loses to the plain footprint loop
+#ifdef LLIMG_SSE2
+    pairs = POW2 && (llimg_cpu () & LLIMG_CPU_SSE2);
+#endif
+    if (pairs) {
+      for (step = 3; step < 3 * R; step *= 2)
+        reduce_pair_row (sums, 3 * R * width, step);
+      for (x = 0; x < width; x++) {
+        *rp++ = (unsigned char) (sums[0] >> LOG);
+        *rp++ = (unsigned char) (sums[1] >> LOG);
+        *rp++ = (unsigned char) (sums[2] >> LOG);
+        sums += 3 * R;
+      }
+      return;
+    }
+
+    for (x = 0; x < width; x++) {
+      b = g = r = 0;
+      for (i = 0; i < R; i++) {
+        b += sums[3 * i];
+        g += sums[3 * i + 1];
+        r += sums[3 * i + 2];
+      }
+      *rp++ = (unsigned char) ((b * MUL) >> SHIFT);
+      *rp++ = (unsigned char) ((g * MUL) >> SHIFT);
+      *rp++ = (unsigned char) ((r * MUL) >> SHIFT);
+      sums += 3 * R;
+    }
+  }
+};
+
+static reduce_row_fn reduce_fixed_table[REDUCE_FIXED_MAX + 1] = {
+  NULL,
+  NULL,
+  reduce_fixed<2>::store,
+  reduce_fixed<3>::store,
+  reduce_fixed<4>::store,
+  reduce_fixed<5>::store,
+  reduce_fixed<6>::store,
+  reduce_fixed<7>::store,
+  reduce_fixed<8>::store,
+  reduce_fixed<9>::store
+};
+
+///////////////////////////////////////////////////////////////////////
+//
+// Finishes an output row from its column sums (which may be used up)
+
+static void
+reduce_finish_row (unsigned short *sums, int reduction, int width,
+                   unsigned char *rp)
+{
+  if (reduce_fixed_on && reduction <= REDUCE_FIXED_MAX
+      && reduce_fixed_table[reduction])
+    reduce_fixed_table[reduction] (sums, width, rp);
+  else
+    reduce_store_row (sums, reduction, width, rp);
+}
+
+///////////////////////////////////////////////////////////////////////
+//
+// Sets whether the fixed factor kernels stand in for reduce_store_row
+// (1, as they do unless a test says otherwise) or not (0)
+
+extern "C" void
+llimg_reduce_fixed (int on)
+{
+  reduce_fixed_on = on;
+}
+
+///////////////////////////////////////////////////////////////////////
+//
+// Sets up reduced as a bits_per_pixel, image/reduction sized image,
+// turned as image is to be shown (image->rotation).  The kernels make it
+// w by h, as image is stored, and put each row where the turn takes it.
+
+static int
+reduce_alloc (LLIMG *image, int reduction, LLIMG *reduced, int *w, int *h,
+              int bits_per_pixel)
+{
+  llimg_zero_llimg (reduced);
+  reduced->bits_per_pixel = bits_per_pixel;
+  
+  *w = image->width / reduction;
+  *h = abs (image->height) / reduction;
+  reduced->width = *w;
+  reduced->height = *h;
+  if (image->rotation >= LLIMG_ORIENT_TRANSPOSE) {
+    reduced->width = *h;
+    reduced->height = *w;
+  }
+  reduced->dib_height = -reduced->height;
+  
+  if (llimg_alloc_data (reduced))
+    return (-1);
 
-/* 
-    We want to maintain full color strength when
-    extracting the (R, G, B) colors from the posterized
-    8 bit pixel values.  Just doing the shifts will
-    leave zeros in the LS bits, so, for instance, white
-    will not be fully white.  OR'ing 1's in the LS is
-    equally a problem, since there will always be a
-    little of the other two colors in any primary.  So
-    we do a conditional OR.
-*/
+  return (0);
+}
 
+///////////////////////////////////////////////////////////////////////
+//
+// Where a kernel makes output row y: in place, or in turned for
+// reduce_put_row to put where the image's turn takes it
 
-static struct bgr_color 
-pix2bgr (unsigned char pix)
+static unsigned char *
+reduce_out_row (LLIMG *image, LLIMG *reduced, int y, unsigned char *turned)
 {
-  struct bgr_color col;
-  col.red = pix;
-  if (col.red & 0x80)
-    col.red |= 0x1f;
-  col.green = pix << 3;
-  if (col.green & 0x80)
-    col.green |= 0x1f;
-  col.blue = pix << 6;
-  if (col.blue & 0x80)
-    col.blue |= 0x3f;
-  col.reserved = 0;
-  return col;
+  return image->rotation > LLIMG_ORIENT_NORMAL ? turned : reduced->line[y];
 }
 
-static unsigned char 
-rgb2pix (unsigned char r, unsigned char g, unsigned char b)
+static void
+reduce_put_row (LLIMG *image, LLIMG *reduced, int y, int w, int h,
+                unsigned char *turned)
 {
-  return ((r & 0xe0) | ((g & 0xe0) >> 3) | (b >> 6));
+  if (image->rotation > LLIMG_ORIENT_NORMAL)
+    llimg_orient_row (reduced, image->rotation, turned, y, w, h);
 }
 
 
 /////////////////////////////////////////////////////////////////////////////
 //
+// Reduces an 8 bit image.  A gray one stays 8 bit, its levels averaged
+// as they are; any other keeps its color table, each pixel the entry
+// nearest the average of its footprint (see palette.cpp).  With
+// llimg_keep_palette off, or no memory for the table's inverse, it is
+// 24 bit instead.
 
 int 
 llimg_reduce256 (LLIMG *image, int reduction, LLIMG *reduced)
 {
-  unsigned char *rp, *ip;
-  int i, y, x, y1;
+  const unsigned char *inverse = NULL;
+  unsigned char *ip, *bp, *out;
+  int y, x, y1, w, h, kind, row_bytes;
   
   if (image->bits_per_pixel != 8)
     return (-1);
+  if (reduction < 1 || reduction > REDUCE_MAX)
+    return (-1);
+  kind = llimg_palette_kind (image);
+  if (kind == LLIMG_KEEP_INDEX) {
+    inverse = llimg_inverse_palette (image);
+    if (!inverse)
+      kind = 0;
+  }
+  if (reduce_alloc (image, reduction, reduced, &w, &h, kind ? 8 : 24)) {
+    llimg_release_inverse (inverse);
+    return (-1);
+  }
+  if (kind)
+    memcpy (reduced->color, image->color, sizeof (reduced->color));
   
-  llimg_zero_llimg (reduced);
-  reduced->bits_per_pixel = 24;
-  
-  reduced->width = image->width / reduction;
-  reduced->height = abs (image->height) / reduction;
-  reduced->dib_height = -reduced->height;
-  
-  int line_bytes = 4*(((3 * reduced->width)+3)/4); /* BGR, long aligned*/
-  int reducedSize = line_bytes * abs (reduced->height);
-  reduced->data = (unsigned char *) malloc (reducedSize);
-  
-  reduced->line = (unsigned char **)                    
-    malloc (reduced->height * sizeof (unsigned char *));
-  reduced->line[0] = (reduced)->data;                       
-  for (y = 1; y < reduced->height; y++)  
-    reduced->line[y] = reduced->line[y - 1] + line_bytes;
-  
-  int area = reduction * reduction;
-  
-  long *reducedDataBlue = new long[reduced->width];
-  long *reducedDataGreen = new long[reduced->width];
-  long *reducedDataRed = new long[reduced->width];
+  // Only the columns that land in an output pixel are summed
+  row_bytes = (kind == LLIMG_KEEP_GRAY ? 1 : 3) * w * reduction;
+
+  unsigned short *sums =
+    (unsigned short *) llimg_pool_get (row_bytes * sizeof (unsigned short));
+  unsigned char *bgr = kind == LLIMG_KEEP_GRAY
+    ? NULL : (unsigned char *) llimg_pool_get (row_bytes);
+  unsigned char *turned = (unsigned char *) llimg_pool_get (3 * w);
+  unsigned char *averaged = inverse
+    ? (unsigned char *) llimg_pool_get (3 * w) : NULL;
+  if (!sums || (kind != LLIMG_KEEP_GRAY && !bgr) || !turned
+      || (inverse && !averaged)) {
+    llimg_pool_put (sums);
+    llimg_pool_put (bgr);
+    llimg_pool_put (turned);
+    llimg_pool_put (averaged);
+    llimg_prune_llimg (reduced);
+    llimg_zero_llimg (reduced);
+    llimg_release_inverse (inverse);
+    return (-1);
+  }
 
-  long *rpLongBlue, *rpLongGreen, *rpLongRed;
-  
-  int max_y = reduced->height * reduction;
-  for (y = 0; y < max_y; y += reduction)
+  for (y = 0; y < h; y++)
   {
-    memset (reducedDataBlue, 0, reduced->width * sizeof (long));
-    memset (reducedDataGreen, 0, reduced->width * sizeof (long));
-    memset (reducedDataRed, 0, reduced->width * sizeof (long));
+    memset (sums, 0, row_bytes * sizeof (unsigned short));
     
-    for (y1 = y; y1 < (y + reduction) && y1 < image->height; y1++)
+    for (y1 = y * reduction; y1 < (y + 1) * reduction; y1++)
     {
+      // Gray levels are added in as they are
+      if (kind == LLIMG_KEEP_GRAY) {
+        reduce_add_row (sums, image->line[y1], row_bytes);
+        continue;
+      }
+      // Look the row up in the color table, then add it in as BGR
       ip = image->line[y1];
-      rpLongRed = reducedDataRed;
-      rpLongBlue = reducedDataBlue;
-      rpLongGreen = reducedDataGreen;
-      
-      int counter = 0;
-      for (x = 0; x < reduced->width; x++)
+      bp = bgr;
+      for (x = 0; x < w * reduction; x++)
       {
-        for (i = 0; i < reduction; i++)
-        {
-          *rpLongBlue += image->color[*ip].blue;
-          *rpLongGreen += image->color[*ip].green;
-          *rpLongRed += image->color[*ip].red;
-          ip++;
-        }
-        rpLongRed++;
-        rpLongBlue++;
-        rpLongGreen++;
+        *bp++ = image->color[*ip].blue;
+        *bp++ = image->color[*ip].green;
+        *bp++ = image->color[*ip].red;
+        ip++;
       }
-      
+      reduce_add_row (sums, bgr, row_bytes);
     }
     
-    // now move the long values into the image.
-    rp = reduced->line[y/reduction];
-    rpLongBlue = reducedDataBlue;
-    rpLongGreen = reducedDataGreen;
-    rpLongRed = reducedDataRed;
-    for (i = 0; i < (reduced->width); i++)
-    {
-      *rp++ = (unsigned char)((*rpLongBlue++)/area);
-      *rp++ = (unsigned char)((*rpLongGreen++)/area);
-      *rp++ = (unsigned char)((*rpLongRed++)/area);
+    out = reduce_out_row (image, reduced, y, turned);
+    if (kind == LLIMG_KEEP_GRAY)
+      reduce_gray_row (sums, reduction, w, out);
+    else if (inverse) {
+      reduce_finish_row (sums, reduction, w, averaged);
+      llimg_index_row (inverse, averaged, out, w);
     }
-    
+    else
+      reduce_finish_row (sums, reduction, w, out);
+    reduce_put_row (image, reduced, y, w, h, turned);
   }
   
-  delete (reducedDataRed);
-  delete (reducedDataBlue);
-  delete (reducedDataGreen);
+  llimg_pool_put (sums);
+  llimg_pool_put (bgr);
+  llimg_pool_put (turned);
+  llimg_pool_put (averaged);
+  llimg_release_inverse (inverse);
 
   return 0; 
 }
@@ -166,184 +457,47 @@ llimg_reduce256 (LLIMG *image, int reduction, LLIMG *reduced)
 int 
 llimg_reduce24bit (LLIMG *image, int reduction, LLIMG *reduced)
 {
-  unsigned char *rp, *ip;
-  int i, y, x, y1;
+  int y, y1, w, h;
   
   if (image->bits_per_pixel != 24)
     return (-1);
+  if (reduction < 1 || reduction > REDUCE_MAX)
+    return (-1);
+  if (reduce_alloc (image, reduction, reduced, &w, &h, 24))
+    return (-1);
   
-  llimg_zero_llimg (reduced);
-  reduced->bits_per_pixel = 24;
-  
-  reduced->width = image->width / reduction;
-  reduced->height = abs (image->height) / reduction;
-  reduced->dib_height = -reduced->height;
-  
-  int line_bytes = 4*(((3 * reduced->width)+3)/4); /* BGR, long aligned*/
-  int reducedSize = line_bytes * abs (reduced->height);
-  reduced->data = (unsigned char *) malloc (reducedSize);
-  
-  reduced->line = (unsigned char **)                    
-    malloc (reduced->height * sizeof (unsigned char *));
-  reduced->line[0] = (reduced)->data;                       
-  for (y = 1; y < reduced->height; y++)  
-    reduced->line[y] = reduced->line[y - 1] + line_bytes;
-  
-  int area = reduction * reduction;
-  
-  long *reducedDataRed = new long[reduced->width];
-  long *reducedDataBlue = new long[reduced->width];
-  long *reducedDataGreen = new long[reduced->width];
-  
-  long *rpLongBlue, *rpLongGreen, *rpLongRed;
+  // Only the columns that land in an output pixel are summed
+  int row_bytes = 3 * w * reduction;
+
+  unsigned short *sums =
+    (unsigned short *) llimg_pool_get (row_bytes * sizeof (unsigned short));
+  unsigned char *turned = (unsigned char *) llimg_pool_get (3 * w);
+  if (!sums || !turned) {
+    llimg_pool_put (sums);
+    llimg_pool_put (turned);
+    llimg_prune_llimg (reduced);
+    llimg_zero_llimg (reduced);
+    return (-1);
+  }
 
-  int total_lines = reduced->height * reduction;
-  for (y = 0; y < total_lines; y += reduction)
+  for (y = 0; y < h; y++)
   {
-    memset (reducedDataRed, 0, reduced->width * sizeof (long));
-    memset (reducedDataBlue, 0, reduced->width * sizeof (long));
-    memset (reducedDataGreen, 0, reduced->width * sizeof (long));
+    memset (sums, 0, row_bytes * sizeof (unsigned short));
     
-    for (y1 = y; y1 < (y + reduction) && y1 < image->height; y1++)
-    {
-      ip = image->line[y1];
-      rpLongRed = reducedDataRed;
-      rpLongBlue = reducedDataBlue;
-      rpLongGreen = reducedDataGreen;
-      
-      int counter = 0;
-      for (x = 0; x < reduced->width; x ++)
-      {
-        for (i = 0; i < reduction; i++)
-        {
-          *rpLongBlue += *ip++;
-          *rpLongGreen += *ip++;
-          *rpLongRed += *ip++;
-        }
-        rpLongBlue++;
-        rpLongGreen++;
-        rpLongRed++;
-      }
-    }
+    for (y1 = y * reduction; y1 < (y + 1) * reduction; y1++)
+      reduce_add_row (sums, image->line[y1], row_bytes);
     
-    // now move the long values into the image.
-    rp = reduced->line[y/reduction];
-    rpLongBlue = reducedDataBlue;
-    rpLongGreen = reducedDataGreen;
-    rpLongRed = reducedDataRed;
-    for (i = 0; i < reduced->width; i++)
-    {
-      *rp++ = (unsigned char)((*rpLongBlue++)/area);
-      *rp++ = (unsigned char)((*rpLongGreen++)/area);
-      *rp++ = (unsigned char)((*rpLongRed++)/area);
-    }
+    reduce_finish_row (sums, reduction, w,
+                       reduce_out_row (image, reduced, y, turned));
+    reduce_put_row (image, reduced, y, w, h, turned);
   }
   
-  delete (reducedDataRed);
-  delete (reducedDataBlue);
-  delete (reducedDataGreen);
+  llimg_pool_put (sums);
+  llimg_pool_put (turned);
   
   return (0);
 }
 
-/////////////////////////////////////////////////////////////////////////////
-//
-
-int 
-llimg_reduce256_256 (LLIMG *image, int reduction, LLIMG *reduced)
-{
-  unsigned char *rp, *ip;
-  int i, y, x, y1;
-
-  if (image->bits_per_pixel != 8)
-    return (-1);
-
-  llimg_zero_llimg (reduced);
-  reduced->bits_per_pixel = 8;
-
-  reduced->width = (image->width + (reduction - 1)) / reduction;
-  reduced->width = ((reduced->width + 3) / 4) * 4;	/* Long align */
-  reduced->height = (abs (image->height) + (reduction - 1)) / reduction;
-  reduced->dib_height = -reduced->height;
-
-  int reducedSize = reduced->width * abs (reduced->height);
-  reduced->data = (unsigned char *) malloc (reducedSize);
-  llimg_make_line_array (reduced);
-
-  int area = reduction * reduction;
-
-  long *reducedDataRed = new long[reduced->width];
-  long *reducedDataBlue = new long[reduced->width];
-  long *reducedDataGreen = new long[reduced->width];
-
-  for (y = 0; y < abs (image->height); y += reduction)
-    {
-      memset (reducedDataRed, 0, reduced->width * sizeof (long));
-      memset (reducedDataBlue, 0, reduced->width * sizeof (long));
-      memset (reducedDataGreen, 0, reduced->width * sizeof (long));
-
-      for (y1 = y; y1 < (y + reduction) && y1 < image->height; y1++)
-	{
-	  ip = image->line[y1];
-	  long *rpLongRed = reducedDataRed;
-	  long *rpLongBlue = reducedDataBlue;
-	  long *rpLongGreen = reducedDataGreen;
-
-	  int counter = 0;
-	  for (x = 0; x < image->width - reduction; x += reduction)
-	    {
-	      ip += reduction;
-
-	      for (i = 0; i < reduction; i++)
-		{
-		  *rpLongRed += image->color[ip[i]].red;
-		  *rpLongBlue += image->color[ip[i]].blue;
-		  *rpLongGreen += image->color[ip[i]].green;
-		}
-	      counter++;
-	      rpLongRed++;
-	      rpLongBlue++;
-	      rpLongGreen++;
-	    }
-
-	  for (i = counter; i < reduced->width; i++)
-	    {
-	      // white out the extra
-	      *rpLongRed += 0xff * reduction;
-	      *rpLongBlue += 0xff * reduction;
-	      *rpLongGreen += 0xff * reduction;
-	      rpLongRed++;
-	      rpLongBlue++;
-	      rpLongGreen++;
-	    }
-	}
-
-      // now move the long values into the image.
-      rp = &reduced->data[((y / reduction) * reduced->width)];
-      for (i = 0; i < (reduced->width); i++)
-	{
-	  unsigned char red = 0;
-	  unsigned char blue = 0;
-	  unsigned char green = 0;
-	  red = (unsigned char) (reducedDataRed[i] / area);
-	  blue = (unsigned char) (reducedDataBlue[i] / area);
-	  green = (unsigned char) (reducedDataGreen[i] / area);
-	  rp[i] = rgb2pix (red, green, blue);
-	}
-    }
-
-  delete (reducedDataRed);
-  delete (reducedDataBlue);
-  delete (reducedDataGreen);
-
-  for (y = 0; y < 256; y++)
-    {
-      reduced->color[y] = pix2bgr ((unsigned char) y);
-    }
-  return (0);
-}
-
-
 /////////////////////////////////////////////////////////////////////////////
 //
 // llimg_dub 
@@ -359,16 +513,11 @@ LLIMG *llimg_dub (LLIMG *img) {
   dubimg->height = img->height;
   dubimg->bits_per_pixel = 24;
   dubimg->dib_height = - dubimg->height;
-  int linebytes = 3 * img->width;
-  linebytes = 4 * ((linebytes + 3)/4);
-  dubimg->data = (unsigned char *)
-	  malloc (dubimg->height * linebytes);
-
-  dubimg->line = (unsigned char **)
-	  malloc (dubimg->height * sizeof (unsigned char *));
-  dubimg->line[0] = dubimg->data;
-  for (int l = 1; l < dubimg->height; l++)
-	  dubimg->line[l] = dubimg->line[l-1] + linebytes;
+  int linebytes = llimg_stride (img->width, 24);
+  if (llimg_alloc_data (dubimg)) {
+	  free (dubimg);
+	  return NULL;
+  }
 
   unsigned char *ip, *dp;
   int x;
@@ -27,6 +27,13 @@
 #include <string.h>
 
 #include "ll_image.h"
+#include "ll_simd.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
 
 ///////////////////////////////////////////////////////////////////////
 //
@@ -89,19 +96,12 @@ llimg_narrow24bit (LLIMG *image, int new_width, LLIMG *reduced)
   reduced->height = abs (image->height);
   reduced->dib_height = -reduced->height;
   
-  int line_bytes = 4*(((3 * reduced->width)+3)/4); /* BGR, long aligned*/
-  int reducedSize = line_bytes * abs (reduced->height);
-  reduced->data = (unsigned char *) malloc (reducedSize);
-  
-  reduced->line = (unsigned char **)                    
-    malloc (reduced->height * sizeof (unsigned char *));
-  reduced->line[0] = (reduced)->data;                       
-  for (y = 1; y < reduced->height; y++)  
-    reduced->line[y] = reduced->line[y - 1] + line_bytes;
+  if (llimg_alloc_data (reduced))
+    return (-1);
   
-  long *reducedDataRed = new long[new_width];
-  long *reducedDataBlue = new long[new_width];
-  long *reducedDataGreen = new long[new_width];
+  long *reducedDataRed = (long *) llimg_pool_get (new_width * sizeof (long));
+  long *reducedDataBlue = (long *) llimg_pool_get (new_width * sizeof (long));
+  long *reducedDataGreen = (long *) llimg_pool_get (new_width * sizeof (long));
   
   long *rpLongBlue, *rpLongGreen, *rpLongRed;
 
@@ -181,9 +181,9 @@ llimg_narrow24bit (LLIMG *image, int new_width, LLIMG *reduced)
     
   }
   
-  delete (reducedDataRed);
-  delete (reducedDataBlue);
-  delete (reducedDataGreen);
+  llimg_pool_put (reducedDataRed);
+  llimg_pool_put (reducedDataBlue);
+  llimg_pool_put (reducedDataGreen);
   
   return (0);
 }
@@ -212,20 +212,17 @@ llimg_shorten24bit (LLIMG *image, int new_height, LLIMG *reduced)
   reduced->height = new_height-1;
   reduced->dib_height = -reduced->height;
   
-  int line_bytes = 4*(((3 * reduced->width)+3)/4); /* BGR, long aligned*/
-  int reducedSize = line_bytes * abs (reduced->height);
-  reduced->data = (unsigned char *) malloc (reducedSize);
-  
-  reduced->line = (unsigned char **)                    
-    malloc (reduced->height * sizeof (unsigned char *));
-  reduced->line[0] = (reduced)->data;                       
-  for (y = 1; y < reduced->height; y++)  
-    reduced->line[y] = reduced->line[y - 1] + line_bytes;
+  if (llimg_alloc_data (reduced))
+    return (-1);
   
-  long *reducedDataRed = new long[image->width];
-  long *reducedDataBlue = new long[image->width];
-  long *reducedDataGreen = new long[image->width];
-  long *bottomBuff = new long[image->width * 3];
+  long *reducedDataRed =
+    (long *) llimg_pool_get (image->width * sizeof (long));
+  long *reducedDataBlue =
+    (long *) llimg_pool_get (image->width * sizeof (long));
+  long *reducedDataGreen =
+    (long *) llimg_pool_get (image->width * sizeof (long));
+  long *bottomBuff =
+    (long *) llimg_pool_get (image->width * 3 * sizeof (long));
   
   long *rpLongBlue, *rpLongGreen, *rpLongRed, *lp;
   
@@ -323,10 +320,10 @@ llimg_shorten24bit (LLIMG *image, int new_height, LLIMG *reduced)
   }
 
   
-  delete (reducedDataRed);
-  delete (reducedDataBlue);
-  delete (reducedDataGreen);
-  delete (bottomBuff);
+  llimg_pool_put (reducedDataRed);
+  llimg_pool_put (reducedDataBlue);
+  llimg_pool_put (reducedDataGreen);
+  llimg_pool_put (bottomBuff);
   
   return (0);
 }
@@ -358,19 +355,12 @@ llimg_narrow8bit (LLIMG *image, int new_width, LLIMG *reduced)
   reduced->height = abs (image->height);
   reduced->dib_height = -reduced->height;
   
-  int line_bytes = 4*(((reduced->width*3)+3)/4); /* BGR, long aligned*/
-  int reducedSize = line_bytes * abs (reduced->height);
-  reduced->data = (unsigned char *) malloc (reducedSize);
-  
-  reduced->line = (unsigned char **)                    
-    malloc (reduced->height * sizeof (unsigned char *));
-  reduced->line[0] = (reduced)->data;                       
-  for (y = 1; y < reduced->height; y++)  
-    reduced->line[y] = reduced->line[y - 1] + line_bytes;
+  if (llimg_alloc_data (reduced))
+    return (-1);
   
-  long *reducedDataRed = new long[new_width];
-  long *reducedDataBlue = new long[new_width];
-  long *reducedDataGreen = new long[new_width];
+  long *reducedDataRed = (long *) llimg_pool_get (new_width * sizeof (long));
+  long *reducedDataBlue = (long *) llimg_pool_get (new_width * sizeof (long));
+  long *reducedDataGreen = (long *) llimg_pool_get (new_width * sizeof (long));
   
   long *rpLongBlue, *rpLongGreen, *rpLongRed;
 
@@ -458,9 +448,9 @@ llimg_narrow8bit (LLIMG *image, int new_width, LLIMG *reduced)
     
   }
   
-  delete (reducedDataRed);
-  delete (reducedDataBlue);
-  delete (reducedDataGreen);
+  llimg_pool_put (reducedDataRed);
+  llimg_pool_put (reducedDataBlue);
+  llimg_pool_put (reducedDataGreen);
   
   return (0);
 }
@@ -487,20 +477,17 @@ llimg_shorten8bit (LLIMG *image, int new_height, LLIMG *reduced)
   reduced->height = new_height-1;
   reduced->dib_height = -reduced->height;
   
-  int line_bytes = 4*(((3 * reduced->width)+3)/4); /* BGR, long aligned*/
-  int reducedSize = line_bytes * abs (reduced->height);
-  reduced->data = (unsigned char *) malloc (reducedSize);
-  
-  reduced->line = (unsigned char **)                    
-    malloc (reduced->height * sizeof (unsigned char *));
-  reduced->line[0] = (reduced)->data;                       
-  for (y = 1; y < reduced->height; y++)  
-    reduced->line[y] = reduced->line[y - 1] + line_bytes;
+  if (llimg_alloc_data (reduced))
+    return (-1);
   
-  long *reducedDataRed = new long[image->width];
-  long *reducedDataBlue = new long[image->width];
-  long *reducedDataGreen = new long[image->width];
-  long *bottomBuff = new long[image->width * 3];
+  long *reducedDataRed =
+    (long *) llimg_pool_get (image->width * sizeof (long));
+  long *reducedDataBlue =
+    (long *) llimg_pool_get (image->width * sizeof (long));
+  long *reducedDataGreen =
+    (long *) llimg_pool_get (image->width * sizeof (long));
+  long *bottomBuff =
+    (long *) llimg_pool_get (image->width * 3 * sizeof (long));
   
   long *rpLongBlue, *rpLongGreen, *rpLongRed, *lp;
   
@@ -607,10 +594,10 @@ llimg_shorten8bit (LLIMG *image, int new_height, LLIMG *reduced)
   }
 
   
-  delete (reducedDataRed);
-  delete (reducedDataBlue);
-  delete (reducedDataGreen);
-  delete (bottomBuff);
+  llimg_pool_put (reducedDataRed);
+  llimg_pool_put (reducedDataBlue);
+  llimg_pool_put (reducedDataGreen);
+  llimg_pool_put (bottomBuff);
   
   return (0);
 }
@@ -677,19 +664,12 @@ llimg_widen24bit (LLIMG *image, int new_width, LLIMG *reduced)
   reduced->height = abs (image->height);
   reduced->dib_height = -reduced->height;
   
-  int line_bytes = 4*(((3 * reduced->width)+3)/4); /* BGR, long aligned*/
-  int reducedSize = line_bytes * abs (reduced->height);
-  reduced->data = (unsigned char *) malloc (reducedSize);
-  
-  reduced->line = (unsigned char **)                    
-    malloc (reduced->height * sizeof (unsigned char *));
-  reduced->line[0] = (reduced)->data;                       
-  for (y = 1; y < reduced->height; y++)  
-    reduced->line[y] = reduced->line[y - 1] + line_bytes;
+  if (llimg_alloc_data (reduced))
+    return (-1);
   
-  long *reducedDataRed = new long[new_width];
-  long *reducedDataBlue = new long[new_width];
-  long *reducedDataGreen = new long[new_width];
+  long *reducedDataRed = (long *) llimg_pool_get (new_width * sizeof (long));
+  long *reducedDataBlue = (long *) llimg_pool_get (new_width * sizeof (long));
+  long *reducedDataGreen = (long *) llimg_pool_get (new_width * sizeof (long));
   
   long *rpLongBlue, *rpLongGreen, *rpLongRed;
 
@@ -759,9 +739,9 @@ llimg_widen24bit (LLIMG *image, int new_width, LLIMG *reduced)
     
   }
   
-  delete (reducedDataRed);
-  delete (reducedDataBlue);
-  delete (reducedDataGreen);
+  llimg_pool_put (reducedDataRed);
+  llimg_pool_put (reducedDataBlue);
+  llimg_pool_put (reducedDataGreen);
   
   return (0);
 }
@@ -789,19 +769,15 @@ llimg_heighten24bit (LLIMG *image, int new_height, LLIMG *reduced)
   reduced->height = new_height-1;
   reduced->dib_height = -reduced->height;
   
-  int line_bytes = 4*(((3 * reduced->width)+3)/4); /* BGR, long aligned*/
-  int reducedSize = line_bytes * new_height;
-  reduced->data = (unsigned char *) malloc (reducedSize);
-  
-  reduced->line = (unsigned char **)                    
-    malloc (new_height * sizeof (unsigned char *));
-  reduced->line[0] = (reduced)->data;                       
-  for (y = 1; y < new_height; y++)  
-    reduced->line[y] = reduced->line[y - 1] + line_bytes;
+  if (llimg_alloc_data (reduced))
+    return (-1);
   
-  long *reducedDataRed = new long[image->width];
-  long *reducedDataBlue = new long[image->width];
-  long *reducedDataGreen = new long[image->width];
+  long *reducedDataRed =
+    (long *) llimg_pool_get (image->width * sizeof (long));
+  long *reducedDataBlue =
+    (long *) llimg_pool_get (image->width * sizeof (long));
+  long *reducedDataGreen =
+    (long *) llimg_pool_get (image->width * sizeof (long));
   
   long *rpLongBlue, *rpLongGreen, *rpLongRed;
   
@@ -873,9 +849,9 @@ llimg_heighten24bit (LLIMG *image, int new_height, LLIMG *reduced)
   }
 
   
-  delete (reducedDataRed);
-  delete (reducedDataBlue);
-  delete (reducedDataGreen);
+  llimg_pool_put (reducedDataRed);
+  llimg_pool_put (reducedDataBlue);
+  llimg_pool_put (reducedDataGreen);
   
   return (0);
 }
@@ -904,19 +880,15 @@ llimg_heighten8bit (LLIMG *image, int new_height, LLIMG *reduced)
   reduced->height = new_height-1;
   reduced->dib_height = -reduced->height;
   
-  int line_bytes = 4*(((3 * reduced->width)+3)/4); /* BGR, long aligned*/
-  int reducedSize = line_bytes * new_height;
-  reduced->data = (unsigned char *) malloc (reducedSize);
-  
-  reduced->line = (unsigned char **)                    
-    malloc (new_height * sizeof (unsigned char *));
-  reduced->line[0] = (reduced)->data;                       
-  for (y = 1; y < new_height; y++)  
-    reduced->line[y] = reduced->line[y - 1] + line_bytes;
+  if (llimg_alloc_data (reduced))
+    return (-1);
   
-  long *reducedDataRed = new long[image->width];
-  long *reducedDataBlue = new long[image->width];
-  long *reducedDataGreen = new long[image->width];
+  long *reducedDataRed =
+    (long *) llimg_pool_get (image->width * sizeof (long));
+  long *reducedDataBlue =
+    (long *) llimg_pool_get (image->width * sizeof (long));
+  long *reducedDataGreen =
+    (long *) llimg_pool_get (image->width * sizeof (long));
   
   long *rpLongBlue, *rpLongGreen, *rpLongRed;
   
@@ -993,9 +965,9 @@ llimg_heighten8bit (LLIMG *image, int new_height, LLIMG *reduced)
   }
 
   
-  delete (reducedDataRed);
-  delete (reducedDataBlue);
-  delete (reducedDataGreen);
+  llimg_pool_put (reducedDataRed);
+  llimg_pool_put (reducedDataBlue);
+  llimg_pool_put (reducedDataGreen);
   
   return (0);
 }
@@ -1009,6 +981,481 @@ llimg_heighten8bit (LLIMG *image, int new_height, LLIMG *reduced)
 //
 
 
+// Resampling engine
+//
+// The kernels above resize one axis at a time, so a resize used to run
+// a shorten/heighten pass into a full size temporary image and then a
+// narrow/widen pass out of it, working out the split weights again for
+// every pixel.  The engine below does both axes in a single pass over
+// the source:
+//
+//   - each axis gets a contribution table, built once per (source,
+//     destination) length pair: for every output index, the first
+//     contributing source index, the number of contributors, and their
+//     weights in RS_WT_BITS fixed point, summing to exactly RS_WT_ONE.
+//
+//   - source rows are filtered horizontally, as they are needed, into
+//     a ring of a few rows (as many as the widest vertical footprint),
+//     keeping RS_FRAC_BITS of fraction.  Each output row is then the
+//     vertical weighted sum of the ring rows under its footprint.
+//
+// Shrinking an axis averages the source pixels each output pixel
+// covers, weighted by coverage (the box filter of narrow/shorten).
+// Enlarging interpolates linearly between the two nearest source pixels
+// (as widen/heighten do).
+
+#define RS_WT_BITS   14
+#define RS_WT_ONE    (1 << RS_WT_BITS)
+#define RS_FRAC_BITS 7           /* 255 << 7 still fits a short */
+
+#define RS_H_SHIFT   (RS_WT_BITS - RS_FRAC_BITS)
+#define RS_V_SHIFT   (RS_WT_BITS + RS_FRAC_BITS)
+
+struct rs_axis {
+  int src_len;
+  int dst_len;
+  int max_count;     // widest footprint, the row pitch of weight[]
+  int *first;        // first contributing source index, per output
+  int *count;        // number of contributors, per output
+  short *weight;     // dst_len rows of max_count weights
+  int refs;          // the cache, if on it, and each resample using it
+};
+
+// The last few tables are kept, since the same sizes come up again and
+// again (all the windows of a tile, the two axes of a square image...).
+// A table pushed off the cache lives on until the resamples on it let
+// it go, and the decoders resample too, so the cache is locked.
+
+#define RS_CACHE_SLOTS 4
+
+static struct rs_axis *rs_cache[RS_CACHE_SLOTS];
+static int rs_cache_next = 0;
+
+#ifdef _WIN32
+static volatile LONG rs_busy = 0;
+#define RS_LOCK() while (InterlockedExchange (&rs_busy, 1)) Sleep (0)
+#define RS_UNLOCK() InterlockedExchange (&rs_busy, 0)
+#else
+static pthread_mutex_t rs_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define RS_LOCK() pthread_mutex_lock (&rs_mutex)
+#define RS_UNLOCK() pthread_mutex_unlock (&rs_mutex)
+#endif
+
+///////////////////////////////////////////////////////////////////////
+//
+//
+
+static void
+rs_free_axis (struct rs_axis *axis)
+{
+  if (!axis)
+    return;
+  delete [] axis->first;
+  delete [] axis->count;
+  delete [] axis->weight;
+  delete axis;
+}
+
+///////////////////////////////////////////////////////////////////////
+//
+//
+
+static struct rs_axis *
+rs_build_axis (int src_len, int dst_len)
+{
+  struct rs_axis *axis;
+  int i, j, k, n, big;
+  double scale, left, right, lo, hi, x, f;
+  int wsum;
+  short *wp;
+
+  axis = new struct rs_axis;
+  if (!axis)
+    return NULL;
+  axis->src_len = src_len;
+  axis->dst_len = dst_len;
+  if (dst_len < src_len)
+    axis->max_count = (src_len + dst_len - 1) / dst_len + 1;
+  else
+    axis->max_count = 2;
+  axis->first = new int[dst_len];
+  axis->count = new int[dst_len];
+  axis->weight = new short[dst_len * axis->max_count];
+  if (!axis->first || !axis->count || !axis->weight) {
+    rs_free_axis (axis);
+    return NULL;
+  }
+  memset (axis->weight, 0, dst_len * axis->max_count * sizeof (short));
+
+  scale = (double) src_len / (double) dst_len;
+
+  for (i = 0; i < dst_len; i++) {
+    wp = axis->weight + i * axis->max_count;
+
+    if (dst_len < src_len) {
+      // Output i covers [left, right) of the source
+      left = i * scale;
+      right = left + scale;
+      j = (int) left;
+      n = 0;
+      for (; j < src_len && j < right && n < axis->max_count; j++) {
+        lo = j < left ? left : j;
+        hi = j + 1 > right ? right : j + 1;
+        if (hi <= lo)
+          continue;
+        if (n == 0)
+          axis->first[i] = j;
+        wp[n++] = (short) ((hi - lo) * RS_WT_ONE / scale + 0.5);
+      }
+    }
+    else {
+      // Output i is centered at x in the source
+      x = (i + 0.5) * scale - 0.5;
+      if (x < 0)
+        x = 0;
+      j = (int) x;
+      f = x - j;
+      axis->first[i] = j;
+      if (j >= src_len - 1 || f == 0) {
+        n = 1;
+        wp[0] = RS_WT_ONE;
+      }
+      else {
+        n = 2;
+        wp[1] = (short) (f * RS_WT_ONE + 0.5);
+        wp[0] = RS_WT_ONE - wp[1];
+      }
+    }
+    axis->count[i] = n;
+
+    // Give any rounding error to the heaviest weight
+    wsum = 0;
+    big = 0;
+    for (k = 0; k < n; k++) {
+      wsum += wp[k];
+      if (wp[k] > wp[big])
+        big = k;
+    }
+    wp[big] += RS_WT_ONE - wsum;
+  }
+
+  return axis;
+}
+
+///////////////////////////////////////////////////////////////////////
+//
+// The table for src_len to dst_len, off the cache or made and put on
+// it; NULL if there is no memory for it.  Let go with rs_put_axis.
+
+static struct rs_axis *
+rs_get_axis (int src_len, int dst_len)
+{
+  struct rs_axis *axis, *old;
+  int i;
+
+  RS_LOCK ();
+  for (i = 0; i < RS_CACHE_SLOTS; i++) {
+    axis = rs_cache[i];
+    if (axis && axis->src_len == src_len && axis->dst_len == dst_len) {
+      axis->refs++;
+      RS_UNLOCK ();
+      return axis;
+    }
+  }
+  RS_UNLOCK ();
+
+  axis = rs_build_axis (src_len, dst_len);
+  if (!axis)
+    return NULL;
+  axis->refs = 2;
+  RS_LOCK ();
+  old = rs_cache[rs_cache_next];
+  rs_cache[rs_cache_next] = axis;
+  rs_cache_next = (rs_cache_next + 1) % RS_CACHE_SLOTS;
+  if (old && --old->refs)
+    old = NULL;
+  RS_UNLOCK ();
+  rs_free_axis (old);
+  return axis;
+}
+
+///////////////////////////////////////////////////////////////////////
+//
+// Lets go of a table from rs_get_axis, freeing it if it has been
+// pushed off the cache and no one else is on it
+
+static void
+rs_put_axis (struct rs_axis *axis)
+{
+  if (!axis)
+    return;
+  RS_LOCK ();
+  if (--axis->refs)
+    axis = NULL;
+  RS_UNLOCK ();
+  rs_free_axis (axis);
+}
+
+///////////////////////////////////////////////////////////////////////
+//
+// Filters one source row across into a ring row of BGR shorts, or of
+// gray ones if gray
+
+static void
+rs_filter_row (LLIMG *image, int y, struct rs_axis *ax, short *out, int gray)
+{
+  unsigned char *ip = image->line[y];
+  unsigned char *sp;
+  struct bgr_color *clr = image->color;
+  short *wp;
+  int x, k, n, w, b, g, r;
+  int round = 1 << (RS_H_SHIFT - 1);
+
+  for (x = 0; x < ax->dst_len; x++) {
+    wp = ax->weight + x * ax->max_count;
+    n = ax->count[x];
+    b = g = r = round;
+    if (gray) {
+      sp = ip + ax->first[x];
+      for (k = 0; k < n; k++)
+        b += wp[k] * *sp++;
+      *out++ = (short) (b >> RS_H_SHIFT);
+      continue;
+    }
+    if (image->bits_per_pixel == 24) {
+      sp = ip + 3 * ax->first[x];
+      for (k = 0; k < n; k++) {
+        w = wp[k];
+        b += w * *sp++;
+        g += w * *sp++;
+        r += w * *sp++;
+      }
+    }
+    else {
+      sp = ip + ax->first[x];
+      for (k = 0; k < n; k++) {
+        w = wp[k];
+        b += w * clr[*sp].blue;
+        g += w * clr[*sp].green;
+        r += w * clr[*sp].red;
+        sp++;
+      }
+    }
+    *out++ = (short) (b >> RS_H_SHIFT);
+    *out++ = (short) (g >> RS_H_SHIFT);
+    *out++ = (short) (r >> RS_H_SHIFT);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////
+//
+// acc[x] += wa * a[x] + wb * b[x] for n values.  Ring values are at most
+// 255 << RS_FRAC_BITS and weights at most RS_WT_ONE, so each pair of
+// products fits the 32 bit lanes of pmaddwd.
+
+static void
+rs_sum_rows (int *acc, const short *a, const short *b, int wa, int wb, int n)
+{
+  int x = 0;
+
+#if defined(LLIMG_AVX2)
+  if (llimg_cpu () & LLIMG_CPU_AVX2) {
+    __m256i va = _mm256_set1_epi32 (wa);
+    __m256i vb = _mm256_set1_epi32 (wb);
+    for (; x + 8 <= n; x += 8) {
+      __m256i pa = _mm256_cvtepi16_epi32 (
+        _mm_loadu_si128 ((const __m128i *) (a + x)));
+      __m256i pb = _mm256_cvtepi16_epi32 (
+        _mm_loadu_si128 ((const __m128i *) (b + x)));
+      __m256i *ap = (__m256i *) (acc + x);
+      __m256i s = _mm256_add_epi32 (_mm256_mullo_epi32 (pa, va),
+                                    _mm256_mullo_epi32 (pb, vb));
+      _mm256_storeu_si256 (ap, _mm256_add_epi32 (_mm256_loadu_si256 (ap), s));
+    }
+  }
+#endif
+#if defined(LLIMG_SSE2)
+  if (llimg_cpu () & LLIMG_CPU_SSE2) {
+    __m128i w = _mm_set1_epi32 ((wb << 16) | (wa & 0xffff));
+    for (; x + 8 <= n; x += 8) {
+      __m128i pa = _mm_loadu_si128 ((const __m128i *) (a + x));
+      __m128i pb = _mm_loadu_si128 ((const __m128i *) (b + x));
+      __m128i *ap = (__m128i *) (acc + x);
+      _mm_storeu_si128 (ap, _mm_add_epi32 (_mm_loadu_si128 (ap),
+        _mm_madd_epi16 (_mm_unpacklo_epi16 (pa, pb), w)));
+      _mm_storeu_si128 (ap + 1, _mm_add_epi32 (_mm_loadu_si128 (ap + 1),
+        _mm_madd_epi16 (_mm_unpackhi_epi16 (pa, pb), w)));
+    }
+  }
+#endif
+  for (; x < n; x++)
+    acc[x] += wa * a[x] + wb * b[x];
+}
+
+///////////////////////////////////////////////////////////////////////
+//
+// op[x] = acc[x] >> RS_V_SHIFT for n values, all already in 0..255
+
+static void
+rs_store_row (unsigned char *op, const int *acc, int n)
+{
+  int x = 0;
+
+#if defined(LLIMG_SSE2)
+  if (llimg_cpu () & LLIMG_CPU_SSE2) {
+    for (; x + 8 <= n; x += 8) {
+      __m128i lo = _mm_srai_epi32 (
+        _mm_loadu_si128 ((const __m128i *) (acc + x)), RS_V_SHIFT);
+      __m128i hi = _mm_srai_epi32 (
+        _mm_loadu_si128 ((const __m128i *) (acc + x + 4)), RS_V_SHIFT);
+      __m128i p = _mm_packs_epi32 (lo, hi);
+      _mm_storel_epi64 ((__m128i *) (op + x), _mm_packus_epi16 (p, p));
+    }
+  }
+#endif
+  for (; x < n; x++)
+    op[x] = (unsigned char) (acc[x] >> RS_V_SHIFT);
+}
+
+///////////////////////////////////////////////////////////////////////
+//
+// Resamples image (8 bit color tabled or 24 bit) into a new_width by
+// new_height image.  C linkage, for the decoders.  An 8 bit image comes
+// out 8 bit, gray or on its own color table, as llimg_reduce256 makes
+// it; otherwise the output is 24 bit.
+//
+// An image that is to be shown turned (image->rotation) comes out
+// turned, new_width by new_height as shown: each row is resampled as
+// the image is stored and put where the turn takes it.
+
+extern "C" int
+llimg_resample (LLIMG *image, int new_width, int new_height, LLIMG *resized)
+{
+  struct rs_axis *ax, *ay;
+  short *ring, *wp, *rp;
+  int ring_rows, next_row;
+  int y, x, k, n, first;
+  int *acc;
+  int round = 1 << (RS_V_SHIFT - 1);
+  int row_len, src_w, src_h, orient, kind;
+  const unsigned char *inverse = NULL;
+  unsigned char *turned, *averaged, *op;
+
+  if (image->bits_per_pixel != 8 && image->bits_per_pixel != 24)
+    return (-1);
+  if (new_width < 1 || new_height < 1)
+    return (-1);
+
+  // The output as the image is stored
+  orient = image->rotation > LLIMG_ORIENT_NORMAL ? image->rotation : 0;
+  src_w = new_width;
+  src_h = new_height;
+  if (orient >= LLIMG_ORIENT_TRANSPOSE) {
+    src_w = new_height;
+    src_h = new_width;
+  }
+
+  ax = rs_get_axis (image->width, src_w);
+  ay = rs_get_axis (image->height, src_h);
+  if (!ax || !ay) {
+    rs_put_axis (ax);
+    rs_put_axis (ay);
+    return (-1);
+  }
+
+  kind = llimg_palette_kind (image);
+  if (kind == LLIMG_KEEP_INDEX) {
+    inverse = llimg_inverse_palette (image);
+    if (!inverse)
+      kind = 0;
+  }
+
+  llimg_zero_llimg (resized);
+  resized->bits_per_pixel = kind ? 8 : 24;
+  resized->width = new_width;
+  resized->height = new_height;
+  resized->dib_height = -resized->height;
+  if (kind)
+    memcpy (resized->color, image->color, sizeof (resized->color));
+
+  if (llimg_alloc_data (resized)) {
+    rs_put_axis (ax);
+    rs_put_axis (ay);
+    llimg_release_inverse (inverse);
+    return (-1);
+  }
+
+  row_len = (kind == LLIMG_KEEP_GRAY ? 1 : 3) * src_w;
+  ring_rows = ay->max_count;
+  ring = (short *) llimg_pool_get (ring_rows * row_len * sizeof (short));
+  acc = (int *) llimg_pool_get (row_len * sizeof (int));
+  turned = orient ? (unsigned char *) llimg_pool_get (row_len) : NULL;
+  averaged = inverse ? (unsigned char *) llimg_pool_get (row_len) : NULL;
+  if (!ring || !acc || (orient && !turned) || (inverse && !averaged)) {
+    llimg_pool_put (ring);
+    llimg_pool_put (acc);
+    llimg_pool_put (turned);
+    llimg_pool_put (averaged);
+    llimg_prune_llimg (resized);
+    rs_put_axis (ax);
+    rs_put_axis (ay);
+    llimg_release_inverse (inverse);
+    return (-1);
+  }
+  next_row = 0;
+
+  for (y = 0; y < src_h; y++) {
+    first = ay->first[y];
+    n = ay->count[y];
+    wp = ay->weight + y * ay->max_count;
+
+    // Bring the rows under this footprint into the ring
+    if (next_row < first)
+      next_row = first;
+    for (; next_row < first + n; next_row++)
+      rs_filter_row (image, next_row, ax,
+                     ring + (next_row % ring_rows) * row_len,
+                     kind == LLIMG_KEEP_GRAY);
+
+    // ...and sum them down into the output row, two rows at a time
+    for (x = 0; x < row_len; x++)
+      acc[x] = round;
+    for (k = 0; k + 1 < n; k += 2)
+      rs_sum_rows (acc, ring + ((first + k) % ring_rows) * row_len,
+                   ring + ((first + k + 1) % ring_rows) * row_len,
+                   wp[k], wp[k + 1], row_len);
+    if (k < n) {
+      rp = ring + ((first + k) % ring_rows) * row_len;
+      rs_sum_rows (acc, rp, rp, wp[k], 0, row_len);
+    }
+    op = orient ? turned : resized->line[y];
+    if (inverse) {
+      rs_store_row (averaged, acc, row_len);
+      llimg_index_row (inverse, averaged, op, src_w);
+    }
+    else
+      rs_store_row (op, acc, row_len);
+    if (orient)
+      llimg_orient_row (resized, orient, turned, y, src_w, src_h);
+  }
+
+  llimg_pool_put (ring);
+  llimg_pool_put (acc);
+  llimg_pool_put (turned);
+  llimg_pool_put (averaged);
+  rs_put_axis (ax);
+  rs_put_axis (ay);
+  llimg_release_inverse (inverse);
+
+  return (0);
+}
+
+///////////////////////////////////////////////////////////////////////
+//
+// Returns a new image one pixel less than width by height.  Callers ask
+// for their client size plus one, as they did with the narrow/widen
+// and shorten/heighten chain this replaces.
+
 LLIMG * llimg_resize (LLIMG *image, int width, int height) {
   if (!image)
     return NULL;
@@ -1016,31 +1463,11 @@ LLIMG * llimg_resize (LLIMG *image, int width, int height) {
   if (!resized)
     return NULL;
   llimg_zero_llimg (resized);
-  LLIMG *llimg_temp = (LLIMG *) malloc(sizeof(LLIMG));
-  if (!llimg_temp)
-    return NULL;
-  llimg_zero_llimg (llimg_temp);
 
-  if (height < image->height) {
-    if (image->bits_per_pixel == 8)
-      llimg_shorten8bit (image, height, llimg_temp);
-    else
-      llimg_shorten24bit (image, height, llimg_temp);
-  }
-  else {
-    if (image->bits_per_pixel == 8)
-      llimg_heighten8bit (image, height, llimg_temp);
-    else
-      llimg_heighten24bit (image, height, llimg_temp);
-  }
-  if (width < image->width) {
-    llimg_narrow24bit (llimg_temp, width, resized);
-  }
-  else {
-    llimg_widen24bit (llimg_temp, width, resized);
+  if (llimg_resample (image, width - 1, height - 1, resized)) {
+    free (resized);
+    return NULL;
   }
-  
-  llimg_release_llimg (llimg_temp);
 
   return resized;
 }
@@ -1056,8 +1483,15 @@ void llimg_lock_aspect (LLIMG *image, int &width, int &height){
   // h = (ih * w)/iw
   if (!image)
     return;
-  int lock_width = (image->width * height)/image->height;
-  int lock_height = (image->height * width)/image->width; 
+  // The aspect the image shows at, turned or not
+  long iw = image->width;
+  long ih = image->height;
+  if (image->rotation >= LLIMG_ORIENT_TRANSPOSE) {
+    iw = image->height;
+    ih = image->width;
+  }
+  int lock_width = (iw * height)/ih;
+  int lock_height = (ih * width)/iw; 
   if (lock_width < width) {
     width = lock_width;    
   }
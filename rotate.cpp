@@ -21,220 +21,762 @@
 //
 // File: rotate.cpp
 //
+// The eight ways to lay an image back onto itself: turns by quarters,
+// mirrors and the transposes, numbered as the Exif orientation tag
+// numbers them (LLIMG_ORIENT_...).  Each is a single pass over the
+// image.  One that keeps rows as rows copies row by row; one that
+// makes rows into columns goes a tile at a time, so the source rows
+// of a tile stay in the cache while its columns are written out, and
+// within a tile by 16 x 16 byte (SSE2) or 4 x 4 BGR pixel (SSSE3)
+// blocks transposed in registers.
+//
+// Turning by any other angle is at the end.
+//
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 
 #include "ll_image.h"
+#include "ll_simd.h"
 
 /////////////////////////////////////////////////////////////////////////////
 //
+// What each transform does, taking destination (x, y) from source
+//   transpose: (sx, sy) = (y, x), else (x, y)
+//   flip_x:    sx = w - 1 - sx
+//   flip_y:    sy = h - 1 - sy
+// where w and h are the source size
+
+static const struct {
+  char transpose, flip_x, flip_y;
+} orient_kind[9] = {
+  { 0, 0, 0 },  // 0 is taken as NORMAL
+  { 0, 0, 0 },  // NORMAL
+  { 0, 1, 0 },  // FLIP_H
+  { 0, 1, 1 },  // 180
+  { 0, 0, 1 },  // FLIP_V
+  { 1, 0, 0 },  // TRANSPOSE
+  { 1, 0, 1 },  // CW
+  { 1, 1, 1 },  // TRANSVERSE
+  { 1, 1, 0 }   // CCW
+};
+
+// ...and where it takes a point about the center, x' = m0 x + m1 y,
+// y' = m2 x + m3 y, for putting transforms together
+
+static const int orient_matrix[9][4] = {
+  {  1,  0,  0,  1 },
+  {  1,  0,  0,  1 },
+  { -1,  0,  0,  1 },
+  { -1,  0,  0, -1 },
+  {  1,  0,  0, -1 },
+  {  0,  1,  1,  0 },
+  {  0, -1,  1,  0 },
+  {  0, -1, -1,  0 },
+  {  0,  1, -1,  0 }
+};
+
+#define ORIENT_TILE 32   // Pixels on a side of a transpose tile
 
-int 
-llimg_rotate24bitR (LLIMG *image, LLIMG *rotated)
+/////////////////////////////////////////////////////////////////////////////
+//
+// The one transform that does first, then then
+
+int
+llimg_orient_compose (int first, int then)
 {
-  int y;
-  
-  if (image->bits_per_pixel != 24)
-    return (-1);
-  
-  llimg_zero_llimg (rotated);
-  rotated->bits_per_pixel = 24;
-  
-  rotated->width = image->height;
-  rotated->height = image->width;
-  rotated->dib_height = -rotated->height;
-  
-  int line_bytes = 4*(((3 * rotated->width)+3)/4); /* BGR, long aligned*/
-  int rotatedSize = line_bytes * abs (rotated->height);
-  rotated->data = (unsigned char *) malloc (rotatedSize);
-  
-  rotated->line = (unsigned char **)                    
-    malloc (rotated->height * sizeof (unsigned char *));
-  rotated->line[0] = rotated->data;                       
-  for (y = 1; y < rotated->height; y++)  
-    rotated->line[y] = rotated->line[y - 1] + line_bytes;
-   
-
-  unsigned char *ip, *rp;
-  int x, ry;
-  // The source image is read from top to bottom
-  // The rotated image is filled from right to left
-  int rot_offset = (rotated->width - 1) * 3;
-  
-  for (y = 0; y < image->height; y++ ) {
-    ip = image->line[y];
-    ry = 0;
-    for (x = 0; x < image->width; x++) {
-      rp = rotated->line[ry++] + rot_offset;
-      *rp++ = *ip++;  // blue
-      *rp++ = *ip++;  // green
-      *rp++ = *ip++;  // red
-    } // For each pixel in the source line
-    rot_offset -= 3;
-  } // For each line in the source image
+  const int *a, *b;
+  int m[4], t;
+
+  if (first < 1 || first > 8)
+    first = LLIMG_ORIENT_NORMAL;
+  if (then < 1 || then > 8)
+    then = LLIMG_ORIENT_NORMAL;
+  a = orient_matrix[first];
+  b = orient_matrix[then];
+  m[0] = b[0] * a[0] + b[1] * a[2];
+  m[1] = b[0] * a[1] + b[1] * a[3];
+  m[2] = b[2] * a[0] + b[3] * a[2];
+  m[3] = b[2] * a[1] + b[3] * a[3];
+  for (t = 1; t <= 8; t++) {
+    if (!memcmp (m, orient_matrix[t], sizeof (m)))
+      return t;
+  }
+  return LLIMG_ORIENT_NORMAL;
+}
 
-  return (0);
+/////////////////////////////////////////////////////////////////////////////
+//
+// Each destination row is a source row, mirrored or not
+
+static void
+orient_rows (LLIMG *image, LLIMG *oriented, int bytes, int flip_x, int flip_y)
+{
+  unsigned char *ip, *op;
+  int x, y, w = image->width, h = image->height;
+
+  for (y = 0; y < h; y++) {
+    ip = image->line[flip_y ? h - 1 - y : y];
+    op = oriented->line[y];
+    if (!flip_x) {
+      memcpy (op, ip, w * bytes);
+    }
+    else if (bytes == 3) {
+      ip += 3 * (w - 1);
+      for (x = 0; x < w; x++, ip -= 3) {
+        *op++ = ip[0];  // blue
+        *op++ = ip[1];  // green
+        *op++ = ip[2];  // red
+      }
+    }
+    else {
+      ip += w - 1;
+      for (x = 0; x < w; x++)
+        *op++ = *ip--;
+    }
+  }
 }
 
+/////////////////////////////////////////////////////////////////////////////
+//
+// Part of a transpose tile, a pixel at a time: destination rows y0 to
+// y1 and columns x0 to x1 of the tile at (tx, ty), from the source rows
+// at rows[0 ..].  Source columns run backwards for flip_x.
+
+static void
+tile_pixels (unsigned char **rows, LLIMG *oriented, int bytes, int w,
+             int flip_x, int tx, int ty, int x0, int x1, int y0, int y1)
+{
+  unsigned char *op, *ip;
+  int x, y, sx;
+
+  for (y = y0; y < y1; y++) {
+    sx = flip_x ? w - 1 - (ty + y) : ty + y;
+    op = oriented->line[ty + y] + (tx + x0) * bytes;
+    if (bytes == 3) {
+      sx *= 3;
+      for (x = x0; x < x1; x++) {
+        ip = rows[x] + sx;
+        *op++ = ip[0];  // blue
+        *op++ = ip[1];  // green
+        *op++ = ip[2];  // red
+      }
+    }
+    else {
+      for (x = x0; x < x1; x++)
+        *op++ = rows[x][sx];
+    }
+  }
+}
 
+#ifdef LLIMG_SSE2
 
 /////////////////////////////////////////////////////////////////////////////
 //
+// 16 by 16 bytes: the 16 source rows at rows[x ..] from the source
+// column for destination row y, to destination rows y to y + 15.
+// Four rounds of interleaving rows i and i + 8 is a transpose.
 
-int 
-llimg_rotate8bitR (LLIMG *image, LLIMG *rotated)
+#define BLOCK8 16
+
+static void
+block8 (unsigned char **rows, LLIMG *oriented, int w, int flip_x,
+        int tx, int ty, int x, int y)
 {
-  int y;
-  
-  if (image->bits_per_pixel != 8)
-    return (-1);
-  
-  llimg_zero_llimg (rotated);
-  rotated->bits_per_pixel = 8;
-  
-  rotated->width = image->height;
-  rotated->height = image->width;
-  rotated->dib_height = -rotated->height;
-  
-  int line_bytes = 4*((rotated->width+3)/4); /* 8 bit, long aligned*/
-  int rotatedSize = line_bytes * abs (rotated->height);
-  rotated->data = (unsigned char *) malloc (rotatedSize);
-  
-  rotated->line = (unsigned char **)                    
-    malloc (rotated->height * sizeof (unsigned char *));
-  rotated->line[0] = rotated->data;                       
-  for (y = 1; y < rotated->height; y++)  
-    rotated->line[y] = rotated->line[y - 1] + line_bytes;
-   
-
-  unsigned char *ip, *rp;
-  int x, ry;
-  // The source image is read from top to bottom
-  // The rotated image is filled from right to left
-  int rot_offset = rotated->width - 1;
-  
-  for (y = 0; y < image->height; y++ ) {
-    ip = image->line[y];
-    ry = 0;
-    for (x = 0; x < image->width; x++) {
-      rp = rotated->line[ry++] + rot_offset;
-      *rp = *ip++;
-    } // For each pixel in the source line
-    rot_offset --;
-  } // For each line in the source image
+  __m128i a[16], b[16];
+  int i, r, sx;
+
+  sx = flip_x ? w - BLOCK8 - (ty + y) : ty + y;
+  for (i = 0; i < 16; i++)
+    a[i] = _mm_loadu_si128 ((const __m128i *) (rows[x + i] + sx));
+  for (r = 0; r < 4; r++) {
+    for (i = 0; i < 8; i++) {
+      b[2 * i] = _mm_unpacklo_epi8 (a[i], a[i + 8]);
+      b[2 * i + 1] = _mm_unpackhi_epi8 (a[i], a[i + 8]);
+    }
+    for (i = 0; i < 16; i++)
+      a[i] = b[i];
+  }
+  // a[i] is source column sx + i
+  for (i = 0; i < 16; i++)
+    _mm_storeu_si128 ((__m128i *) (oriented->line[ty + y
+                                   + (flip_x ? 15 - i : i)] + tx + x), a[i]);
+}
 
-  // Copy the color table
-  memcpy (rotated->color, image->color, 256 * sizeof(struct bgr_color));
+#endif
 
+#ifdef LLIMG_SSSE3
 
-  return (0);
+/////////////////////////////////////////////////////////////////////////////
+//
+// 4 by 4 BGR pixels: each source row's 12 bytes are spread to a pixel
+// a 32 bit lane, the lanes are transposed, and each result is packed
+// back to 12 bytes.  Loads and stores are exactly 12 bytes, so nothing
+// past the ends of the rows is touched.
+
+#define BLOCK24 4
+
+static __m128i
+load12 (const unsigned char *p)
+{
+  return _mm_unpacklo_epi64 (_mm_loadl_epi64 ((const __m128i *) p),
+                             _mm_cvtsi32_si128 (*(const int *) (p + 8)));
 }
 
+static void
+store12 (unsigned char *p, __m128i v)
+{
+  _mm_storel_epi64 ((__m128i *) p, v);
+  *(int *) (p + 8) = _mm_cvtsi128_si32 (_mm_srli_si128 (v, 8));
+}
 
+static void
+block24 (unsigned char **rows, LLIMG *oriented, int w, int flip_x,
+         int tx, int ty, int x, int y)
+{
+  const __m128i spread = _mm_setr_epi8 (0, 1, 2, -1, 3, 4, 5, -1,
+                                        6, 7, 8, -1, 9, 10, 11, -1);
+  const __m128i pack = _mm_setr_epi8 (0, 1, 2, 4, 5, 6, 8, 9,
+                                      10, 12, 13, 14, -1, -1, -1, -1);
+  __m128i a, b, c, d, ab_lo, cd_lo, ab_hi, cd_hi;
+  __m128i r[4];
+  int i, sx;
+
+  sx = 3 * (flip_x ? w - BLOCK24 - (ty + y) : ty + y);
+  a = _mm_shuffle_epi8 (load12 (rows[x] + sx), spread);
+  b = _mm_shuffle_epi8 (load12 (rows[x + 1] + sx), spread);
+  c = _mm_shuffle_epi8 (load12 (rows[x + 2] + sx), spread);
+  d = _mm_shuffle_epi8 (load12 (rows[x + 3] + sx), spread);
+  ab_lo = _mm_unpacklo_epi32 (a, b);
+  cd_lo = _mm_unpacklo_epi32 (c, d);
+  ab_hi = _mm_unpackhi_epi32 (a, b);
+  cd_hi = _mm_unpackhi_epi32 (c, d);
+  r[0] = _mm_unpacklo_epi64 (ab_lo, cd_lo);
+  r[1] = _mm_unpackhi_epi64 (ab_lo, cd_lo);
+  r[2] = _mm_unpacklo_epi64 (ab_hi, cd_hi);
+  r[3] = _mm_unpackhi_epi64 (ab_hi, cd_hi);
+  // r[i] is source column sx/3 + i
+  for (i = 0; i < 4; i++)
+    store12 (oriented->line[ty + y + (flip_x ? 3 - i : i)] + 3 * (tx + x),
+             _mm_shuffle_epi8 (r[i], pack));
+}
 
+#endif
 
 /////////////////////////////////////////////////////////////////////////////
 //
+// Each destination row is a source column, taken a tile at a time: a
+// tile's destination columns are ORIENT_TILE source rows, whose pixels
+// in the tile's span stay in cache while the destination rows are
+// filled.  Whole blocks of a tile go through the vector kernels where
+// there are some, the edges a pixel at a time.
+
+static void
+orient_tiles (LLIMG *image, LLIMG *oriented, int bytes,
+              int flip_x, int flip_y)
+{
+  unsigned char *rows[ORIENT_TILE];
+  int w = image->width, h = image->height;
+  int tx, ty, tw, th, x, y, bw, bh;
+
+  for (ty = 0; ty < oriented->height; ty += ORIENT_TILE) {
+    th = oriented->height - ty;
+    if (th > ORIENT_TILE)
+      th = ORIENT_TILE;
+    for (tx = 0; tx < oriented->width; tx += ORIENT_TILE) {
+      tw = oriented->width - tx;
+      if (tw > ORIENT_TILE)
+        tw = ORIENT_TILE;
+      for (x = 0; x < tw; x++)
+        rows[x] = image->line[flip_y ? h - 1 - (tx + x) : tx + x];
+
+      // The part of the tile in whole blocks
+      bw = 0;
+      bh = 0;
+#ifdef LLIMG_SSE2
+      if (bytes == 1 && (llimg_cpu () & LLIMG_CPU_SSE2)) {
+        bw = tw - tw % BLOCK8;
+        bh = th - th % BLOCK8;
+        for (y = 0; y < bh; y += BLOCK8)
+          for (x = 0; x < bw; x += BLOCK8)
+            block8 (rows, oriented, w, flip_x, tx, ty, x, y);
+      }
+#endif
+#ifdef LLIMG_SSSE3
+      if (bytes == 3 && (llimg_cpu () & LLIMG_CPU_SSSE3)) {
+        bw = tw - tw % BLOCK24;
+        bh = th - th % BLOCK24;
+        for (y = 0; y < bh; y += BLOCK24)
+          for (x = 0; x < bw; x += BLOCK24)
+            block24 (rows, oriented, w, flip_x, tx, ty, x, y);
+      }
+#endif
+      tile_pixels (rows, oriented, bytes, w, flip_x, tx, ty, bw, tw, 0, bh);
+      tile_pixels (rows, oriented, bytes, w, flip_x, tx, ty, 0, tw, bh, th);
+    }
+  }
+}
 
-int 
-llimg_rotate24bitL (LLIMG *image, LLIMG *rotated)
+/////////////////////////////////////////////////////////////////////////////
+//
+// Fills in *oriented with image put through the transform; 0 or -1
+
+static int
+orient_into (LLIMG *image, int transform, LLIMG *oriented)
 {
-  int y;
-  
-  if (image->bits_per_pixel != 24)
+  int bytes;
+
+  if (image->bits_per_pixel != 8 && image->bits_per_pixel != 24)
+    return (-1);
+  if (transform < 1 || transform > 8)
+    transform = LLIMG_ORIENT_NORMAL;
+  bytes = image->bits_per_pixel / 8;
+
+  llimg_zero_llimg (oriented);
+  oriented->bits_per_pixel = image->bits_per_pixel;
+  if (orient_kind[transform].transpose) {
+    oriented->width = image->height;
+    oriented->height = image->width;
+    // A scaled read stays one
+    oriented->full_width = image->full_height;
+    oriented->full_height = image->full_width;
+  }
+  else {
+    oriented->width = image->width;
+    oriented->height = image->height;
+    oriented->full_width = image->full_width;
+    oriented->full_height = image->full_height;
+  }
+  oriented->dib_height = -oriented->height;
+
+  if (llimg_alloc_data (oriented))
     return (-1);
-  
-  llimg_zero_llimg (rotated);
-  rotated->bits_per_pixel = 24;
-  
-  rotated->width = image->height;
-  rotated->height = image->width;
-  rotated->dib_height = -rotated->height;
-  
-  int line_bytes = 4*(((3 * rotated->width)+3)/4); /* BGR, long aligned*/
-  int rotatedSize = line_bytes * abs (rotated->height);
-  rotated->data = (unsigned char *) malloc (rotatedSize);
-  
-  rotated->line = (unsigned char **)                    
-    malloc (rotated->height * sizeof (unsigned char *));
-  rotated->line[0] = rotated->data;                       
-  for (y = 1; y < rotated->height; y++)  
-    rotated->line[y] = rotated->line[y - 1] + line_bytes;
-   
-
-  unsigned char *ip, *rp;
-  int x, ry;
-
-  
-  int rot_offset = 0;
-  
-  for (y = 0; y < image->height; y++ ) {
-    ip = image->line[y];
-    ry = rotated->height - 1;
-    for (x = 0; x < image->width; x++) {
-      rp = rotated->line[ry--] + rot_offset;
-      *rp++ = *ip++;  // blue
-      *rp++ = *ip++;  // green
-      *rp++ = *ip++;  // red
-    } // For each pixel in the source line
-    rot_offset += 3;
-  } // For each line in the source image
+
+  if (orient_kind[transform].transpose)
+    orient_tiles (image, oriented, bytes,
+                  orient_kind[transform].flip_x, orient_kind[transform].flip_y);
+  else
+    orient_rows (image, oriented, bytes,
+                 orient_kind[transform].flip_x, orient_kind[transform].flip_y);
+
+  // Copy the color table
+  if (bytes == 1)
+    memcpy (oriented->color, image->color, 256 * sizeof(struct bgr_color));
 
   return (0);
 }
 
+/////////////////////////////////////////////////////////////////////////////
+//
+// Returns a new image, image put through the transform, or NULL
+
+LLIMG *
+llimg_orient (LLIMG *image, int transform)
+{
+  LLIMG *oriented;
+
+  if (!image)
+    return NULL;
+  oriented = llimg_create_base ();
+  if (!oriented)
+    return NULL;
+  if (orient_into (image, transform, oriented)) {
+    free (oriented);
+    return NULL;
+  }
+  return oriented;
+}
 
+/////////////////////////////////////////////////////////////////////////////
+//
+// Stores row y of a w by h image where the transform puts it in
+// oriented: along one of its rows, or down one of its columns.  This is
+// how the reduce and resize kernels, which make their output a row at a
+// time, make it turned as they go.
+
+extern "C" void
+llimg_orient_row (LLIMG *oriented, int transform, const unsigned char *row,
+                  int y, int w, int h)
+{
+  unsigned char *op;
+  int bytes = oriented->bits_per_pixel / 8;
+  int x, dx, dy, flip_x;
+
+  if (transform < 1 || transform > 8)
+    transform = LLIMG_ORIENT_NORMAL;
+  flip_x = orient_kind[transform].flip_x;
+  dy = orient_kind[transform].flip_y ? h - 1 - y : y;
+  if (!orient_kind[transform].transpose && !flip_x) {
+    memcpy (oriented->line[dy], row, w * bytes);
+    return;
+  }
+  for (x = 0; x < w; x++, row += bytes) {
+    dx = flip_x ? w - 1 - x : x;
+    if (orient_kind[transform].transpose)
+      op = oriented->line[dx] + dy * bytes;
+    else
+      op = oriented->line[dy] + dx * bytes;
+    op[0] = row[0];
+    if (bytes == 3) {
+      op[1] = row[1];
+      op[2] = row[2];
+    }
+  }
+}
 
 /////////////////////////////////////////////////////////////////////////////
 //
+// The quarter turns
+
+int 
+llimg_rotate24bitR (LLIMG *image, LLIMG *rotated)
+{
+  if (image->bits_per_pixel != 24)
+    return (-1);
+  return orient_into (image, LLIMG_ORIENT_CW, rotated);
+}
+
+int 
+llimg_rotate8bitR (LLIMG *image, LLIMG *rotated)
+{
+  if (image->bits_per_pixel != 8)
+    return (-1);
+  return orient_into (image, LLIMG_ORIENT_CW, rotated);
+}
+
+int 
+llimg_rotate24bitL (LLIMG *image, LLIMG *rotated)
+{
+  if (image->bits_per_pixel != 24)
+    return (-1);
+  return orient_into (image, LLIMG_ORIENT_CCW, rotated);
+}
 
 int 
 llimg_rotate8bitL (LLIMG *image, LLIMG *rotated)
 {
-  int y;
-  
   if (image->bits_per_pixel != 8)
     return (-1);
-  
-  llimg_zero_llimg (rotated);
-  rotated->bits_per_pixel = 8;
-  
-  rotated->width = image->height;
-  rotated->height = image->width;
-  rotated->dib_height = -rotated->height;
-  
-  int line_bytes = 4*((rotated->width+3)/4); /* 8 bit, long aligned*/
-  int rotatedSize = line_bytes * abs (rotated->height);
-  rotated->data = (unsigned char *) malloc (rotatedSize);
-  
-  rotated->line = (unsigned char **)                    
-    malloc (rotated->height * sizeof (unsigned char *));
-  rotated->line[0] = rotated->data;                       
-  for (y = 1; y < rotated->height; y++)  
-    rotated->line[y] = rotated->line[y - 1] + line_bytes;
-   
-
-  unsigned char *ip, *rp;
-  int x, ry;
-
-  int rot_offset = 0;
-  
-  for (y = 0; y < image->height; y++ ) {
-    ip = image->line[y];
-    ry = rotated->height - 1;
-    for (x = 0; x < image->width; x++) {
-      rp = rotated->line[ry--] + rot_offset;
-      *rp = *ip++;
-    } // For each pixel in the source line
-    rot_offset ++;
-  } // For each line in the source image
+  return orient_into (image, LLIMG_ORIENT_CCW, rotated);
+}
 
-  // Copy the color table
-  memcpy (rotated->color, image->color, 256 * sizeof(struct bgr_color));
+/////////////////////////////////////////////////////////////////////////////
+//
+// Turning by any angle
+//
+// A turn by a is three shears (Paeth): rows slid across by -tan(a/2)
+// times their distance from the center, columns slid down by sin(a)
+// times theirs, then rows across again.  A shear moves whole rows, so
+// each row is either copied to the nearest pixel (fast) or blended
+// with itself one pixel over by the fraction of the slide (smooth,
+// 16 pixels at a time with SSE2).  The column shear is a row shear of
+// the transpose.  Whole quarter turns are taken out first, exactly, so
+// no shear is of more than 45 degrees.
+
+#define ANGLE_PI 3.14159265358979323846
+
+// The orientation for so many quarter turns clockwise
+static const int angle_quarter[4] = {
+  LLIMG_ORIENT_NORMAL, LLIMG_ORIENT_CW, LLIMG_ORIENT_180, LLIMG_ORIENT_CCW
+};
 
+/////////////////////////////////////////////////////////////////////////////
+//
+// A new w by h image, or NULL
 
-  return (0);
+static LLIMG *
+angle_alloc (int w, int h, int bits_per_pixel)
+{
+  LLIMG *llimg;
+
+  llimg = llimg_create_base ();
+  if (!llimg)
+    return NULL;
+  llimg->bits_per_pixel = bits_per_pixel;
+  llimg->width = w;
+  llimg->height = h;
+  llimg->dib_height = -h;
+  if (llimg_alloc_data (llimg)) {
+    llimg_release_llimg (llimg);
+    return NULL;
+  }
+  return llimg;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// op[i] = (ip[i] * (256 - f) + ip[i - 3] * f + 128) >> 8 for n bytes:
+// each BGR pixel blended with the one before it
+
+static void
+blend_row (unsigned char *op, const unsigned char *ip, int n, int f)
+{
+  int i = 0;
+
+#ifdef LLIMG_SSE2
+  if (llimg_cpu () & LLIMG_CPU_SSE2) {
+    __m128i zero = _mm_setzero_si128 ();
+    __m128i fa = _mm_set1_epi16 ((short) (256 - f));
+    __m128i fb = _mm_set1_epi16 ((short) f);
+    __m128i half = _mm_set1_epi16 (128);
+    __m128i a, b, lo, hi;
+    for (; i + 16 <= n; i += 16) {
+      a = _mm_loadu_si128 ((const __m128i *) (ip + i));
+      b = _mm_loadu_si128 ((const __m128i *) (ip + i - 3));
+      lo = _mm_add_epi16 (_mm_mullo_epi16 (_mm_unpacklo_epi8 (a, zero), fa),
+                          _mm_mullo_epi16 (_mm_unpacklo_epi8 (b, zero), fb));
+      hi = _mm_add_epi16 (_mm_mullo_epi16 (_mm_unpackhi_epi8 (a, zero), fa),
+                          _mm_mullo_epi16 (_mm_unpackhi_epi8 (b, zero), fb));
+      lo = _mm_srli_epi16 (_mm_add_epi16 (lo, half), 8);
+      hi = _mm_srli_epi16 (_mm_add_epi16 (hi, half), 8);
+      _mm_storeu_si128 ((__m128i *) (op + i), _mm_packus_epi16 (lo, hi));
+    }
+  }
+#endif
+  for (; i < n; i++)
+    op[i] = (unsigned char) ((ip[i] * (256 - f) + ip[i - 3] * f + 128) >> 8);
 }
 
+/////////////////////////////////////////////////////////////////////////////
+//
+// Slides a row of n BGR pixels s pixels across into a row of m, with bg
+// where it doesn't reach
+
+static void
+shear_row (const unsigned char *ip, int n, unsigned char *op, int m,
+           double s, int smooth, const unsigned char *bg)
+{
+  int x, x0, x1, i, f, c;
+  const unsigned char *a, *b;
+
+  for (x = 0; x < m; x++) {
+    op[3 * x] = bg[0];
+    op[3 * x + 1] = bg[1];
+    op[3 * x + 2] = bg[2];
+  }
+  if (n <= 0)
+    return;
+
+  if (!smooth) {
+    i = (int) floor (s + 0.5);
+    x0 = i < 0 ? 0 : i;
+    x1 = i + n < m ? i + n : m;
+    if (x1 > x0)
+      memcpy (op + 3 * x0, ip + 3 * (x0 - i), 3 * (x1 - x0));
+    return;
+  }
+
+  // Output x is source x - i blended with source x - i - 1 by f/256
+  i = (int) floor (s);
+  f = (int) ((s - i) * 256 + 0.5);
+  if (f == 256) {
+    i++;
+    f = 0;
+  }
+  x0 = i + 1 < 0 ? 0 : i + 1;
+  x1 = i + n < m ? i + n : m;
+  if (x1 > x0)
+    blend_row (op + 3 * x0, ip + 3 * (x0 - i), 3 * (x1 - x0), f);
+
+  // The two ends blend into bg
+  for (x = i; x <= i + n; x += n) {
+    if (x < 0 || x >= m)
+      continue;
+    a = x - i < n ? ip + 3 * (x - i) : bg;
+    b = x - i > 0 ? ip + 3 * (x - i - 1) : bg;
+    for (c = 0; c < 3; c++)
+      op[3 * x + c] = (unsigned char) ((a[c] * (256 - f) + b[c] * f + 128) >> 8);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// A new out_w by out_h 24 bit image of rows y0 on of image, each slid
+// across by slope times its distance from image's middle row, plus
+// offset.  An 8 bit image is looked up in its color table on the way.
+
+static LLIMG *
+shear_rows (LLIMG *image, double slope, double offset, int out_w, int out_h,
+            int y0, int smooth, const unsigned char *bg)
+{
+  LLIMG *sheared;
+  unsigned char *bgr, *ip, *bp;
+  double mid = (image->height - 1) / 2.0;
+  int x, y, sy;
+
+  sheared = angle_alloc (out_w, out_h, 24);
+  if (!sheared)
+    return NULL;
+  bgr = NULL;
+  if (image->bits_per_pixel == 8) {
+    bgr = (unsigned char *) llimg_pool_get (3 * image->width);
+    if (!bgr) {
+      llimg_release_llimg (sheared);
+      return NULL;
+    }
+  }
+
+  for (y = 0; y < out_h; y++) {
+    sy = y + y0;
+    if (sy < 0 || sy >= image->height) {
+      shear_row (NULL, 0, sheared->line[y], out_w, 0, 0, bg);
+      continue;
+    }
+    ip = image->line[sy];
+    if (bgr) {
+      bp = bgr;
+      for (x = 0; x < image->width; x++) {
+        *bp++ = image->color[*ip].blue;
+        *bp++ = image->color[*ip].green;
+        *bp++ = image->color[*ip].red;
+        ip++;
+      }
+      ip = bgr;
+    }
+    shear_row (ip, image->width, sheared->line[y], out_w,
+               slope * (sy - mid) + offset, smooth, bg);
+  }
+
+  llimg_pool_put (bgr);
+  return sheared;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Marks with 1 the pixels of a w by h mask that fall inside an sw by sh
+// image turned by a (radians, within 45 degrees) about its center, and
+// the rest 0, as WRegion::createMask would.
+
+static LLIMG *
+angle_footprint (int w, int h, int sw, int sh, double a)
+{
+  LLIMG *mask;
+  unsigned char *mp;
+  double c = cos (a), s = sin (a), cx = (w - 1) / 2.0, cy = (h - 1) / 2.0;
+  double yr, lo, hi, l2, h2, t;
+  int y, x0, x1;
+
+  mask = angle_alloc (w, h, 8);
+  if (!mask)
+    return NULL;
+  mask->color[0].blue = mask->color[0].green = mask->color[0].red = 255;
+
+  // Turned back, a pixel (xr, yr) from the center is at
+  // (c xr + s yr, -s xr + c yr) in the image; c is never under .7
+  for (y = 0; y < h; y++) {
+    mp = mask->line[y];
+    memset (mp, 0, w);
+    yr = y - cy;
+    lo = (-sw / 2.0 - s * yr) / c;
+    hi = (sw / 2.0 - s * yr) / c;
+    if (s > 1e-9 || s < -1e-9) {
+      l2 = (c * yr - sh / 2.0) / s;
+      h2 = (c * yr + sh / 2.0) / s;
+      if (l2 > h2) {
+        t = l2;
+        l2 = h2;
+        h2 = t;
+      }
+      if (l2 > lo)
+        lo = l2;
+      if (h2 < hi)
+        hi = h2;
+    }
+    else if (fabs (c * yr) > sh / 2.0)
+      continue;
+    x0 = (int) ceil (lo + cx);
+    x1 = (int) floor (hi + cx);
+    if (x0 < 0)
+      x0 = 0;
+    if (x1 > w - 1)
+      x1 = w - 1;
+    if (x1 >= x0)
+      memset (mp + x0, 1, x1 - x0 + 1);
+  }
+  return mask;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Returns image turned by degrees clockwise about its center, as a new
+// 24 bit image sized to the turned bounds, with bg around it; or NULL.
+// Unless smooth each shear is to the nearest pixel, for following the
+// mouse.  If footprint isn't NULL it gets a new 8 bit mask of
+// where the image fell, 1 in it and 0 around it, for WRegion::useMask.
+
+LLIMG *
+llimg_rotate_angle (LLIMG *image, double degrees, int smooth,
+                    struct bgr_color bg, LLIMG **footprint)
+{
+  LLIMG *turned, *pass1, *pass2, *rotated;
+  unsigned char bgb[3];
+  double a, alpha, beta, ac, as;
+  int q, w, h, w1, h2, bw, bh;
+
+  if (footprint)
+    *footprint = NULL;
+  if (!image || (image->bits_per_pixel != 8 && image->bits_per_pixel != 24))
+    return NULL;
+  bgb[0] = bg.blue;
+  bgb[1] = bg.green;
+  bgb[2] = bg.red;
+
+  // Quarter turns exactly, leaving a within 45 degrees
+  q = (int) floor (degrees / 90 + 0.5);
+  a = (degrees - 90.0 * q) * ANGLE_PI / 180;
+  q = ((q % 4) + 4) % 4;
+  turned = image;
+  if (q) {
+    turned = llimg_orient (image, angle_quarter[q]);
+    if (!turned)
+      return NULL;
+  }
+  w = turned->width;
+  h = turned->height;
+
+  if (fabs (a) < 1e-9) {
+    rotated = shear_rows (turned, 0, 0, w, h, 0, 0, bgb);
+    if (rotated && footprint)
+      *footprint = angle_footprint (w, h, w, h, 0);
+  }
+  else {
+    alpha = -tan (a / 2);
+    beta = sin (a);
+    ac = fabs (cos (a));
+    as = fabs (beta);
+
+    // Each shear is centered in room for the slide and one pixel more
+    // for the blend; the last is cut to the turned bounds, keeping the
+    // crop of rows whole
+    w1 = w + (int) ceil (fabs (alpha) * (h - 1)) + 1;
+    h2 = h + (int) ceil (as * (w1 - 1)) + 1;
+    bw = (int) ceil (w * ac + h * as - 1e-6);
+    bh = (int) ceil (w * as + h * ac - 1e-6);
+    bh += (h2 - bh) & 1;
+
+    rotated = NULL;
+    pass1 = shear_rows (turned, alpha, (w1 - w) / 2.0, w1, h, 0, smooth, bgb);
+    pass2 = pass1 ? llimg_orient (pass1, LLIMG_ORIENT_TRANSPOSE) : NULL;
+    llimg_release_llimg (pass1);
+    if (pass2) {
+      pass1 = shear_rows (pass2, beta, (h2 - h) / 2.0, h2, w1, 0,
+                          smooth, bgb);
+      llimg_release_llimg (pass2);
+      pass2 = pass1 ? llimg_orient (pass1, LLIMG_ORIENT_TRANSPOSE) : NULL;
+      llimg_release_llimg (pass1);
+    }
+    if (pass2) {
+      rotated = shear_rows (pass2, alpha, (bw - w1) / 2.0, bw, bh,
+                            (h2 - bh) / 2, smooth, bgb);
+      llimg_release_llimg (pass2);
+    }
+    if (rotated && footprint)
+      *footprint = angle_footprint (bw, bh, w, h, a);
+  }
+
+  if (turned != image)
+    llimg_release_llimg (turned);
+  return rotated;
+}
@@ -0,0 +1,182 @@
+/*******************************************************************************
+ * Copyright 2002, 2003, 2004, 2005, 2006, 2012 Kent Stork
+ *
+ * share.cpp is part of Osiva.
+ *
+ * Osiva is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Osiva is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Osiva.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// File: share.cpp
+//
+// Images that show the same pixels.  The first share or view of an image
+// moves its data into an LLBUF, which counts the images on it, and
+// llimg_release_llimg frees the pixels with the last of them.  Each
+// image keeps its own header and line array, so turning or resizing one
+// leaves the others be; only the pixels are common, and whoever writes
+// to pixels that may be shared calls llimg_own first.
+//
+// Images are shared on the window thread only, so the count is plain.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ll_image.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// A new header on h rows of image from y, each x pixels in and w wide
+
+static LLIMG *
+share_rows (LLIMG *image, int x, int y, int w, int h)
+{
+  struct LLBUF *buf;
+  LLIMG *share;
+  int i, skip;
+
+  if (!image || !image->data || !image->line)
+    return NULL;
+  if (!image->buf) {
+    buf = (struct LLBUF *) malloc (sizeof (struct LLBUF));
+    if (!buf)
+      return NULL;
+    buf->refs = 1;
+    buf->data = image->data;
+    image->buf = buf;
+  }
+
+  share = (LLIMG *) malloc (sizeof (LLIMG));
+  if (!share)
+    return NULL;
+  *share = *image;
+  share->line = (unsigned char **) malloc (h * sizeof (unsigned char *));
+  if (!share->line) {
+    free (share);
+    return NULL;
+  }
+  skip = x * (image->bits_per_pixel / 8);
+  for (i = 0; i < h; i++)
+    share->line[i] = image->line[y + i] + skip;
+  share->data = share->line[0];
+  share->buf->refs++;
+  return share;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Another image on the same pixels, in place of a copy
+
+LLIMG *
+llimg_share (LLIMG *image)
+{
+  if (!image)
+    return NULL;
+  return share_rows (image, 0, 0, image->width, image->height);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// A crop that points into image rather than copying it.  Its rows keep
+// image's stride, so unless it is as wide as image it isn't a DIB until
+// llimg_own packs it.  Clipped to image; NULL if nothing is left.
+
+LLIMG *
+llimg_view (LLIMG *image, int x, int y, int w, int h)
+{
+  LLIMG *view;
+
+  if (!image)
+    return NULL;
+  if (x < 0) {
+    w += x;
+    x = 0;
+  }
+  if (y < 0) {
+    h += y;
+    y = 0;
+  }
+  if (w > image->width - x)
+    w = image->width - x;
+  if (h > image->height - y)
+    h = image->height - y;
+  if (w <= 0 || h <= 0)
+    return NULL;
+  if (x && image->bits_per_pixel % 8)
+    return NULL;
+
+  view = share_rows (image, x, y, w, h);
+  if (!view)
+    return NULL;
+  view->width = w;
+  view->height = h;
+  view->dib_height = image->dib_height < 0 ? -h : h;
+  if (w != image->width || h != image->height) {
+    view->full_width = 0;
+    view->full_height = 0;
+  }
+  return view;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Whether the rows lie one after the other at DIB stride, as SetDIBits
+// and the like take them
+
+int
+llimg_flat (LLIMG *image)
+{
+  if (image->height < 2)
+    return 1;
+  return image->line[1] - image->line[0]
+    == llimg_stride (image->width, image->bits_per_pixel);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Copy on write: gives image pixels of its own, packed flat, copying
+// them only if another image is on them or they aren't flat.  0 or -1,
+// with image as it was.
+
+int
+llimg_own (LLIMG *image)
+{
+  LLIMG owned;
+  long bytes;
+  int y;
+
+  if (!image->buf)
+    return 0;
+  if (image->buf->refs == 1 && image->data == image->buf->data
+      && llimg_flat (image)) {
+    free (image->buf);
+    image->buf = NULL;
+    return 0;
+  }
+
+  owned = *image;
+  if (llimg_alloc_data (&owned))
+    return -1;
+  bytes = (image->width * image->bits_per_pixel + 7) / 8;
+  for (y = 0; y < image->height; y++)
+    memcpy (owned.line[y], image->line[y], bytes);
+  free (image->line);
+  llimg_free_data (image);
+  image->buf = NULL;
+  image->data = owned.data;
+  image->line = owned.line;
+  return 0;
+}
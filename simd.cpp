@@ -0,0 +1,149 @@
+/*******************************************************************************
+ * Copyright 2002, 2003, 2004, 2005, 2006, 2012 Kent Stork
+ *
+ * simd.cpp is part of Osiva.
+ *
+ * Osiva is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Osiva is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Osiva.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// File: simd.cpp
+//
+// Which of the vector sets in ll_simd.h the processor has, from CPUID.
+// AVX2 also needs the OS to save the YMM registers, which XGETBV tells.
+// Asked once; any thread may ask, and they all get the same answer.
+
+#include <stdlib.h>
+
+#if defined(_MSC_VER) && _MSC_VER >= 1600
+#include <intrin.h>
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <cpuid.h>
+#endif
+
+#include "ll_simd.h"
+
+static int cpu_sets = -1;
+static int cpu_limit = ~0;
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// CPUID leaf (subleaf 0) into r: eax, ebx, ecx, edx; 0 or -1
+
+static int
+cpu_id (unsigned int leaf, unsigned int r[4])
+{
+#if defined(_MSC_VER) && _MSC_VER >= 1600
+  int v[4];
+  __cpuidex (v, (int) leaf, 0);
+  r[0] = v[0];
+  r[1] = v[1];
+  r[2] = v[2];
+  r[3] = v[3];
+  return 0;
+#elif defined(_MSC_VER) && defined(_M_IX86)
+  unsigned int a, b, c, d;
+  __asm {
+    mov eax, leaf
+    xor ecx, ecx
+    _emit 0x0F      // cpuid
+    _emit 0xA2
+    mov a, eax
+    mov b, ebx
+    mov c, ecx
+    mov d, edx
+  }
+  r[0] = a;
+  r[1] = b;
+  r[2] = c;
+  r[3] = d;
+  return 0;
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+  if (leaf > __get_cpuid_max (0, NULL))
+    return -1;
+  __cpuid_count (leaf, 0, r[0], r[1], r[2], r[3]);
+  return 0;
+#else
+  (void) leaf;
+  r[0] = r[1] = r[2] = r[3] = 0;
+  return -1;
+#endif
+}
+
+// The low word of XCR0, the register state the OS saves
+
+static unsigned int
+cpu_xcr0 ()
+{
+#if defined(_MSC_FULL_VER) && _MSC_FULL_VER >= 160040219
+  return (unsigned int) _xgetbv (0);
+#elif defined(_MSC_VER) && defined(_M_IX86)
+  unsigned int a;
+  __asm {
+    xor ecx, ecx
+    _emit 0x0F      // xgetbv
+    _emit 0x01
+    _emit 0xD0
+    mov a, eax
+  }
+  return a;
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+  unsigned int a, d;
+  __asm__ (".byte 0x0f, 0x01, 0xd0" : "=a" (a), "=d" (d) : "c" (0));
+  return a;
+#else
+  return 0;
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// LLIMG_CPU_ flags for the sets this processor runs, within the limit
+
+extern "C" int
+llimg_cpu (void)
+{
+  unsigned int r[4];
+  int sets;
+
+  if (cpu_sets < 0) {
+    sets = 0;
+    if (cpu_id (0, r) == 0 && r[0] >= 1 && cpu_id (1, r) == 0) {
+      if (r[3] & (1 << 26))
+        sets |= LLIMG_CPU_SSE2;
+      if ((sets & LLIMG_CPU_SSE2) && (r[2] & (1 << 9)))
+        sets |= LLIMG_CPU_SSSE3;
+      // AVX2 wants OSXSAVE and AVX, the OS saving XMM and YMM, and the
+      // AVX2 bit of leaf 7
+      if ((sets & LLIMG_CPU_SSSE3) && (r[2] & (1 << 27))
+          && (r[2] & (1 << 28)) && (cpu_xcr0 () & 6) == 6
+          && cpu_id (0, r) == 0 && r[0] >= 7 && cpu_id (7, r) == 0
+          && (r[1] & (1 << 5)))
+        sets |= LLIMG_CPU_AVX2;
+    }
+    cpu_sets = sets;
+  }
+  return cpu_sets & cpu_limit;
+}
+
+// Keeps what llimg_cpu answers to sets, so the tests can time and
+// check each kernel on one processor; ~0 lifts the limit
+
+extern "C" void
+llimg_cpu_limit (int sets)
+{
+  cpu_limit = sets;
+}
@@ -51,17 +51,23 @@ using namespace std;
 
 #include "hotspot.h"
 #include "dialogs.h"
+#include "probe.h"
+#include "mapfile.h"
 
 #define GET_X_LPARAM(lp)   ((int)(short)LOWORD(lp))
 #define GET_Y_LPARAM(lp)   ((int)(short)HIWORD(lp))
 
 // Decoders
 extern "C" {
-LLIMG * read_jpeg_file ( char * filename );
+LLIMG * read_jpeg_file_scaled ( char * filename, int max_w, int max_h );
+LLIMG * read_jpeg_file_progressive ( char * filename, int max_w, int max_h,
+                                     void (*shown) (LLIMG *llimg,
+                                                    void *client),
+                                     void *client );
+LLIMG * read_jpeg_thumbnail ( char * filename, long offset, long length,
+                              long full_w, long full_h );
 }
 extern LLIMG *
-read_gif_file ( char * filename );
-extern LLIMG *
 expandGif (unsigned char *idata, int filebytes);
 
 // Zooming
@@ -75,21 +81,26 @@ extern void
 llimg_lock_aspect (LLIMG *image, int &width, int &height);
 
 //Rotation
-extern int 
-llimg_rotate24bitR (LLIMG *image, LLIMG *rotated);
-extern int 
-llimg_rotate8bitR (LLIMG *image, LLIMG *rotated);
-extern int 
-llimg_rotate24bitL (LLIMG *image, LLIMG *rotated);
-extern int 
-llimg_rotate8bitL (LLIMG *image, LLIMG *rotated);
+extern LLIMG *
+llimg_orient (LLIMG *image, int transform);
+extern int
+llimg_orient_compose (int first, int then);
+extern LLIMG *
+llimg_rotate_angle (LLIMG *image, double degrees, int smooth,
+                    struct bgr_color bg, LLIMG **footprint);
 
 // Dissolve effect
 extern LLIMG *
-llimg_dub (LLIMG *img);
-extern LLIMG *
 llimg_cpscreen (const RECT *source);
 
+// Shared pixels
+extern LLIMG *
+llimg_share (LLIMG *image);
+extern int
+llimg_flat (LLIMG *image);
+extern int
+llimg_own (LLIMG *image);
+
 // Shell integration
 extern int
 drag_file_out (const char *filename);
@@ -108,9 +119,21 @@ static int logo_image_sz = 0;
 static unsigned char *error_image = NULL;
 static int error_image_sz = 0;
 
+// Each is expanded once, and every window showing it shares the pixels
+static LLIMG *logo_llimg = NULL;
+static LLIMG *error_llimg = NULL;
+
 static void
 showLastSysError( char * mess );
 
+// The orientation for so many quarter turns clockwise
+static const int quarter_orient[4] = {
+  LLIMG_ORIENT_NORMAL, LLIMG_ORIENT_CW, LLIMG_ORIENT_180, LLIMG_ORIENT_CCW
+};
+
+#define SPIN_SNAP 3.0   // Degrees from a quarter turn that snap to it
+#define SPIN_PI   3.14159265358979323846
+
 ///////////////////////////////////////////////////////////////////////////////
 // GLOBAL SCOPE
 
@@ -204,11 +227,18 @@ paintImage (HWND hwnd, HDC hdc, LLIMG * img,
 
   if (img == NULL)
     return;
+  // A view into a wider image is packed before it will do as a DIB
+  if (!llimg_flat (img) && llimg_own (img))
+    return;
 
   int yScrollPix = yCurrentScroll;
   int xScrollPix = xCurrentScroll;
 
-  if (img->bits_per_pixel < 16)
+  // The DIB's own color table does on a true color screen; only a
+  // palette screen needs one made and realized (and a reduced 8 bit
+  // image is made every resize step)
+  if (img->bits_per_pixel < 16
+      && (GetDeviceCaps (hdc, RASTERCAPS) & RC_PALETTE))
     {
       if (!(img->hpalette))
         {
@@ -274,6 +304,10 @@ SnapShotW::SnapShotW () {
   erosions = 0;
   mask_depth = 0;
   rotation = 0;
+  g_angled = NULL;
+  angle_src = NULL;
+  angle = 0;
+  angle_base = 0;
 
   wndmgr = NULL;
 
@@ -290,6 +324,15 @@ SnapShotW::SnapShotW () {
   shift_key = 0;
   curr_file = NULL;
   paint_stretch = 0;
+  scan_file = NULL;
+  scan_x = 0;
+  scan_y = 0;
+  placeholder = 0;
+  file_orient = LLIMG_ORIENT_NORMAL;
+  viewed = 0;
+  dropped = 0;
+  source = NULL;
+  source_codec = NULL;
 };
 
 
@@ -297,7 +340,9 @@ SnapShotW::~SnapShotW () {
 
   llimg_release_llimg (g_llimg);
   llimg_release_llimg (g_llimg_x8);
+  llimg_release_llimg (g_angled);
   delete [] curr_file;
+  llimg_unkeep_file (source);
 
 };
 
@@ -379,9 +424,10 @@ void SnapShotW::apply_trans (int x, int y) {
 //
 ///////////////////////////////////////////////////////////////////////////////
 
+// The image shares g_image's pixels, which are not to be written
+
 LLIMG *SnapShotW::dub_image () {
-  LLIMG *dubimg = llimg_dub (g_image);
-  return dubimg;
+  return llimg_share (g_image);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -447,7 +493,7 @@ int SnapShotW::handle_click (int x, int y, int keymod) {
   unsigned long area_ratio;
   if (!g_x8_up){
     if (g_llimg_x8) {
-      native_area = g_llimg->width * g_llimg->height;
+      native_area = full_w () * full_h ();
       custom_area = g_llimg_x8->width * g_llimg_x8->height;
       area_ratio = (100 * custom_area) / native_area;
       if (area_ratio < 45) {
@@ -470,8 +516,8 @@ int SnapShotW::handle_click (int x, int y, int keymod) {
   // If the zoomed image is showing at a custom scale and is n%
   // or less of the image area, use the native image
 
-  native_area = g_llimg->width * g_llimg->height;
-  custom_area = g_llimg_x8->width * g_llimg_x8->height;
+  native_area = full_w () * full_h ();
+  custom_area = g_image->width * g_image->height;
   area_ratio = (100 * custom_area) / native_area;
   if (area_ratio < 45) {
     show_centered_img (x, y);
@@ -483,7 +529,7 @@ int SnapShotW::handle_click (int x, int y, int keymod) {
 
   int reduce = wndmgr->reduction;
   unsigned long reduced_area = 
-    (g_llimg->width/reduce) * (g_llimg->height/reduce);
+    (full_w ()/reduce) * (full_h ()/reduce);
 
   unsigned long reduced_ratio;
   if (custom_area > reduced_area)
@@ -546,6 +592,14 @@ handle_left_down (HWND hwnd, UINT uint, WPARAM wparam, LPARAM lparam)
       SetWindowRgn (hwnd, NULL, TRUE);
       transparent = 0;
     }
+    // The turn goes on from any angle already showing
+    RECT rwnd;
+    GetWindowRect (hwnd, &rwnd);
+    spin_center.x = (rwnd.left + rwnd.right)/2;
+    spin_center.y = (rwnd.top + rwnd.bottom)/2;
+    if (!g_angled && !placeholder)
+      angle_src = g_image;
+    angle_base = angle;
   }
 
 
@@ -597,23 +651,24 @@ handle_mouse_move (HWND hwnd, UINT uint, WPARAM wparam, LPARAM lparam)
     return 0;
   }
 
+  // The image turns as the line from its center to the mouse does
   if (in_rotate)
   {
-    if (has_rotated)
-      return 0;
     ClientToScreen (hwnd, &pt);
     if (pt.x == base_pt.x && pt.y == base_pt.y)
       return 0;
-    GetWindowRect (hwnd, &rect);
     base_pt = pt;
-    int dx = pt.x - click_pt.x;
-    if (abs(dx) > 16) {
-      if (dx > 0)
-        rotate (1);
-      else
-        rotate (0);
+    if (!has_rotated) {
+      if (abs(pt.x - click_pt.x) <= 4 && abs(pt.y - click_pt.y) <= 4)
+        return 0;
       has_rotated = 1;
     }
+    double swing = 
+      atan2 ((double) (pt.y - spin_center.y), 
+             (double) (pt.x - spin_center.x)) -
+      atan2 ((double) (click_pt.y - spin_center.y),
+             (double) (click_pt.x - spin_center.x));
+    spin (angle_base + swing * 180 / SPIN_PI, 0);
     return 0;
   }
   
@@ -715,8 +770,10 @@ handle_left_up (HWND hwnd, UINT uint, WPARAM wparam, LPARAM lparam)
   if (in_resize)
   {
     in_resize = 0;
+    straighten ();
     GetClientRect (hwnd, &clnt);
     SetCursor (LoadCursor (NULL, IDC_WAIT));
+    cover_image (clnt.right+1, clnt.bottom+1);
     llimg_release_llimg (g_llimg_x8);
     g_llimg_x8 = 
       llimg_resize (g_llimg, clnt.right+1, clnt.bottom+1);
@@ -728,8 +785,20 @@ handle_left_up (HWND hwnd, UINT uint, WPARAM wparam, LPARAM lparam)
     UpdateWindow (hwnd);
     g_x8_up = 1;
     reduction = 0;
+    shown_small ();
   } 
 
+  // A turn let go at a quarter is made exactly, else drawn smoothly
+  if (in_rotate && has_rotated && g_angled) {
+    int quarters = (int) floor (angle / 90 + 0.5);
+    if (angle == 90.0 * quarters) {
+      straighten ();
+      turn (quarters);
+    }
+    else
+      spin (angle, 1);
+  }
+
   act_state = 0;
   has_moved = 0;
   in_rotate = 0;
@@ -922,7 +991,12 @@ handle_command (HWND hwnd, UINT uint, WPARAM wparam, LPARAM lparam)
 ///////////////////////////////////////////////////////////////////////////////
 
 void SnapShotW::show_img_fix_corner (int x, int y) {
+  straighten ();
   // Expand the corner that the drop is in
+  if (g_llimg) {
+    cover_image (full_w (), full_h ());
+    orient_full ();
+  }
   g_image = g_llimg;
   if (g_image) {
     int w = max( 16, g_image->width );
@@ -1004,10 +1078,7 @@ int SnapShotW::handle_drop (HDROP hdrop){
   else {
     for (f = 0; f < files; f++) {
       DragQueryFile (hdrop, f, filename, 512);
-      if (wndmgr->is_layout_file (filename))
-        wndmgr->load_layout_file (filename);
-      else
-        wndmgr->new_window(hInst, filename, SW_SHOW);
+      wndmgr->open_file (filename, SW_SHOW, 1);
     }
   }
   DragFinish (hdrop);
@@ -1021,59 +1092,140 @@ int SnapShotW::handle_drop (HDROP hdrop){
 //
 ///////////////////////////////////////////////////////////////////////////////
 
-void SnapShotW::load_image ( char *filename, int x, int y ) {
+// A max_w by max_h size asks for only that much of the image: a JPEG is
+// then read scaled down, and shown at the size it comes in, for the
+// caller to move_img into place.
+//
+// A progressive JPEG goes up with its first scan, and is repainted as
+// the later scans refine it (see show_scan).
+//
+// A preview puts up a JPEG's Exif thumbnail, stretched over the window,
+// and leaves the decode for the window manager to ask finish_load for.
+//
+// A JPEG is put upright as its Exif orientation says, once it shows
+// (see orient_full).  max_w by max_h is the upright size.
+//
+// probed is what llimg_probe said of the file, when the caller has
+// asked already.
+
+void SnapShotW::load_image ( char *filename, int x, int y,
+                             int max_w, int max_h, int preview,
+                             const LLPROBE *probed ) {
   int _in_error = 0;
   int _in_logo = 0;
+  int read_w, read_h;
   SetForegroundWindow (hw_main);
   SetCursor (LoadCursor (NULL, IDC_WAIT));    
   LLIMG *llimg = NULL;
   // Use the logo image if no filename was specified
   if ( strlen(filename) == 0 ) {
     _in_logo = 1;
-    llimg = expandGif (logo_image, logo_image_sz);
+    if (!logo_llimg)
+      logo_llimg = expandGif (logo_image, logo_image_sz);
+    llimg = llimg_share (logo_llimg);
     //WRegion wregion;
     //wregion.createMask (llimg);
     //wregion.extractRegion ();
     //wregion.applyRegion (hw_main);
     //transparent = 1;
   }
-  // Otherwise try the decompressors until one works
+  // Otherwise use the decoder for what the file's leading bytes say it is
   else {
     SetWindowRgn (hw_main, NULL, FALSE);
     transparent = 0;
-    llimg = read_jpeg_file (filename);
-    if ( !llimg )
-      llimg = read_gif_file (filename);
-  }
-  // Maybe it is a layout file?
-  if (!llimg) {
-    if (wndmgr->is_layout_file (filename)){
+    LLPROBE probe;
+    if (probed)
+      probe = *probed;
+    else
+      llimg_probe (filename, &probe);
+    // Maybe it is a layout file?
+    if (probe.format == LLIMG_FMT_LAYOUT) {
       wndmgr->load_layout_file (filename);
       SetCursor (g_hand_cursor);    
       return;
     }
+    file_orient = probe.orientation;
+    take_source (filename, probe.codec);
+    if (preview && probe.thumb_length && wndmgr) {
+      llimg = read_jpeg_thumbnail (filename, probe.thumb_offset,
+                                   probe.thumb_length,
+                                   probe.width, probe.height);
+      if (llimg) {
+        llimg->rotation = file_orient;
+        show_placeholder (llimg, filename, x, y, max_w, max_h);
+        wndmgr->defer_load ();
+        SetCursor (g_hand_cursor);    
+        return;
+      }
+    }
+    // The file is read as it is stored
+    read_w = max_w;
+    read_h = max_h;
+    if (file_orient >= LLIMG_ORIENT_TRANSPOSE) {
+      read_w = max_h;
+      read_h = max_w;
+    }
+    // Scans go up as they come only if they come upright
+    if (probe.format == LLIMG_FMT_JPEG && probe.progressive
+        && file_orient == LLIMG_ORIENT_NORMAL) {
+      scan_file = filename;
+      scan_x = x;
+      scan_y = y;
+      llimg = read_jpeg_file_progressive (filename, read_w, read_h,
+                                          scan_proxy, this);
+    }
+    else if (probe.codec && probe.codec->read) {
+      if (source)
+        llimg = source_codec->read_data (source->data, source->size,
+                                         read_w, read_h);
+      else
+        llimg = probe.codec->read (filename, read_w, read_h);
+      if (llimg)
+        llimg->rotation = file_orient;
+    }
+  }
+  // A progressive JPEG is up already, and just needs its last scan shown
+  if (llimg && llimg == g_llimg) {
+    SetCursor (g_hand_cursor);    
+    InvalidateRect (hw_main, NULL, FALSE);
+    UpdateWindow (hw_main);
+    return;
   }
   // If there's still no image use the error image
   if (!llimg) {
     _in_error = 1;
-    llimg = expandGif (error_image, error_image_sz);
+    if (!error_llimg)
+      error_llimg = expandGif (error_image, error_image_sz);
+    llimg = llimg_share (error_llimg);
   }
+  show_loaded (llimg, filename, x, y, _in_error, _in_logo);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Puts up a newly read image in place of g_llimg
 
+void SnapShotW::show_loaded ( LLIMG *llimg, char *filename, int x, int y,
+                              int _in_error, int _in_logo ) {
+  straighten ();
+  placeholder = 0;
+  dropped = 0;
+  viewed = GetTickCount ();
+  if (_in_error || _in_logo)
+    drop_source ();
   llimg_release_llimg (g_llimg);
   g_llimg = llimg;
   llimg_release_llimg (g_llimg_x8);
   g_llimg_x8 = NULL;
-    in_error = _in_error;
+  in_error = _in_error;
   in_logo = _in_logo;
- 
-  SetCursor (g_hand_cursor);    
-  if (x < 0 || in_error)
-    show_centered_img (x, y);
-  else 
-    show_img_fix_corner (x, y);
+  rotation = 0;
 
-  if (in_logo || in_error)
-    toggle_trans ();
+  // The file name is needed to read any more of a scaled image
 
   delete [] curr_file;
   static char *resource_name = "Internal Resource";
@@ -1086,9 +1238,298 @@ void SnapShotW::load_image ( char *filename, int x, int y ) {
     curr_file = new char [strlen(resource_name) +1];
     strcpy (curr_file, resource_name);
   }
+ 
+  SetCursor (g_hand_cursor);    
+  if (g_llimg->full_width) {
+    RECT r;
+    GetWindowRect (hw_main, &r);
+    orient_full ();
+    g_image = g_llimg;
+    g_x8_up = 1;
+    reduction = 0;
+    MoveWindow (hw_main, r.left, r.top, 
+                max (16, g_image->width), max (16, g_image->height), TRUE);
+    InvalidateRect (hw_main, NULL, TRUE);
+  }
+  else if (x < 0 || in_error)
+    show_centered_img (x, y);
+  else 
+    show_img_fix_corner (x, y);
 
-  rotation = 0;
+  if (in_logo || in_error)
+    toggle_trans ();
+
+  // Room is made for it among the other windows' images
+  if (wndmgr)
+    wndmgr->keep_budget (this);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Called by the JPEG reader with each scan of a progressive JPEG that
+// load_image is reading.  The first one is put up like any new image;
+// the rest are refinements of that same LLIMG, and just need painting.
+
+void SnapShotW::show_scan (LLIMG *llimg) {
+  if (llimg != g_llimg)
+    show_loaded (llimg, scan_file, scan_x, scan_y, 0, 0);
+  else
+    InvalidateRect (hw_main, NULL, FALSE);
+  UpdateWindow (hw_main);
+  // Still reading
+  SetCursor (LoadCursor (NULL, IDC_APPSTARTING));    
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Puts up a thumbnail in place of the image, in a window the size the
+// image would come in.  It is painted stretched until finish_load.
+
+void SnapShotW::show_placeholder ( LLIMG *thumb, char *filename, int x, int y,
+                                   int max_w, int max_h ) {
+  RECT r, scrn;
+  int w, h;
+
+  show_loaded (thumb, filename, x, y, 0, 0);
+  placeholder = 1;
+  w = full_w ();
+  h = full_h ();
+
+  // A scaled read would be just big enough, keeping the aspect
+  if (max_w > 0 && max_h > 0 && (max_w < w || max_h < h)) {
+    if ((double) max_w * h >= (double) max_h * w) {
+      h = (int) (((double) h * max_w + w - 1) / w);
+      w = max_w;
+    }
+    else {
+      w = (int) (((double) w * max_h + h - 1) / h);
+      h = max_h;
+    }
+  }
+  w = max (16, w);
+  h = max (16, h);
+  GetWindowRect (hw_main, &r);
+  SystemParametersInfo (SPI_GETWORKAREA, 0, &scrn, 0);
+  if (x < 0)
+    r.left = (scrn.right - w)/2;
+  if (y < 0)
+    r.top = (scrn.bottom - h)/2;
+  MoveWindow (hw_main, r.left, r.top, w, h, TRUE);
+  InvalidateRect (hw_main, NULL, FALSE);
+}
 
+///////////////////////////////////////////////////////////////////////////////
+//
+// 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Replaces a placeholder with the image, read to cover the window as it
+// is now, since it may have been moved, sized or turned meanwhile.
+
+void SnapShotW::finish_load () {
+  RECT r;
+  int w, h;
+
+  if (!placeholder || g_saved)
+    return;
+  straighten ();
+  placeholder = 0;
+  GetWindowRect (hw_main, &r);
+  w = r.right - r.left;
+  h = r.bottom - r.top;
+  // If the read fails the thumbnail is sized to the window for good
+  read_cover (w, h);
+
+  g_image = g_llimg;
+  llimg_release_llimg (g_llimg_x8);
+  g_llimg_x8 = NULL;
+  g_x8_up = 0;
+  if (w != view_w () || h != view_h ()) {
+    g_llimg_x8 = llimg_resize (g_llimg, w, h);
+    if (g_llimg_x8) {
+      g_image = g_llimg_x8;
+      reduction = 0;
+      g_x8_up = 1;
+    }
+  }
+  if (g_image == g_llimg)
+    orient_full ();
+  if (transparent)
+    apply_trans ();
+  InvalidateRect (hw_main, NULL, FALSE);
+  UpdateWindow (hw_main);
+  shown_small ();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// g_llimg may be a scaled read of a JPEG, with only so many pixels, or
+// what showed of an image let go by drop_full.  If it is smaller than w
+// by h (in the rotated view) read the file again at a scale that covers
+// it, or in full.  Returns 0 if g_llimg covers it.
+// A placeholder is taken to cover anything, and is stretched, until
+// finish_load reads the image.
+
+int SnapShotW::cover_image (int w, int h) {
+  if (!g_llimg || !g_llimg->full_width || placeholder)
+    return 0;
+  if (w <= view_w () && h <= view_h ())
+    return 0;
+  return read_cover (w, h);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Reads the file again to cover w by h, in place of g_llimg; 0 or -1.
+// The new read waits on its turn, as g_llimg does, unless it shows.
+
+int SnapShotW::read_cover (int w, int h) {
+  LLIMG *llimg = NULL;
+  LLPROBE probe;
+  int orient, t;
+
+  if (!curr_file || in_logo || in_error)
+    return -1;
+
+  // The file is read as it is stored, to be put upright and turned
+  orient = llimg_orient_compose (file_orient, quarter_orient[rotation]);
+  if (orient >= LLIMG_ORIENT_TRANSPOSE) {
+    t = w;
+    w = h;
+    h = t;
+  }
+
+  HCURSOR currcur = GetCursor ();
+  SetCursor (LoadCursor (NULL, IDC_WAIT));    
+  if (source)
+    llimg = source_codec->read_data (source->data, source->size, w, h);
+  else if (llimg_probe (curr_file, &probe) == 0 && probe.codec->read)
+    llimg = probe.codec->read (curr_file, w, h);
+  SetCursor (currcur);    
+  if (!llimg)
+    return -1;
+  llimg->rotation = orient;
+  dropped = 0;
+
+  if (g_image == g_llimg)
+    g_image = llimg;
+  if (g_saved == g_llimg)
+    g_saved = llimg;
+  llimg_release_llimg (g_llimg);
+  g_llimg = llimg;
+  if (g_image == g_llimg || g_saved == g_llimg)
+    orient_full ();
+
+  if (wndmgr)
+    wndmgr->keep_budget (this);
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// With ooptions->keep_source, holds on to the bytes of the file being
+// loaded, for read_cover to decode from at whatever scale is wanted.
+// Files are typically a tenth the size of their pixels, so the full
+// size image can go as soon as it doesn't show (see shown_small).
+// Windows on the same file share its bytes.
+
+void SnapShotW::take_source (char *filename, const struct LLCODEC *codec) {
+  LLKEPT *kept = NULL;
+
+  // Kept before the old bytes go, in case they are this file's
+  if (ooptions->keep_source && codec && codec->read_data)
+    kept = llimg_keep_file (filename);
+  drop_source ();
+  source = kept;
+  if (source)
+    source_codec = codec;
+}
+
+void SnapShotW::drop_source () {
+  llimg_unkeep_file (source);
+  source = NULL;
+  source_codec = NULL;
+}
+
+// Called once g_llimg_x8 shows in place of g_llimg
+
+void SnapShotW::shown_small () {
+  if (source && g_image == g_llimg_x8)
+    drop_full ();
+}
+
+// Bytes of pixels img has
+
+static double image_bytes (const LLIMG *img) {
+  if (!img)
+    return 0;
+  return (double) llimg_stride (img->width, img->bits_per_pixel)
+    * abs (img->height);
+}
+
+// Bytes the window holds on to, each pixel buffer once.  Kept bytes
+// are split between the windows sharing them.
+
+double SnapShotW::held_bytes () {
+  double bytes = image_bytes (g_llimg);
+  if (source)
+    bytes += (double) source->size / source->refs;
+  if (g_llimg_x8 && (!g_llimg_x8->buf || !g_llimg
+                     || g_llimg_x8->buf != g_llimg->buf))
+    bytes += image_bytes (g_llimg_x8);
+  return bytes;
+}
+
+// Lets go of g_llimg while what shows is g_llimg_x8, keeping a share of
+// that in its place, as a scaled read of the image at the size it shows.
+// cover_image reads the file again once more than that is wanted.
+// Returns the bytes let go, 0 if there was nothing to let go or it is
+// in use.
+
+double SnapShotW::drop_full () {
+  LLIMG *llimg;
+  double bytes;
+
+  if (!g_llimg || !g_llimg_x8 || g_image != g_llimg_x8 || dropped)
+    return 0;
+  if (g_saved || g_angled || placeholder || in_logo || in_error
+      || !curr_file)
+    return 0;
+  bytes = image_bytes (g_llimg);
+  if (bytes <= image_bytes (g_llimg_x8))
+    return 0;
+  llimg = llimg_share (g_llimg_x8);
+  if (!llimg)
+    return 0;
+  // g_llimg_x8 is already turned
+  llimg->rotation = LLIMG_ORIENT_NORMAL;
+  llimg->full_width = full_w ();
+  llimg->full_height = full_h ();
+  llimg_release_llimg (g_llimg);
+  g_llimg = llimg;
+  dropped = 1;
+  return bytes;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -1098,6 +1539,26 @@ void SnapShotW::load_image ( char *filename, int x, int y ) {
 ///////////////////////////////////////////////////////////////////////////////
 
 void SnapShotW::rotate (int clockwise) {
+  turn (clockwise ? 1 : 3);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Turns the image so many quarters clockwise.  The turn is only noted
+// on g_llimg, for the reductions and resizes made from it to apply as
+// they go; what is turned now is just the image that shows.  A reduced
+// image turned is the same as one made turned, so that takes no more
+// than its own size of work, and g_llimg is turned only if it shows.
+
+void SnapShotW::turn (int quarters) {
+  quarters &= 3;
+  if (!quarters)
+    return;
+  straighten ();
   SetForegroundWindow (hw_main);
   HCURSOR currcur = GetCursor ();
   SetCursor (LoadCursor (NULL, IDC_WAIT));    
@@ -1107,94 +1568,169 @@ void SnapShotW::rotate (int clockwise) {
   // We want to rotate around the center, holding size constant
 
   // Remember the display size and position of the current image
+  // (a placeholder is stretched over the window)
 
-  int w_old = g_image->width;
-  int h_old = g_image->height;
   RECT rcurr;
   GetWindowRect (hw_main, &rcurr);
+  int w_old = g_image->width;
+  int h_old = g_image->height;
+  if (placeholder) {
+    w_old = rcurr.right - rcurr.left;
+    h_old = rcurr.bottom - rcurr.top;
+  }
+  int w_new = (quarters & 1) ? h_old : w_old;
+  int h_new = (quarters & 1) ? w_old : h_old;
   int cx = (rcurr.right + rcurr.left)/2;
   int cy = (rcurr.bottom + rcurr.top)/2;
 
-  // Roate the image in memory
+  // Remember the rotation for report generation. Rotation is clockwise increasing.
 
-  LLIMG *llimg = llimg_create_base ();
-  
-  int ret = 0;
+  g_llimg->rotation = 
+    llimg_orient_compose (g_llimg->rotation, quarter_orient[quarters]);
+  rotation = (rotation + quarters) % 4;
   
-  if (g_llimg->bits_per_pixel == 24)
-  {
-    if (clockwise) {
-      ret = llimg_rotate24bitR (g_llimg, llimg);
-    }
-    else {
-      ret = llimg_rotate24bitL (g_llimg, llimg);
+  // g_image is the one painted onto the display
+
+  LLIMG *llimg = NULL;
+  if (g_image == g_llimg_x8) {
+    llimg = llimg_orient (g_llimg_x8, quarter_orient[quarters]);
+    if (llimg) {
+      llimg->client1 = g_llimg_x8->client1;
+      g_image = llimg;
+      llimg_release_llimg (g_llimg_x8);
+      g_llimg_x8 = llimg;
     }
   }
-  else // bits_per_pixel = 8
-  {
-    if (clockwise) {
-      ret = llimg_rotate8bitR (g_llimg, llimg);
-    }
-    else {
-      ret = llimg_rotate8bitL (g_llimg, llimg);
-    }
+  else if (!orient_full ()) {
+    llimg = g_llimg;
+    g_image = g_llimg;
+    llimg_release_llimg (g_llimg_x8);
+    g_llimg_x8 = NULL;
   }
 
-
-  if (ret) {
-    llimg_release_llimg (llimg);
+  // Failing that, turn back (g_llimg may be a new read by now)
+  if (!llimg) {
+    g_llimg->rotation = 
+      llimg_orient_compose (g_llimg->rotation, quarter_orient[4 - quarters]);
+    rotation = (rotation + 4 - quarters) % 4;
     SetCursor (currcur);    
     return ;
   }
   
-  
-  // Show the new display geometry, but with a stretched image for feedback
-  // Since resizing might take a long time
+  int left = cx - (w_new/2);
+  int top = cy - (h_new/2);
+  MoveWindow (hw_main, left, top, w_new, h_new, TRUE);
+  InvalidateRect (hw_main, NULL, FALSE);
+  UpdateWindow (hw_main);
+  SetCursor (currcur);    
 
+}
 
-  SetWindowRgn (hw_main, NULL, FALSE);
-  transparent = 0;
+///////////////////////////////////////////////////////////////////////////////
+//
+// 
+//
+///////////////////////////////////////////////////////////////////////////////
 
+// Puts g_llimg through the turn it is waiting on, for when it shows at
+// its own size; 0, or -1 if that can't be done.
 
-  int left = cx - (h_old/2);
-  int top = cy - (w_old/2);
-  
-  g_image = llimg;
-  paint_stretch = 1;
-  MoveWindow (hw_main, left, top, h_old, w_old, TRUE); // w and h are rotated
-  InvalidateRect (hw_main, NULL, FALSE);
-  UpdateWindow (hw_main);
-  paint_stretch = 0;
-  
+int SnapShotW::orient_full () {
+  LLIMG *llimg;
+
+  if (!g_llimg || g_llimg->rotation <= LLIMG_ORIENT_NORMAL)
+    return 0;
+  llimg = llimg_orient (g_llimg, g_llimg->rotation);
+  if (!llimg)
+    return -1;
+  if (g_image == g_llimg)
+    g_image = llimg;
+  if (g_saved == g_llimg)
+    g_saved = llimg;
   llimg_release_llimg (g_llimg);
   g_llimg = llimg;
-  llimg_release_llimg (g_llimg_x8);
-  g_llimg_x8 = NULL;
-  g_image = g_llimg; 
-  
-  // Resize the already rotated image into the rotated window
-  // If the image isn't the nominal size
-  // g_image is the one painted onto the display
-  
-  if (g_x8_up) {
-    g_llimg_x8 = llimg_resize (g_llimg, h_old+1, w_old+1); // w and h are rotated
-    g_image = g_llimg_x8;
-  }
+  return 0;
+}
 
-  InvalidateRect (hw_main, NULL, FALSE);
-  UpdateWindow (hw_main);
-  SetCursor (currcur);    
+///////////////////////////////////////////////////////////////////////////////
+//
+// 
+//
+///////////////////////////////////////////////////////////////////////////////
 
-  // Remember the rotation for report generation. Rotation is clockwise increasing.
+// Shows what showed when the drag began (angle_src) turned by degrees
+// about spin_center, in a window sized to fit.  Within SPIN_SNAP of a
+// quarter turn it is that turn.  The smooth one is shaped to where the
+// image fell, as a transparent window.
+
+void SnapShotW::spin (double degrees, int smooth) {
+  LLIMG *llimg, *footprint = NULL;
+  struct bgr_color bg = {128, 128, 128, 0};   // The window's gray brush
+  int quarters, w, h;
+
+  if (!angle_src || placeholder || g_saved)
+    return;
+  degrees -= 360 * floor ((degrees + 180) / 360);
+  quarters = (int) floor (degrees / 90 + 0.5);
+  if (fabs (degrees - 90.0 * quarters) < SPIN_SNAP)
+    degrees = 90.0 * quarters;
 
-  if (clockwise) {
-    rotation = (rotation + 1) % 4;
+  if (degrees == 0) {
+    straighten ();
   }
   else {
-    rotation = (rotation - 1 + 4) % 4;
+    llimg = llimg_rotate_angle (angle_src, degrees, smooth, bg,
+                                smooth ? &footprint : NULL);
+    if (!llimg)
+      return;
+    g_image = llimg;
+    llimg_release_llimg (g_angled);
+    g_angled = llimg;
+    angle = degrees;
   }
 
+  w = max (16, g_image->width);
+  h = max (16, g_image->height);
+  SetWindowRgn (hw_main, NULL, FALSE);
+  transparent = 0;
+  MoveWindow (hw_main, spin_center.x - w/2, spin_center.y - h/2, w, h, TRUE);
+  if (footprint) {
+    WRegion wregion;
+    wregion.useMask (footprint);
+    wregion.extractRegions ();
+    if (wregion.extractedOK ()) {
+      wregion.applyRegion (hw_main);
+      transparent = 1;
+    }
+  }
+  InvalidateRect (hw_main, NULL, FALSE);
+  UpdateWindow (hw_main);
+}
 
+///////////////////////////////////////////////////////////////////////////////
+//
+// 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Drops a free turn, for what it was made from to show again.  Anything
+// that changes g_llimg or g_llimg_x8 does this first.
+
+void SnapShotW::straighten () {
+  if (!g_angled)
+    return;
+  if (g_image == g_angled)
+    g_image = angle_src;
+  if (g_saved == g_angled)
+    g_saved = angle_src;
+  llimg_release_llimg (g_angled);
+  g_angled = NULL;
+  angle_src = NULL;
+  angle = 0;
+  if (transparent) {
+    SetWindowRgn (hw_main, NULL, FALSE);
+    transparent = 0;
+  }
 }
 
 
@@ -1209,6 +1745,7 @@ void SnapShotW::show_small_img (int x, int y, int reduce) {
   
   if (!g_llimg) return;
   if (in_error) return;
+  straighten ();
 
   // Force a new reduced image if necessary
   // reduce = 0 means use the current g_llimg_x8 if there is one
@@ -1223,7 +1760,17 @@ void SnapShotW::show_small_img (int x, int y, int reduce) {
   if (!g_llimg_x8) {
     if (!reduction)
       reduction = wndmgr->reduction;
-    switch (g_llimg->bits_per_pixel){
+    // A scaled read gets resampled down, read bigger first if need be
+    if (g_llimg->full_width) {
+      int w = full_w () / reduction;
+      int h = full_h () / reduction;
+      SetCursor (LoadCursor (NULL, IDC_WAIT));
+      cover_image (w, h);
+      g_llimg_x8 = llimg_resize (g_llimg, w+1, h+1);
+      SetCursor (g_hand_cursor);    
+      if (!g_llimg_x8) return;
+    }
+    else switch (g_llimg->bits_per_pixel){
     case 8:
       SetCursor (LoadCursor (NULL, IDC_WAIT));
       g_llimg_x8 = (LLIMG *) malloc(sizeof(LLIMG));
@@ -1286,6 +1833,7 @@ void SnapShotW::show_small_img (int x, int y, int reduce) {
   InvalidateRect (hw_main, NULL, TRUE);
   UpdateWindow (hw_main);
   g_x8_up = 1;
+  shown_small ();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -1295,6 +1843,7 @@ void SnapShotW::show_small_img (int x, int y, int reduce) {
 ///////////////////////////////////////////////////////////////////////////////
 
 void SnapShotW::move_img (const RECT *rect, int fix_aspect) {
+  straighten ();
   
   int w = rect->right - rect->left + 1;
   int h = rect->bottom - rect->top + 1;
@@ -1308,7 +1857,8 @@ void SnapShotW::move_img (const RECT *rect, int fix_aspect) {
   int left = rect->left + (targ_w - w)/2;
   int top = rect->top + (targ_h - h)/2;
   // ...
-  if (w == g_llimg->width && h == g_llimg->height) {
+  if (w == full_w () && h == full_h () && !cover_image (w, h)) {
+    orient_full ();
     g_image = g_llimg;  
     g_x8_up = 0;
   }
@@ -1320,6 +1870,7 @@ void SnapShotW::move_img (const RECT *rect, int fix_aspect) {
     }
     if (!matches) {
       SetCursor (LoadCursor (NULL, IDC_WAIT));
+      cover_image (w, h);
       llimg_release_llimg (g_llimg_x8);
       g_llimg_x8 = 
         llimg_resize (g_llimg, w, h);
@@ -1334,6 +1885,7 @@ void SnapShotW::move_img (const RECT *rect, int fix_aspect) {
   InvalidateRect (hw_main, NULL, FALSE);
   UpdateWindow (hw_main);
   MoveWindow (hw_main, left, top, w-1, h-1, TRUE);
+  shown_small ();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -1397,12 +1949,14 @@ void SnapShotW::show_saved () {
 // (area * width) easily overflows an integer for large images
 
 void SnapShotW::scale_to_area (int area) {
+  straighten ();
   SetCursor (LoadCursor (NULL, IDC_WAIT));
-  double aw = double(area) * double(g_llimg->width);
-  double xx = aw/g_llimg->height;
+  double aw = double(area) * double(view_w ());
+  double xx = aw/view_h ();
   int w = (int)(sqrt(xx) + 0.5);
   int h = area / w;
   llimg_lock_aspect (g_llimg, w, h);
+  cover_image (w, h);
   llimg_release_llimg (g_llimg_x8);
   g_llimg_x8 = 
     llimg_resize (g_llimg, w, h);
@@ -1417,6 +1971,7 @@ void SnapShotW::scale_to_area (int area) {
   RECT rect;
   GetWindowRect (hw_main, &rect);
   MoveWindow (hw_main, rect.left, rect.top, w-1, h-1, TRUE);
+  shown_small ();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -1428,6 +1983,11 @@ void SnapShotW::scale_to_area (int area) {
 // Expand the image around the mouse click
 
 void SnapShotW::show_centered_img (int x, int y) {
+  straighten ();
+  if (g_llimg) {
+    cover_image (full_w (), full_h ());
+    orient_full ();
+  }
   g_image = g_llimg;
   if (!g_image)
     return;
@@ -1474,7 +2034,9 @@ void SnapShotW::show_centered_img (int x, int y) {
 ///////////////////////////////////////////////////////////////////////////////
 
 void SnapShotW::init(HINSTANCE hInstance,
-                     LPSTR lpCmdLine, int nCmdShow) {
+                     LPSTR lpCmdLine, int nCmdShow,
+                     int max_w, int max_h, int preview,
+                     const LLPROBE *probed) {
 
   WNDCLASSEX wcl;
   wcl.cbSize = sizeof (WNDCLASSEX);
@@ -1507,7 +2069,7 @@ void SnapShotW::init(HINSTANCE hInstance,
   SetWindowLong (hw_main, GWL_USERDATA, (LONG) this);
   DragAcceptFiles (hw_main, TRUE);
 
-  load_image(lpCmdLine, -1, -1);
+  load_image(lpCmdLine, -1, -1, max_w, max_h, preview, probed);
   ShowWindow (hw_main, nCmdShow);
   UpdateWindow (hw_main);
 
@@ -1570,6 +2132,7 @@ WindowProc (HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam)
       return 0;
       
     case WM_SETFOCUS:
+      viewed = GetTickCount ();
       if (wndmgr)
         wndmgr->show();
       
@@ -1717,7 +2280,8 @@ WindowProc (HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam)
         HDC hdc = BeginPaint (hwnd, &ps);
         prect = &ps.rcPaint;
         act_state |= 2;
-        paintImage (hwnd, hdc, g_image, prect, 0, 0, paint_stretch);
+        paintImage (hwnd, hdc, g_image, prect, 0, 0,
+                    paint_stretch || placeholder);
         EndPaint (hwnd, &ps);
       }
       return 0;
@@ -1911,6 +2475,9 @@ WinMain (HINSTANCE hInstance,
   // 
   ooptions = new OOptions;
   ooptions->default_options();
+  // Kept to 1 GB, so the bytes fit a long
+  llimg_pool_cap (min (ooptions->pool_mb, 1024) * 1024L * 1024L);
+  llimg_keep_palette (ooptions->keep_palette);
   
   RECT r_scrn;
   SystemParametersInfo (SPI_GETWORKAREA, 0, &r_scrn, 0);
@@ -1987,12 +2554,8 @@ WinMain (HINSTANCE hInstance,
     wm->new_window (hInstance, "", nCmdShow);
   }
   else {
-    for (int t = tok_base; t < toks; t++ ) {
-      if (wm->is_layout_file (tok[t]))
-        wm->load_layout_file (tok[t]);
-      else
-        wm->new_window (hInstance, tok[t], nCmdShow);
-    }
+    for (int t = tok_base; t < toks; t++ )
+      wm->open_file (tok[t], nCmdShow);
   }
   
   while (GetMessage (&msg, NULL, 0, 0))
@@ -2002,6 +2565,8 @@ WinMain (HINSTANCE hInstance,
     }
 
   delete wm;
+  llimg_release_llimg (logo_llimg);
+  llimg_release_llimg (error_llimg);
 
   delete flip_dialog;
   delete trans_dialog;
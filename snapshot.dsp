@@ -43,7 +43,7 @@ RSC=rc.exe
 # PROP Ignore_Export_Lib 0
 # PROP Target_Dir ""
 # ADD BASE CPP /nologo /W3 /GX /O2 /D "WIN32" /D "NDEBUG" /D "_WINDOWS" /D "_MBCS" /YX /FD /c
-# ADD CPP /nologo /W3 /GX /O2 /D "WIN32" /D "NDEBUG" /D "_WINDOWS" /D "_MBCS" /FR /YX /FD /c
+# ADD CPP /nologo /W3 /GX /O2 /D "WIN32" /D "NDEBUG" /D "_WINDOWS" /D "_MBCS" /D "LLIMG_SIMD" /FR /YX /FD /c
 # ADD BASE MTL /nologo /D "NDEBUG" /mktyplib203 /win32
 # ADD MTL /nologo /D "NDEBUG" /mktyplib203 /win32
 # ADD BASE RSC /l 0x409 /d "NDEBUG"
@@ -69,7 +69,7 @@ LINK32=link.exe
 # PROP Ignore_Export_Lib 0
 # PROP Target_Dir ""
 # ADD BASE CPP /nologo /W3 /Gm /GX /ZI /Od /D "WIN32" /D "_DEBUG" /D "_WINDOWS" /D "_MBCS" /YX /FD /GZ /c
-# ADD CPP /nologo /W3 /Gm /GX /ZI /Od /D "WIN32" /D "_DEBUG" /D "_WINDOWS" /D "_MBCS" /FR /YX /FD /GZ /c
+# ADD CPP /nologo /W3 /Gm /GX /ZI /Od /D "WIN32" /D "_DEBUG" /D "_WINDOWS" /D "_MBCS" /D "LLIMG_SIMD" /FR /YX /FD /GZ /c
 # ADD BASE MTL /nologo /D "_DEBUG" /mktyplib203 /win32
 # ADD MTL /nologo /D "_DEBUG" /mktyplib203 /win32
 # ADD BASE RSC /l 0x409 /d "_DEBUG"
@@ -120,10 +120,26 @@ SOURCE=.\iconbar.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\mapfile.c
+# End Source File
+# Begin Source File
+
 SOURCE=.\ooptions.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\palette.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\pool.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\probe.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\readgif.cpp
 # End Source File
 # Begin Source File
@@ -144,6 +160,14 @@ SOURCE=.\rotate.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\share.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\simd.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\snapshot.cpp
 # End Source File
 # Begin Source File
@@ -188,10 +212,22 @@ SOURCE=.\iconbar.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\ll_simd.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\mapfile.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\ooptions.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\probe.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\resource.h
 # End Source File
 # Begin Source File
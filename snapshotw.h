@@ -40,8 +40,15 @@ public:
   SnapShotW();
   ~SnapShotW();
   void SnapShotW::init(HINSTANCE hInstance,
-                       LPSTR lpCmdLine, int nCmdShow);
-  void load_image (char *filename, int x, int y);
+                       LPSTR lpCmdLine, int nCmdShow,
+                       int max_w = 0, int max_h = 0, int preview = 0,
+                       const struct LLPROBE *probed = NULL);
+  void load_image (char *filename, int x, int y,
+                   int max_w = 0, int max_h = 0, int preview = 0,
+                   const struct LLPROBE *probed = NULL);
+  // Reads the image a preview put a placeholder up for
+  void finish_load ();
+  int get_placeholder () {return placeholder;}
   void show_centered_img (int x, int y);
   void show_img_fix_corner (int x, int y);
   void show_small_img (int x, int y, int reduce = 0);
@@ -51,6 +58,9 @@ public:
   void toggle_trans (int x=0, int y=0);
   void apply_trans (int x=0, int y=0);
   void rotate (int clockwise = 1);
+  void turn (int quarters);
+  // Turns what shows by any angle, fast for following the mouse
+  void spin (double degrees, int smooth);
   HWND get_hwnd () {return hw_main;}
   HINSTANCE instance () {return hInst;}
 
@@ -83,6 +93,12 @@ public:
 
   int get_in_logo () {return in_logo;}
 
+  // For the memory budget (see WndMgr::keep_budget)
+  double held_bytes ();
+  double drop_full ();
+  DWORD get_viewed () {return viewed;}
+  int get_dropped () {return dropped;}
+
 private:
 
   class WndMgr *wndmgr;
@@ -92,6 +108,8 @@ private:
   HMENU hmenu;        // The context menu
   LLIMG *g_image;      // Currently displaying image
   LLIMG *g_llimg;      // Full size, as read version of the image
+                       // (or a scaled read of it, see full_width),
+                       // turned only once it shows (see rotation)
   LLIMG *g_llimg_x8;   // Reduced 1/8 size version of the image
   LLIMG *g_saved;      // Temp * for image while showing screen (for dissolve)
   int g_x8_up;        // Flag meaning the 1/8 size image is showing
@@ -101,7 +119,13 @@ private:
   int tolerance;      // Transparency background tolerance
   int erosions;       // Transparency mask erosions
   int mask_depth;     // Transparency nesting depth, like ooptions->depth
-  int rotation;       // User rotation, clockwise, 0, 1, 2, or 3
+  int rotation;       // User rotation, clockwise, 0, 1, 2, or 3, after
+                      // the file is put upright
+  LLIMG *g_angled;    // What showed, turned by angle (see spin)
+  LLIMG *angle_src;   // ...which was this, g_llimg or g_llimg_x8
+  double angle;       // Free turn, degrees clockwise, on top of rotation
+  double angle_base;  // The angle when a drag at the top began
+  POINT spin_center;  // Screen point the window turns about
   int in_logo;        // The splash logo is showing
   int in_init;        // During posting of initial image
   int in_error;       // The error image is showing
@@ -110,13 +134,53 @@ private:
   int in_dragout;     // Right Click - a drag out if moved far enough
   int in_rotate;      // Click - at top center maybe a rotate
   int has_moved;      // Mouse dragged enough to not be just a click
-  int has_rotated;    // Mouse dragged enougth to rotate and the rotate is done
+  int has_rotated;    // Mouse dragged enough to start turning the image
   int act_state;      // Activation state: bit 1=WM_MOUSEACTIVATION 2=WM_PAINT
   POINT click_pt;     // The point initally left clicked on
   POINT base_pt;      // The latest reference point for the drag
   int shift_key;      // Flag meaning the shift key is down
   char *curr_file;    // Path of the currently viewing file
   int paint_stretch;  // Flag requesting a StretchDIBits when painting
+  int placeholder;    // g_llimg is an Exif thumbnail until finish_load
+  int file_orient;    // Exif orientation of curr_file, LLIMG_ORIENT_...
+  DWORD viewed;       // Tick count when last focused or loaded
+  int dropped;        // g_llimg was let go for what showed (see drop_full)
+  struct LLKEPT *source;  // curr_file's bytes, with ooptions->keep_source,
+                          // for read_cover to decode from
+  const struct LLCODEC *source_codec;
+  void take_source (char *filename, const struct LLCODEC *codec);
+  void drop_source ();
+  void shown_small ();
+
+  // Size of the full image as it shows, even when g_llimg is a scaled
+  // decode, or is still to be turned
+  int turned () {return g_llimg->rotation >= LLIMG_ORIENT_TRANSPOSE;}
+  long stored_w () {return g_llimg->full_width ? 
+                      g_llimg->full_width : g_llimg->width;}
+  long stored_h () {return g_llimg->full_height ? 
+                      g_llimg->full_height : g_llimg->height;}
+  long full_w () {return turned () ? stored_h () : stored_w ();}
+  long full_h () {return turned () ? stored_w () : stored_h ();}
+  // Size of g_llimg as it shows
+  long view_w () {return turned () ? g_llimg->height : g_llimg->width;}
+  long view_h () {return turned () ? g_llimg->width : g_llimg->height;}
+  int orient_full ();
+  void straighten ();
+  int cover_image (int w, int h);
+  int read_cover (int w, int h);
+  void show_placeholder (LLIMG *thumb, char *filename, int x, int y,
+                         int max_w, int max_h);
+  void show_loaded (LLIMG *llimg, char *filename, int x, int y,
+                    int _in_error, int _in_logo);
+
+  // Where load_image is to put up a progressive JPEG, for show_scan
+  char *scan_file;
+  int scan_x;
+  int scan_y;
+  void show_scan (LLIMG *llimg);
+  static void scan_proxy (LLIMG *llimg, void *client) {
+    ((SnapShotW *) client)->show_scan (llimg);
+  }
 
   int handle_click (int x, int y, int keymod = 0);
   int handle_drop (HDROP hdrop);
@@ -0,0 +1,429 @@
+/*******************************************************************************
+ * Copyright 2002, 2003, 2004, 2005, 2006, 2012 Kent Stork
+ *
+ * gifbench.cpp is part of Osiva.
+ *
+ * Osiva is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Osiva is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Osiva.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+///////////////////////////////////////////////////////////////////////////
+//
+// File: gifbench.cpp
+//
+// Times the GIF decoder against the one it replaced, side by side in
+// one program: the old xv loop, which stacked each string in OutCode and
+// wrote it out backwards a pixel at a time, is kept below as it was
+// (only its container reading is cut down to what finds the image).
+// Both decode the same bytes from memory to an image, the best of some
+// runs each, and a hash of each image's pixels shows they agree.
+//
+// With no files named it makes its own, large and of the two kinds
+// that matter (see harness_gif): scanned pages at 1 and 2 bits and
+// screenshots, one of them interlaced.
+//
+// Build (see harness.h):
+//
+//   tests/gifbench.cpp readgif.cpp pool.cpp mapfile.c
+//
+// Run:
+//
+//   gifbench [-n runs] [file.gif ...]
+//
+// 7 runs unless told otherwise.
+
+
+#include "harness.h"
+#include "mapfile.h"
+
+// readgif.cpp
+extern LLIMG *
+expandGif (unsigned char *idata, int filebytes);
+
+/////////////////////////////////////////////////////////////////////////
+//
+// The decoder before the table-driven one, its LZW loop as it was
+
+struct old_gif {
+  int BitOffset, XC, YC, Pass, OutCount, Width, Height, CodeSize,
+    InitCodeSize, Code, MaxCode, ClearCode, EOFCode, CurCode, OldCode,
+    InCode, FirstFree, FreeCode, FinChar, BitMask, ReadMask, Interlace;
+  unsigned char *Raster, *pic8, *interlace_ptr;
+  int interlace_y;
+  int Prefix[4096];
+  int Suffix[4096];
+  int OutCode[4097];
+};
+
+static int
+old_read_code (struct old_gif *g)
+{
+  int RawCode, ByteOffset;
+
+  ByteOffset = g->BitOffset / 8;
+  RawCode = g->Raster[ByteOffset] + (g->Raster[ByteOffset + 1] << 8);
+  if (g->CodeSize >= 8)
+    RawCode += (((int) g->Raster[ByteOffset + 2]) << 16);
+  RawCode >>= (g->BitOffset % 8);
+  g->BitOffset += g->CodeSize;
+
+  return (RawCode & g->ReadMask);
+}
+
+static void
+old_interlace (struct old_gif *g, int Index)
+{
+  if (g->interlace_y != g->YC) {
+    g->interlace_ptr = g->pic8 + g->YC * g->Width;
+    g->interlace_y = g->YC;
+  }
+  if (g->YC < g->Height)
+    *g->interlace_ptr++ = Index;
+  if (++g->XC == g->Width) {
+    g->XC = 0;
+    switch (g->Pass) {
+    case 0:
+      g->YC += 8;
+      if (g->YC >= g->Height) {
+        g->Pass++;
+        g->YC = 4;
+      }
+      break;
+    case 1:
+      g->YC += 8;
+      if (g->YC >= g->Height) {
+        g->Pass++;
+        g->YC = 2;
+      }
+      break;
+    case 2:
+      g->YC += 4;
+      if (g->YC >= g->Height) {
+        g->Pass++;
+        g->YC = 1;
+      }
+      break;
+    case 3:
+      g->YC += 2;
+      break;
+    }
+  }
+}
+
+// The image at p (just past its separator), into image; 0 or -1
+static int
+old_read_image (struct old_gif *g, const unsigned char *p,
+                const unsigned char *end, LLIMG *image)
+{
+  unsigned char *ptr1, *picptr, *op, *np;
+  int i, y, ch, ch1, npixels = 0, maxpixels, aWidth, padbytes;
+
+  g->Width = p[4] + 0x100 * p[5];
+  g->Height = p[6] + 0x100 * p[7];
+  g->Interlace = p[8] & 0x40;
+  if (p[8] & 0x80) {
+    for (i = 0; i < 1 << ((p[8] & 7) + 1); i++) {
+      image->color[i].red = p[9 + 3 * i];
+      image->color[i].green = p[10 + 3 * i];
+      image->color[i].blue = p[11 + 3 * i];
+    }
+    p += 3 << ((p[8] & 7) + 1);
+  }
+  p += 9;
+
+  g->CodeSize = *p++;
+  g->ClearCode = (1 << g->CodeSize);
+  g->EOFCode = g->ClearCode + 1;
+  g->FreeCode = g->FirstFree = g->ClearCode + 2;
+  g->CodeSize++;
+  g->InitCodeSize = g->CodeSize;
+  g->MaxCode = (1 << g->CodeSize);
+  g->ReadMask = g->MaxCode - 1;
+
+  // Unblock
+  g->Raster = (unsigned char *) calloc ((size_t) (end - p) + 256, 1);
+  if (!g->Raster)
+    return -1;
+  ptr1 = g->Raster;
+  do {
+    ch = ch1 = *p++;
+    while (ch--)
+      *ptr1++ = *p++;
+    if (p > end)
+      break;
+  } while (ch1);
+
+  maxpixels = g->Width * g->Height;
+  aWidth = 4 * ((g->Width + 3) / 4);
+  picptr = g->pic8 = (unsigned char *) malloc ((size_t) (aWidth * g->Height));
+  if (!g->pic8)
+    return -1;
+  if (g->Interlace)
+    memset (g->pic8, 0, (size_t) (aWidth * g->Height));
+
+  g->Code = old_read_code (g);
+  while (g->Code != g->EOFCode) {
+    if (g->Code == g->ClearCode) {
+      g->CodeSize = g->InitCodeSize;
+      g->MaxCode = (1 << g->CodeSize);
+      g->ReadMask = g->MaxCode - 1;
+      g->FreeCode = g->FirstFree;
+      g->Code = old_read_code (g);
+      g->CurCode = g->OldCode = g->Code;
+      g->FinChar = g->CurCode & g->BitMask;
+      if (!g->Interlace)
+        *picptr++ = g->FinChar;
+      else
+        old_interlace (g, g->FinChar);
+      npixels++;
+    }
+    else {
+      if (g->FreeCode >= 4096)
+        break;
+      g->CurCode = g->InCode = g->Code;
+      if (g->CurCode >= g->FreeCode) {
+        g->CurCode = g->OldCode;
+        if (g->OutCount > 4096)
+          break;
+        g->OutCode[g->OutCount++] = g->FinChar;
+      }
+      while (g->CurCode > g->BitMask) {
+        if (g->OutCount > 4096)
+          break;
+        g->OutCode[g->OutCount++] = g->Suffix[g->CurCode];
+        g->CurCode = g->Prefix[g->CurCode];
+      }
+      if (g->OutCount > 4096)
+        break;
+      g->FinChar = g->CurCode & g->BitMask;
+      g->OutCode[g->OutCount++] = g->FinChar;
+      if (npixels + g->OutCount > maxpixels)
+        g->OutCount = maxpixels - npixels;
+      npixels += g->OutCount;
+      if (!g->Interlace)
+        for (i = g->OutCount - 1; i >= 0; i--)
+          *picptr++ = g->OutCode[i];
+      else
+        for (i = g->OutCount - 1; i >= 0; i--)
+          old_interlace (g, g->OutCode[i]);
+      g->OutCount = 0;
+
+      g->Prefix[g->FreeCode] = g->OldCode;
+      g->Suffix[g->FreeCode] = g->FinChar;
+      g->OldCode = g->InCode;
+      g->FreeCode++;
+      if (g->FreeCode >= g->MaxCode) {
+        if (g->CodeSize < 12) {
+          g->CodeSize++;
+          g->MaxCode *= 2;
+          g->ReadMask = (1 << g->CodeSize) - 1;
+        }
+      }
+    }
+    g->Code = old_read_code (g);
+    if (npixels >= maxpixels)
+      break;
+  }
+  if (npixels != maxpixels && !g->Interlace)
+    memset ((char *) g->pic8 + npixels, 0, (size_t) (maxpixels - npixels));
+
+  // Long align the rows, in the room left for it
+  if (g->Width != aWidth) {
+    padbytes = aWidth - g->Width;
+    op = g->pic8 + (g->Height - 1) * g->Width;
+    np = g->pic8 + (g->Height - 1) * aWidth;
+    for (y = g->Height - 1; y >= 0; y--) {
+      memmove (np, op, g->Width);
+      memset (np + g->Width, 0, padbytes);
+      op -= g->Width;
+      np -= aWidth;
+    }
+  }
+
+  image->width = g->Width;
+  image->height = g->Height;
+  image->bits_per_pixel = 8;
+  image->data = g->pic8;
+  image->line = (unsigned char **) malloc (g->Height * sizeof (unsigned char *));
+  if (!image->line)
+    return -1;
+  for (y = 0; y < g->Height; y++)
+    image->line[y] = g->pic8 + y * aWidth;
+  return 0;
+}
+
+// The first image of the size bytes of GIF at data, the old way; its
+// data and line are malloc'd (see old_free).  0 or -1.
+static int
+old_decode (const unsigned char *data, long size, LLIMG *image)
+{
+  struct old_gif *g;
+  const unsigned char *p = data + 13, *end = data + size;
+  int ret = -1, n;
+
+  memset (image, 0, sizeof (LLIMG));
+  if (size < 13 || memcmp (data, "GIF8", 4))
+    return -1;
+  g = (struct old_gif *) calloc (1, sizeof (struct old_gif));
+  if (!g)
+    return -1;
+  g->interlace_y = -1;
+  g->BitMask = (1 << ((data[10] & 7) + 1)) - 1;
+  if (data[10] & 0x80)
+    p += 3 << ((data[10] & 7) + 1);
+  while (p < end) {
+    if (*p == 0x21) {
+      // Extensions go by, sub-block by sub-block
+      for (p += 2; p < end && *p; p += *p + 1)
+        ;
+      p++;
+    }
+    else if (*p == 0x2c) {
+      ret = old_read_image (g, p + 1, end, image);
+      break;
+    }
+    else
+      break;
+  }
+  free (g->Raster);
+  if (ret)
+    free (g->pic8);
+  free (g);
+  return ret;
+}
+
+static void
+old_free (LLIMG *image)
+{
+  free (image->data);
+  free (image->line);
+}
+
+/////////////////////////////////////////////////////////////////////////
+//
+// A hash of image's pixels, without the pad after each row
+
+static unsigned long
+pixel_hash (LLIMG *image)
+{
+  unsigned long hash = 5381;
+  int x, y, bytes;
+
+  bytes = (image->width * image->bits_per_pixel + 7) / 8;
+  for (y = 0; y < image->height; y++) {
+    for (x = 0; x < bytes; x++)
+      hash = hash * 33 + image->line[y][x];
+  }
+  return hash & 0xffffffffUL;
+}
+
+/////////////////////////////////////////////////////////////////////////
+//
+// Decodes the size bytes at data both ways, runs times each, and prints
+// the best times and whether the images agree; 0 if they do, else -1
+
+static int
+bench (const char *name, const unsigned char *data, long size, int runs)
+{
+  LLIMG *image = NULL;
+  LLIMG old;
+  double t, best_old = 0, best_new = 0;
+  unsigned long hash_old = 0, hash_new = 0;
+  int run;
+
+  for (run = 0; run < runs; run++) {
+    t = harness_ms ();
+    if (old_decode (data, size, &old)) {
+      printf ("%s: the old decoder can't read it\n", name);
+      return -1;
+    }
+    t = harness_ms () - t;
+    if (!run || t < best_old)
+      best_old = t;
+    if (!run)
+      hash_old = pixel_hash (&old);
+    old_free (&old);
+
+    t = harness_ms ();
+    image = expandGif ((unsigned char *) data, (int) size);
+    t = harness_ms () - t;
+    if (!image) {
+      printf ("%s: doesn't read\n", name);
+      return -1;
+    }
+    if (!run || t < best_new)
+      best_new = t;
+    if (!run)
+      hash_new = pixel_hash (image);
+    if (run < runs - 1)
+      llimg_release_llimg (image);
+  }
+  printf ("%-28s %5ldx%-5ld old %8.2f ms  new %8.2f ms  %5.2fx  %s\n",
+          name, image->width, image->height, best_old, best_new,
+          best_new > 0 ? best_old / best_new : 0.0,
+          hash_old == hash_new ? "same" : "NOT THE SAME");
+  llimg_release_llimg (image);
+  return hash_old == hash_new ? 0 : -1;
+}
+
+static const struct {
+  const char *name;
+  int kind, width, height, interlace;
+} made[] = {
+  { "scan, 1 bit", HARNESS_GIF_SCAN, 2550, 3300, 0 },
+  { "scan, 2 bits", HARNESS_GIF_SCAN2, 4000, 3000, 0 },
+  { "screenshot", HARNESS_GIF_SCREEN, 1920, 1080, 0 },
+  { "screenshot, interlaced", HARNESS_GIF_SCREEN, 1203, 907, 1 },
+  { "screenshot, 4k", HARNESS_GIF_SCREEN, 3840, 2160, 0 }
+};
+
+int
+main (int argc, char **argv)
+{
+  struct LLMAP map;
+  unsigned char *data;
+  long size;
+  int runs = 7, files = 0, failed = 0;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (!strcmp (argv[i], "-n") && i + 1 < argc) {
+      runs = atoi (argv[++i]);
+      continue;
+    }
+    files++;
+    if (llimg_map_file (argv[i], &map)) {
+      printf ("%s: can't read\n", argv[i]);
+      failed++;
+      continue;
+    }
+    if (bench (argv[i], map.data, map.size, runs))
+      failed++;
+    llimg_unmap_file (&map);
+  }
+  if (!files) {
+    for (i = 0; i < (int) (sizeof (made) / sizeof (made[0])); i++) {
+      data = harness_gif (made[i].kind, made[i].width, made[i].height,
+                          made[i].interlace, i + 1, &size);
+      if (!data) {
+        printf ("%s: out of memory\n", made[i].name);
+        return 2;
+      }
+      if (bench (made[i].name, data, size, runs))
+        failed++;
+      free (data);
+    }
+  }
+  return failed ? 1 : 0;
+}
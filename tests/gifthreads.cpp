@@ -0,0 +1,174 @@
+/*******************************************************************************
+ * Copyright 2002, 2003, 2004, 2005, 2006, 2012 Kent Stork
+ *
+ * gifthreads.cpp is part of Osiva.
+ *
+ * Osiva is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Osiva is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Osiva.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+///////////////////////////////////////////////////////////////////////////
+//
+// File: gifthreads.cpp
+//
+// Decodes GIFs on many threads at once and checks every decode against
+// one made alone first: the GIF decoder keeps all its state in the
+// call, so decodes side by side must not see each other.  Each thread
+// goes through the files from a different one, so different files are
+// decoding at any moment, all from the one copy of each.
+//
+// Build (see harness.h):
+//
+//   tests/gifthreads.cpp readgif.cpp pool.cpp mapfile.c
+//
+// Run:
+//
+//   gifthreads [-t threads] [-r rounds] [file.gif ...]
+//
+// If no files are named, the GIFs at the top of the tree and large ones
+// made here (see harness_gif): a scanned page, a screenshot and an
+// interlaced one, so the long decodes overlap too.  16 threads and 20
+// rounds unless told otherwise.
+
+
+#include "harness.h"
+#include "mapfile.h"
+
+// readgif.cpp
+extern LLIMG *
+expandGif (unsigned char *idata, int filebytes);
+
+#define MAX_FILES 256
+
+static const char *default_files[] = {
+  "osiva.gif", "error.gif", "iconbar528.gif", "iconbar528md.gif",
+  "iconbar528mo.gif", "iconbar528na.gif"
+};
+
+static const struct {
+  const char *name;
+  int kind, width, height, interlace;
+} made[] = {
+  { "scan, 1 bit", HARNESS_GIF_SCAN, 2550, 3300, 0 },
+  { "screenshot", HARNESS_GIF_SCREEN, 1920, 1080, 0 },
+  { "screenshot, interlaced", HARNESS_GIF_SCREEN, 1203, 907, 1 }
+};
+
+struct stress {
+  int files;
+  int rounds;
+  struct LLMAP map[MAX_FILES];     /* data is malloc'd for those made */
+  LLIMG *alone[MAX_FILES];         /* each file decoded by itself */
+  int decodes[HARNESS_THREADS];
+  int wrong[HARNESS_THREADS];
+};
+
+/////////////////////////////////////////////////////////////////////////
+//
+// One thread's share: every file, rounds times, from file i on
+
+static void
+decode_all (void *arg, int i)
+{
+  struct stress *s = (struct stress *) arg;
+  LLIMG *image;
+  int round, k, f;
+
+  for (round = 0; round < s->rounds; round++) {
+    for (k = 0; k < s->files; k++) {
+      f = (i + k) % s->files;
+      image = expandGif ((unsigned char *) s->map[f].data,
+                         (int) s->map[f].size);
+      if (!harness_same (image, s->alone[f]))
+        s->wrong[i]++;
+      s->decodes[i]++;
+      llimg_release_llimg (image);
+    }
+  }
+}
+
+int
+main (int argc, char **argv)
+{
+  static struct stress s;
+  const char *name[MAX_FILES];
+  int threads = 16, decodes = 0, wrong = 0, named;
+  int i, f, m;
+  double t;
+
+  s.rounds = 20;
+  for (i = 1; i < argc; i++) {
+    if (!strcmp (argv[i], "-t") && i + 1 < argc)
+      threads = atoi (argv[++i]);
+    else if (!strcmp (argv[i], "-r") && i + 1 < argc)
+      s.rounds = atoi (argv[++i]);
+    else if (s.files < MAX_FILES)
+      name[s.files++] = argv[i];
+  }
+  named = s.files;
+  if (!named) {
+    for (f = 0; f < (int) (sizeof (default_files) / sizeof (char *)); f++)
+      name[s.files++] = default_files[f];
+  }
+  if (threads < 1 || threads > HARNESS_THREADS) {
+    printf ("1 to %d threads\n", HARNESS_THREADS);
+    return 2;
+  }
+
+  for (f = 0; f < s.files; f++) {
+    if (llimg_map_file (name[f], &s.map[f])) {
+      printf ("%s: can't read\n", name[f]);
+      return 2;
+    }
+  }
+  for (m = 0; !named && m < (int) (sizeof (made) / sizeof (made[0])); m++) {
+    f = s.files++;
+    name[f] = made[m].name;
+    s.map[f].data = harness_gif (made[m].kind, made[m].width,
+                                 made[m].height, made[m].interlace, m + 1,
+                                 &s.map[f].size);
+    s.map[f].mapped = 0;
+    if (!s.map[f].data) {
+      printf ("%s: out of memory\n", name[f]);
+      return 2;
+    }
+  }
+
+  for (f = 0; f < s.files; f++) {
+    s.alone[f] = expandGif ((unsigned char *) s.map[f].data,
+                            (int) s.map[f].size);
+    if (s.alone[f])
+      printf ("%s: %ldx%ld\n", name[f], s.alone[f]->width,
+              s.alone[f]->height);
+    else
+      printf ("%s: doesn't decode (each thread must agree)\n", name[f]);
+  }
+
+  t = harness_ms ();
+  harness_threads (threads, decode_all, &s);
+  t = harness_ms () - t;
+
+  for (i = 0; i < threads; i++) {
+    decodes += s.decodes[i];
+    wrong += s.wrong[i];
+  }
+  printf ("%d files, %d threads, %d decodes in %.0f ms: %d unlike the "
+          "decode alone\n", s.files, threads, decodes, t, wrong);
+
+  for (f = 0; f < s.files; f++) {
+    llimg_release_llimg (s.alone[f]);
+    llimg_unmap_file (&s.map[f]);
+  }
+  return wrong ? 1 : 0;
+}
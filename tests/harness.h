@@ -0,0 +1,558 @@
+/*******************************************************************************
+ * Copyright 2002, 2003, 2004, 2005, 2006, 2012 Kent Stork
+ *
+ * harness.h is part of Osiva.
+ *
+ * Osiva is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Osiva is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Osiva.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+///////////////////////////////////////////////////////////////////////////
+//
+// File: harness.h
+//
+// What the programs in tests/ have in common: a millisecond clock,
+// the memory in use, threads, test images and GIFs, and comparing
+// images.  Each program is one .cpp built from the top of the tree with
+// the sources it names at its top.  With Visual C++, for example
+//
+//   cl /O2 /I. /D LLIMG_SIMD tests\gifthreads.cpp readgif.cpp pool.cpp
+//      mapfile.c
+//
+// adding jpeg6b_r.lib for those that read JPEGs.  With gcc, the .c
+// files are compiled as C first and the rest with g++, -fpermissive
+// for the old code in readgif.cpp and resizer.cpp:
+//
+//   gcc -O2 -c -idirafter . mapfile.c
+//   g++ -O2 -fpermissive -idirafter . tests/gifthreads.cpp readgif.cpp
+//       pool.cpp mapfile.o -lpthread
+//
+// Those that read JPEGs build readjpeg.c the same way and link the
+// installed libjpeg (-ljpeg), with -DLLIMG_SYSTEM_JPEG on every step so
+// its headers are used rather than the jpeg6b ones here; -idirafter
+// rather than -I. keeps these from shadowing it.  gcc builds only the
+// SSE2 kernels unless told -mssse3 or -mavx2, which then let it use
+// those sets anywhere in the file.  Each prints what it found and exits
+// 0 if all was well.  None is part of the viewer.
+
+
+#ifndef HARNESS_H
+#define HARNESS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ll_image.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment (lib, "psapi.lib")
+#else
+#include <pthread.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+#if defined (_WIN32) || defined (__GLIBC__)
+#include <malloc.h>
+#endif
+
+#define HARNESS_THREADS 64
+
+// pool.cpp
+extern LLIMG *
+llimg_alloc (int width, int height, int bits_per_pixel);
+
+/////////////////////////////////////////////////////////////////////////
+//
+// Milliseconds from some fixed time
+
+inline double
+harness_ms ()
+{
+#ifdef _WIN32
+  LARGE_INTEGER now, freq;
+  QueryPerformanceCounter (&now);
+  QueryPerformanceFrequency (&freq);
+  return 1000.0 * (double) now.QuadPart / (double) freq.QuadPart;
+#else
+  struct timeval now;
+  gettimeofday (&now, NULL);
+  return now.tv_sec * 1000.0 + now.tv_usec / 1000.0;
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////
+//
+// Bytes of memory the process has in use: its private bytes on
+// Windows, else what is resident.  What the heap has been given back
+// but still holds is handed to the system first, where that can be.
+
+inline double
+harness_mem ()
+{
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS pmc;
+  _heapmin ();
+  if (!GetProcessMemoryInfo (GetCurrentProcess (), &pmc, sizeof (pmc)))
+    return 0;
+  return (double) pmc.PagefileUsage;
+#else
+  FILE *f;
+  long size = 0, resident = 0;
+#ifdef __GLIBC__
+  malloc_trim (0);
+#endif
+  f = fopen ("/proc/self/statm", "r");
+  if (!f)
+    return 0;
+  if (fscanf (f, "%ld %ld", &size, &resident) != 2)
+    resident = 0;
+  fclose (f);
+  return (double) resident * sysconf (_SC_PAGESIZE);
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////
+//
+// Runs body (arg, i) on n threads at once, i from 0, and waits for them
+
+typedef void (*harness_body) (void *arg, int i);
+
+struct harness_job {
+  harness_body body;
+  void *arg;
+  int i;
+};
+
+#ifdef _WIN32
+static DWORD WINAPI
+harness_thread (LPVOID p)
+#else
+static void *
+harness_thread (void *p)
+#endif
+{
+  struct harness_job *job = (struct harness_job *) p;
+  job->body (job->arg, job->i);
+  return 0;
+}
+
+inline void
+harness_threads (int n, harness_body body, void *arg)
+{
+  struct harness_job job[HARNESS_THREADS];
+#ifdef _WIN32
+  HANDLE thread[HARNESS_THREADS];
+#else
+  pthread_t thread[HARNESS_THREADS];
+#endif
+  int i;
+
+  if (n > HARNESS_THREADS)
+    n = HARNESS_THREADS;
+  for (i = 0; i < n; i++) {
+    job[i].body = body;
+    job[i].arg = arg;
+    job[i].i = i;
+#ifdef _WIN32
+    thread[i] = CreateThread (NULL, 0, harness_thread, &job[i], 0, NULL);
+#else
+    pthread_create (&thread[i], NULL, harness_thread, &job[i]);
+#endif
+  }
+  for (i = 0; i < n; i++) {
+#ifdef _WIN32
+    WaitForSingleObject (thread[i], INFINITE);
+    CloseHandle (thread[i]);
+#else
+    pthread_join (thread[i], NULL);
+#endif
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////
+//
+// A width by height test image of noise over a gradient, the same for
+// the same seed.  8 bit ones get a color table of seed's too.
+
+inline LLIMG *
+harness_image (int width, int height, int bits_per_pixel, unsigned seed)
+{
+  LLIMG *image;
+  unsigned char *p;
+  int x, y, bytes;
+
+  image = llimg_alloc (width, height, bits_per_pixel);
+  if (!image)
+    return NULL;
+  bytes = width * bits_per_pixel / 8;
+  for (y = 0; y < height; y++) {
+    p = image->line[y];
+    for (x = 0; x < bytes; x++) {
+      seed = seed * 1103515245 + 12345;
+      p[x] = (unsigned char) ((x + y) / 4 + ((seed >> 16) & 31));
+    }
+  }
+  for (x = 0; x < 256; x++) {
+    seed = seed * 1103515245 + 12345;
+    image->color[x].blue = (unsigned char) (seed >> 8);
+    image->color[x].green = (unsigned char) (seed >> 16);
+    image->color[x].red = (unsigned char) (seed >> 24);
+  }
+  return image;
+}
+
+/////////////////////////////////////////////////////////////////////////
+//
+// Whether two images are the same size and depth with the same pixels
+// (the row bytes, not the pad after them) and, under 16 bits, the same
+// color table
+
+inline int
+harness_same (LLIMG *a, LLIMG *b)
+{
+  int y, bytes;
+
+  if (!a || !b)
+    return a == b;
+  if (a->width != b->width || a->height != b->height
+      || a->bits_per_pixel != b->bits_per_pixel)
+    return 0;
+  if (a->bits_per_pixel < 16
+      && memcmp (a->color, b->color, sizeof (a->color)))
+    return 0;
+  bytes = (a->width * a->bits_per_pixel + 7) / 8;
+  for (y = 0; y < a->height; y++) {
+    if (memcmp (a->line[y], b->line[y], bytes))
+      return 0;
+  }
+  return 1;
+}
+
+/////////////////////////////////////////////////////////////////////////
+//
+// Large GIFs like the ones people open: a page scanned at 1 or 2 bits,
+// text on white with some speckle, and an 8 bit screenshot of windows,
+// text, a gradient bar and a photo.  Made here, so every run of every
+// program has the same ones.
+
+enum { HARNESS_GIF_SCAN, HARNESS_GIF_SCAN2, HARNESS_GIF_SCREEN };
+
+#define HARNESS_GLYPHS 64
+#define HARNESS_HSIZE 5003         /* LZW hash, a prime over 4096 */
+
+struct harness_gif_out {
+  unsigned char *data;
+  long size, room;
+  unsigned long acc;               /* code bits not yet a whole byte */
+  int acc_bits;
+  unsigned char block[255];        /* the sub-block being filled */
+  int block_len;
+};
+
+inline void
+harness_gif_put (struct harness_gif_out *o, const void *bytes, long n)
+{
+  if (o->size + n > o->room) {
+    o->room = 2 * (o->size + n);
+    o->data = (unsigned char *) realloc (o->data, o->room);
+  }
+  if (o->data)
+    memcpy (o->data + o->size, bytes, n);
+  o->size += n;
+}
+
+inline void
+harness_gif_flush (struct harness_gif_out *o)
+{
+  unsigned char n = (unsigned char) o->block_len;
+
+  if (o->block_len) {
+    harness_gif_put (o, &n, 1);
+    harness_gif_put (o, o->block, o->block_len);
+    o->block_len = 0;
+  }
+}
+
+inline void
+harness_gif_code (struct harness_gif_out *o, int code, int bits)
+{
+  o->acc |= (unsigned long) code << o->acc_bits;
+  o->acc_bits += bits;
+  while (o->acc_bits >= 8) {
+    o->block[o->block_len++] = (unsigned char) (o->acc & 255);
+    if (o->block_len == 255)
+      harness_gif_flush (o);
+    o->acc >>= 8;
+    o->acc_bits -= 8;
+  }
+}
+
+// LZW as compress and ppmtogif do it: a hashed string table, a clear
+// code when it fills, and the code size grown as the table passes it
+inline void
+harness_gif_lzw (struct harness_gif_out *o, const unsigned char *pix,
+                 int width, int height, int interlace, int min_size)
+{
+  static const int start[] = { 0, 4, 2, 1 }, step[] = { 8, 8, 4, 2 };
+  long *htab;
+  int *codetab;
+  long fcode;
+  int clear = 1 << min_size, bits = min_size + 1;
+  int maxcode = (1 << bits) - 1, next = clear + 2;
+  int ent = -1, pass, y, x, c, i, disp;
+
+  htab = (long *) malloc (HARNESS_HSIZE * sizeof (long));
+  codetab = (int *) malloc (HARNESS_HSIZE * sizeof (int));
+  for (i = 0; i < HARNESS_HSIZE; i++)
+    htab[i] = -1;
+  harness_gif_code (o, clear, bits);
+  for (pass = 0; pass < 4; pass++) {
+    for (y = interlace ? start[pass] : pass ? height : 0; y < height;
+         y += interlace ? step[pass] : 1) {
+      for (x = 0; x < width; x++) {
+        c = pix[(long) y * width + x];
+        if (ent < 0) {
+          ent = c;
+          continue;
+        }
+        fcode = ((long) c << 12) + ent;
+        i = (c << 4) ^ ent;
+        disp = i ? HARNESS_HSIZE - i : 1;
+        while (htab[i] >= 0 && htab[i] != fcode) {
+          i -= disp;
+          if (i < 0)
+            i += HARNESS_HSIZE;
+        }
+        if (htab[i] == fcode) {
+          ent = codetab[i];
+          continue;
+        }
+        harness_gif_code (o, ent, bits);
+        if (next > maxcode) {
+          bits++;
+          maxcode = bits == 12 ? 4096 : (1 << bits) - 1;
+        }
+        ent = c;
+        if (next < 4096) {
+          codetab[i] = next++;
+          htab[i] = fcode;
+          continue;
+        }
+        // Full: start over
+        for (i = 0; i < HARNESS_HSIZE; i++)
+          htab[i] = -1;
+        harness_gif_code (o, clear, bits);
+        next = clear + 2;
+        bits = min_size + 1;
+        maxcode = (1 << bits) - 1;
+      }
+    }
+  }
+  harness_gif_code (o, ent, bits);
+  if (next > maxcode)
+    bits++;
+  harness_gif_code (o, clear + 1, bits);
+  if (o->acc_bits)
+    harness_gif_code (o, 0, 8 - o->acc_bits);
+  harness_gif_flush (o);
+  free (htab);
+  free (codetab);
+}
+
+// Draws glyph g of the set at x, y, scale pixels a bit, in ink
+inline void
+harness_gif_glyph (unsigned char *pix, int width, int height,
+                   const unsigned char *glyphs, int g, int x, int y,
+                   int scale, int ink)
+{
+  int gx, gy, px, py;
+
+  for (gy = 0; gy < 12 * scale && y + gy < height; gy++) {
+    for (gx = 0; gx < 8 * scale && x + gx < width; gx++) {
+      if (glyphs[g * 12 + gy / scale] & (0x80 >> (gx / scale))) {
+        px = x + gx;
+        py = y + gy;
+        pix[(long) py * width + px] = (unsigned char) ink;
+      }
+    }
+  }
+}
+
+// Lines of text in the box, scale pixels a glyph bit
+inline void
+harness_gif_text (unsigned char *pix, int width, int height,
+                  const unsigned char *glyphs, unsigned *seed,
+                  int left, int top, int right, int bottom, int scale,
+                  int ink)
+{
+  int x, y;
+
+  for (y = top; y + 12 * scale <= bottom; y += 16 * scale) {
+    for (x = left; x + 8 * scale <= right; x += 8 * scale) {
+      *seed = *seed * 1103515245 + 12345;
+      // A space a word, and lines that end short
+      if ((*seed >> 16) % 7 == 0)
+        continue;
+      if ((*seed >> 16) % 97 == 0)
+        break;
+      harness_gif_glyph (pix, width, height, glyphs,
+                         (*seed >> 20) % HARNESS_GLYPHS, x, y, scale, ink);
+    }
+  }
+}
+
+inline void
+harness_gif_fill (unsigned char *pix, int width, int left, int top,
+                  int right, int bottom, int color)
+{
+  int y;
+
+  for (y = top; y < bottom; y++)
+    memset (pix + (long) y * width + left, color, right - left);
+}
+
+// The pixels of a kind of GIF, one byte each
+inline void
+harness_gif_pixels (unsigned char *pix, int kind, int width, int height,
+                    unsigned seed)
+{
+  unsigned char glyphs[HARNESS_GLYPHS * 12];
+  unsigned char *p;
+  int i, x, y, px, py, w, h;
+
+  for (i = 0; i < HARNESS_GLYPHS * 12; i++) {
+    seed = seed * 1103515245 + 12345;
+    glyphs[i] = (unsigned char) ((seed >> 16) & (seed >> 8) & 0x7e);
+  }
+  if (kind != HARNESS_GIF_SCREEN) {
+    // White, three scan pixels a glyph bit, a margin all round
+    memset (pix, 0, (long) width * height);
+    harness_gif_text (pix, width, height, glyphs, &seed, width / 10,
+                      height / 12, width - width / 10,
+                      height - height / 12, 3,
+                      kind == HARNESS_GIF_SCAN ? 1 : 3);
+    for (y = 0; y < height; y++) {
+      p = pix + (long) y * width;
+      for (x = 0; x < width; x++) {
+        // Gray where the ink's edge falls between scan pixels
+        if (kind == HARNESS_GIF_SCAN2 && !p[x] && x + 1 < width
+            && p[x + 1] == 3)
+          p[x] = (x & 1) ? 1 : 2;
+        seed = seed * 1103515245 + 12345;
+        if ((seed >> 16) % 3000 == 0)
+          p[x] = kind == HARNESS_GIF_SCAN ? 1 : 3;
+      }
+    }
+    return;
+  }
+
+  // A desktop with overlapping windows, each a title bar and text
+  harness_gif_fill (pix, width, 0, 0, width, height, 2);
+  for (i = 0; i < 6; i++) {
+    seed = seed * 1103515245 + 12345;
+    w = width / 3 + (seed >> 16) % (width / 3);
+    h = height / 3 + (seed >> 8) % (height / 3);
+    seed = seed * 1103515245 + 12345;
+    px = (seed >> 16) % (width - w);
+    py = (seed >> 8) % (height - h - 32);
+    harness_gif_fill (pix, width, px, py, px + w, py + h, 3);
+    harness_gif_fill (pix, width, px + 2, py + 2, px + w - 2, py + 20,
+                      4 + i % 2);
+    harness_gif_fill (pix, width, px + 2, py + 22, px + w - 2, py + h - 2,
+                      6);
+    harness_gif_text (pix, width, height, glyphs, &seed, px + 6, py + 6,
+                      px + w / 2, py + 18, 1, 7);
+    harness_gif_text (pix, width, height, glyphs, &seed, px + 6, py + 26,
+                      px + w - 6, py + h - 6, 1, 1);
+  }
+  // A photo in the last window: a ramp with noise in it
+  w = width / 5;
+  h = height / 4;
+  for (y = 0; y < h; y++) {
+    p = pix + (long) (height / 2 + y) * width + width / 2;
+    for (x = 0; x < w; x++) {
+      seed = seed * 1103515245 + 12345;
+      p[x] = (unsigned char) (64 + ((x / 3 + y / 2) & 127)
+                              + ((seed >> 16) & 15));
+    }
+  }
+  // A taskbar, shaded top to bottom
+  for (y = height - 32; y < height; y++)
+    harness_gif_fill (pix, width, 0, y, width, y + 1,
+                      216 + (y - height + 32));
+}
+
+// A kind of width by height GIF from seed, and its length in *size;
+// malloc'd, NULL if out of memory
+inline unsigned char *
+harness_gif (int kind, int width, int height, int interlace, unsigned seed,
+             long *size)
+{
+  struct harness_gif_out o;
+  unsigned char head[13], rgb[3];
+  unsigned char *pix;
+  int bits = kind == HARNESS_GIF_SCAN ? 1 : kind == HARNESS_GIF_SCAN2 ? 2 : 8;
+  int i, v;
+
+  pix = (unsigned char *) malloc ((long) width * height);
+  if (!pix)
+    return NULL;
+  harness_gif_pixels (pix, kind, width, height, seed);
+  memset (&o, 0, sizeof (o));
+
+  memcpy (head, "GIF89a", 6);
+  head[6] = (unsigned char) (width & 255);
+  head[7] = (unsigned char) (width >> 8);
+  head[8] = (unsigned char) (height & 255);
+  head[9] = (unsigned char) (height >> 8);
+  head[10] = (unsigned char) (0x80 | (bits - 1) << 4 | (bits - 1));
+  head[11] = head[12] = 0;
+  harness_gif_put (&o, head, 13);
+  for (i = 0; i < 1 << bits; i++) {
+    if (bits < 8) {
+      // White to black
+      v = 255 - i * 255 / ((1 << bits) - 1);
+      rgb[0] = rgb[1] = rgb[2] = (unsigned char) v;
+    }
+    else {
+      seed = seed * 1103515245 + 12345;
+      rgb[0] = (unsigned char) (seed >> 8);
+      rgb[1] = (unsigned char) (seed >> 16);
+      rgb[2] = (unsigned char) (seed >> 24);
+    }
+    harness_gif_put (&o, rgb, 3);
+  }
+
+  head[0] = 0x2c;
+  head[1] = head[2] = head[3] = head[4] = 0;
+  head[5] = (unsigned char) (width & 255);
+  head[6] = (unsigned char) (width >> 8);
+  head[7] = (unsigned char) (height & 255);
+  head[8] = (unsigned char) (height >> 8);
+  head[9] = (unsigned char) (interlace ? 0x40 : 0);
+  head[10] = (unsigned char) (bits < 2 ? 2 : bits);
+  harness_gif_put (&o, head, 11);
+  harness_gif_lzw (&o, pix, width, height, interlace, head[10]);
+  head[0] = 0;
+  head[1] = 0x3b;
+  harness_gif_put (&o, head, 2);
+  free (pix);
+  *size = o.size;
+  return o.data;
+}
+
+#endif
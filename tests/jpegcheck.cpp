@@ -0,0 +1,442 @@
+/*******************************************************************************
+ * Copyright 2002, 2003, 2004, 2005, 2006, 2012 Kent Stork
+ *
+ * jpegcheck.cpp is part of Osiva.
+ *
+ * Osiva is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Osiva is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Osiva.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+///////////////////////////////////////////////////////////////////////////
+//
+// File: jpegcheck.cpp
+//
+// Checks the JPEG reader against the plainest use of the library: one
+// scanline a call, RGB out, each pixel swapped to BGR after, and for a
+// scaled read the same DCT scaling and then llimg_resample.  Whatever
+// readjpeg.c does to go faster (batched scanlines, BGR from the color
+// converter, the SSSE3 swap) must give the same bytes.
+//
+// First small JPEGs 1 to 39 pixels wide, made here, so every tail of
+// the vector swap is met; then each file named, read full and scaled
+// into 700 by 500.  Both are done with the SSSE3 swap and the plain
+// one (llimg_cpu_limit picks), and each read is timed beside the other
+// kernel and the plain read (best of some runs).  The plain read is
+// what readjpeg.c did before it batched its reads, so the times weigh
+// that change too.
+//
+// Build with Visual C++ and the jpeg6b headers and library here:
+//
+//   cl /O2 /I. /D LLIMG_SIMD tests\jpegcheck.cpp readjpeg.c resizer.cpp
+//      rotate.cpp palette.cpp pool.cpp mapfile.c simd.cpp jpeg6b_r.lib
+//
+// or with gcc and the installed libjpeg, whose headers the ones here
+// would shadow under -I. (hence -idirafter).  Such a library gives BGR
+// itself, and LLIMG_JPEG_SWAP makes readjpeg.c swap all the same:
+//
+//   gcc -O2 -mssse3 -c -idirafter . -DLLIMG_SYSTEM_JPEG -DLLIMG_JPEG_SWAP
+//       readjpeg.c mapfile.c
+//   g++ -O2 -fpermissive -idirafter . -DLLIMG_SYSTEM_JPEG
+//       tests/jpegcheck.cpp readjpeg.o mapfile.o resizer.cpp rotate.cpp
+//       palette.cpp pool.cpp simd.cpp -ljpeg -lpthread
+//
+// Run:
+//
+//   jpegcheck [-n runs] [file.jpg ...]
+//
+// 3 runs unless told otherwise.
+
+
+#include "harness.h"
+#include "ll_simd.h"
+#include <setjmp.h>
+
+extern "C" {
+#ifdef LLIMG_SYSTEM_JPEG
+#include <jpeglib.h>
+#else
+#include "jpeglib.h"
+#endif
+
+// readjpeg.c
+LLIMG * read_jpeg_file ( char * filename );
+LLIMG * read_jpeg_file_scaled ( char * filename, int max_w, int max_h );
+LLIMG * read_jpeg_data_scaled ( const unsigned char * data, long size,
+                                int max_w, int max_h );
+
+// resizer.cpp
+int llimg_resample (LLIMG *image, int new_width, int new_height,
+                    LLIMG *resized);
+}
+
+#include "mapfile.h"
+
+#define SCALED_W 700
+#define SCALED_H 500
+
+struct check_error {
+  struct jpeg_error_mgr pub;
+  jmp_buf jump;
+};
+
+static void
+check_error_exit (j_common_ptr cinfo)
+{
+  longjmp (((struct check_error *) cinfo->err)->jump, 1);
+}
+
+/////////////////////////////////////////////////////////////////////////
+//
+// A source of bytes in memory, ending in a made up EOI as readjpeg.c's
+// does, and a destination growing in memory for the JPEGs made here
+
+static void
+check_init_source (j_decompress_ptr)
+{
+}
+
+static boolean
+check_fill_input (j_decompress_ptr cinfo)
+{
+  static const JOCTET fake_eoi[2] = { (JOCTET) 0xFF, (JOCTET) JPEG_EOI };
+
+  cinfo->src->next_input_byte = fake_eoi;
+  cinfo->src->bytes_in_buffer = 2;
+  return TRUE;
+}
+
+static void
+check_skip_input (j_decompress_ptr cinfo, long num_bytes)
+{
+  if (num_bytes <= 0)
+    return;
+  if ((size_t) num_bytes > cinfo->src->bytes_in_buffer) {
+    check_fill_input (cinfo);
+    return;
+  }
+  cinfo->src->next_input_byte += num_bytes;
+  cinfo->src->bytes_in_buffer -= num_bytes;
+}
+
+static void
+check_term_source (j_decompress_ptr)
+{
+}
+
+static void
+check_src (j_decompress_ptr cinfo, struct jpeg_source_mgr *src,
+           const unsigned char *data, long size)
+{
+  src->init_source = check_init_source;
+  src->fill_input_buffer = check_fill_input;
+  src->skip_input_data = check_skip_input;
+  src->resync_to_restart = jpeg_resync_to_restart;
+  src->term_source = check_term_source;
+  src->next_input_byte = data;
+  src->bytes_in_buffer = size;
+  cinfo->src = src;
+}
+
+struct check_dest {
+  struct jpeg_destination_mgr pub;
+  unsigned char *data;
+  long size;
+};
+
+#define DEST_CHUNK 4096
+
+static void
+check_init_dest (j_compress_ptr cinfo)
+{
+  struct check_dest *dest = (struct check_dest *) cinfo->dest;
+
+  dest->data = (unsigned char *) malloc (DEST_CHUNK);
+  dest->size = 0;
+  dest->pub.next_output_byte = dest->data;
+  dest->pub.free_in_buffer = DEST_CHUNK;
+}
+
+static boolean
+check_empty_output (j_compress_ptr cinfo)
+{
+  struct check_dest *dest = (struct check_dest *) cinfo->dest;
+
+  // The whole buffer is full; it says nothing of free_in_buffer
+  dest->size += DEST_CHUNK;
+  dest->data = (unsigned char *) realloc (dest->data,
+                                          dest->size + DEST_CHUNK);
+  dest->pub.next_output_byte = dest->data + dest->size;
+  dest->pub.free_in_buffer = DEST_CHUNK;
+  return TRUE;
+}
+
+static void
+check_term_dest (j_compress_ptr cinfo)
+{
+  struct check_dest *dest = (struct check_dest *) cinfo->dest;
+
+  dest->size = (long) (dest->pub.next_output_byte - dest->data);
+}
+
+/////////////////////////////////////////////////////////////////////////
+//
+// A width by height JPEG of harness_image's noise, its bytes malloc'd
+
+static unsigned char *
+make_jpeg (int width, int height, unsigned seed, long *size)
+{
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  struct check_dest dest;
+  LLIMG *image;
+  JSAMPROW row;
+
+  image = harness_image (width, height, 24, seed);
+  cinfo.err = jpeg_std_error (&jerr);
+  jpeg_create_compress (&cinfo);
+  dest.pub.init_destination = check_init_dest;
+  dest.pub.empty_output_buffer = check_empty_output;
+  dest.pub.term_destination = check_term_dest;
+  cinfo.dest = &dest.pub;
+  cinfo.image_width = width;
+  cinfo.image_height = height;
+  cinfo.input_components = 3;
+  cinfo.in_color_space = JCS_RGB;
+  jpeg_set_defaults (&cinfo);
+  jpeg_set_quality (&cinfo, 90, TRUE);
+  jpeg_start_compress (&cinfo, TRUE);
+  while (cinfo.next_scanline < cinfo.image_height) {
+    row = image->line[cinfo.next_scanline];
+    jpeg_write_scanlines (&cinfo, &row, 1);
+  }
+  jpeg_finish_compress (&cinfo);
+  jpeg_destroy_compress (&cinfo);
+  llimg_release_llimg (image);
+  *size = dest.size;
+  return dest.data;
+}
+
+
+/////////////////////////////////////////////////////////////////////////
+//
+// The plain read of size bytes of JPEG at data, scaled to fit max_w by
+// max_h as readjpeg.c scales (0 for full size).  NULL if the library
+// gives up on it; a file cut short reads as far as it goes, gray.
+
+static LLIMG *
+plain_read (const unsigned char *data, long size, int max_w, int max_h)
+{
+  struct jpeg_decompress_struct cinfo;
+  struct check_error jerr;
+  struct jpeg_source_mgr src;
+  LLIMG * volatile image = NULL;
+  LLIMG *scaled;
+  JSAMPROW row;
+  unsigned char t;
+  int x, full_w, full_h, want_w, want_h, denom;
+
+  cinfo.err = jpeg_std_error (&jerr.pub);
+  jerr.pub.error_exit = check_error_exit;
+  if (setjmp (jerr.jump)) {
+    jpeg_destroy_decompress (&cinfo);
+    if (image)
+      llimg_release_llimg (image);
+    return NULL;
+  }
+  jpeg_create_decompress (&cinfo);
+  check_src (&cinfo, &src, data, size);
+  jpeg_read_header (&cinfo, TRUE);
+
+  // The size readjpeg.c aims for, and the DCT scaling that gets there
+  full_w = cinfo.image_width;
+  full_h = cinfo.image_height;
+  want_w = full_w;
+  want_h = full_h;
+  if (max_w > 0 && max_h > 0) {
+    if ((double) max_w * full_h >= (double) max_h * full_w) {
+      want_w = max_w;
+      want_h = (int) (((double) full_h * max_w + full_w - 1) / full_w);
+    }
+    else {
+      want_h = max_h;
+      want_w = (int) (((double) full_w * max_h + full_h - 1) / full_h);
+    }
+    if (want_w >= full_w || want_h >= full_h) {
+      want_w = full_w;
+      want_h = full_h;
+    }
+  }
+  for (denom = 8; denom > 1; denom /= 2) {
+    if ((full_w + denom - 1) / denom >= want_w
+        && (full_h + denom - 1) / denom >= want_h)
+      break;
+  }
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = denom;
+  jpeg_start_decompress (&cinfo);
+
+  image = llimg_alloc (cinfo.output_width, cinfo.output_height,
+                       cinfo.output_components * 8);
+  for (x = 0; x < 256; x++)
+    image->color[x].blue = image->color[x].green = image->color[x].red =
+      (unsigned char) x;
+  while (cinfo.output_scanline < cinfo.output_height) {
+    row = image->line[cinfo.output_scanline];
+    jpeg_read_scanlines (&cinfo, &row, 1);
+    if (cinfo.output_components == 3) {
+      for (x = 0; x < image->width; x++) {
+        t = row[3 * x];
+        row[3 * x] = row[3 * x + 2];
+        row[3 * x + 2] = t;
+      }
+    }
+  }
+  jpeg_finish_decompress (&cinfo);
+  jpeg_destroy_decompress (&cinfo);
+
+  if (image->width != want_w || image->height != want_h) {
+    scaled = (LLIMG *) malloc (sizeof (LLIMG));
+    if (!scaled || llimg_resample (image, want_w, want_h, scaled)) {
+      free (scaled);
+      llimg_release_llimg (image);
+      return NULL;
+    }
+    llimg_release_llimg (image);
+    image = scaled;
+  }
+  return image;
+}
+
+/////////////////////////////////////////////////////////////////////////
+//
+// The swap kernels, each its own llimg_cpu_limit, the plain one last
+
+static const int swap_sets[] = { LLIMG_CPU_SSSE3, 0 };
+static const char *swap_names[] = { "SSSE3", "plain" };
+#define SWAP_KERNELS 2
+
+// Whether this processor runs swap kernel k.  What readjpeg.c was
+// built with is its own affair: without the SSSE3 kernel both rows
+// are the plain one.
+static int
+swap_built (int k)
+{
+  return (llimg_cpu () & swap_sets[k]) == swap_sets[k];
+}
+
+/////////////////////////////////////////////////////////////////////////
+//
+// Reads file full and scaled with each swap kernel and the plain way,
+// timing them side by side; 0 if the reader's images are the plain
+// ones, else -1
+
+static int
+check_file (char *file, int runs)
+{
+  struct LLMAP map;
+  LLIMG *image, *plain;
+  double t, best[SWAP_KERNELS], best_plain;
+  int wrong = 0;
+  int pass, run, k, max_w, max_h;
+
+  if (llimg_map_file (file, &map)) {
+    printf ("%s: can't read\n", file);
+    return -1;
+  }
+  for (pass = 0; pass < 2 && !wrong; pass++) {
+    max_w = pass ? SCALED_W : 0;
+    max_h = pass ? SCALED_H : 0;
+    best_plain = 0;
+    for (run = 0; run < runs; run++) {
+      t = harness_ms ();
+      plain = plain_read (map.data, map.size, max_w, max_h);
+      t = harness_ms () - t;
+      if (!run || t < best_plain)
+        best_plain = t;
+
+      for (k = 0; k < SWAP_KERNELS; k++) {
+        if (!swap_built (k))
+          continue;
+        llimg_cpu_limit (swap_sets[k]);
+        t = harness_ms ();
+        image = pass ? read_jpeg_file_scaled (file, max_w, max_h)
+          : read_jpeg_file (file);
+        t = harness_ms () - t;
+        if (!run || t < best[k])
+          best[k] = t;
+        if (!run && !harness_same (image, plain))
+          wrong++;
+        if (image)
+          llimg_release_llimg (image);
+      }
+      llimg_cpu_limit (~0);
+      if (plain)
+        llimg_release_llimg (plain);
+    }
+    printf ("%s %s:", file, pass ? "scaled" : "full  ");
+    for (k = 0; k < SWAP_KERNELS; k++) {
+      if (swap_built (k))
+        printf (" %s %8.2f ms,", swap_names[k], best[k]);
+    }
+    printf (" one line at a time %8.2f ms%s\n", best_plain,
+            wrong ? "  NOT THE SAME" : "");
+  }
+  llimg_unmap_file (&map);
+  return wrong ? -1 : 0;
+}
+
+int
+main (int argc, char **argv)
+{
+  LLIMG *image, *plain;
+  unsigned char *data;
+  long size;
+  int runs = 3, wrong = 0;
+  int i, k, width;
+
+  // Every width to 39, through every tail of the swap, with each kernel
+  for (k = 0; k < SWAP_KERNELS; k++) {
+    if (!swap_built (k))
+      continue;
+    llimg_cpu_limit (swap_sets[k]);
+    wrong = 0;
+    for (width = 1; width < 40; width++) {
+      data = make_jpeg (width, 9, width, &size);
+      image = read_jpeg_data_scaled (data, size, 0, 0);
+      plain = plain_read (data, size, 0, 0);
+      if (!harness_same (image, plain)) {
+        printf ("%d wide, %s: not the same\n", width, swap_names[k]);
+        wrong++;
+      }
+      if (image)
+        llimg_release_llimg (image);
+      if (plain)
+        llimg_release_llimg (plain);
+      free (data);
+    }
+    printf ("widths 1 to 39, %s swap: %d not the same\n", swap_names[k],
+            wrong);
+    if (wrong)
+      break;
+  }
+  llimg_cpu_limit (~0);
+
+  for (i = 1; i < argc; i++) {
+    if (!strcmp (argv[i], "-n") && i + 1 < argc)
+      runs = atoi (argv[++i]);
+    else if (check_file (argv[i], runs))
+      wrong++;
+  }
+  return wrong ? 1 : 0;
+}
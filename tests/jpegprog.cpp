@@ -0,0 +1,127 @@
+/*******************************************************************************
+ * Copyright 2002, 2003, 2004, 2005, 2006, 2012 Kent Stork
+ *
+ * jpegprog.cpp is part of Osiva.
+ *
+ * Osiva is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Osiva is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Osiva.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+///////////////////////////////////////////////////////////////////////////
+//
+// File: jpegprog.cpp
+//
+// Reads each file named the way the viewer loads a progressive JPEG,
+// scan by scan through read_jpeg_file_progressive, and the plain way,
+// full size and scaled into 700 by 500.  For each it prints when the
+// first scan was ready to show, how many were shown, how long the whole
+// read took and how long the plain read takes, and checks that both end
+// in the same image.  A baseline file should show nothing and take as
+// long as the plain read.
+//
+// Build (see harness.h, for those that read JPEGs):
+//
+//   tests/jpegprog.cpp readjpeg.c resizer.cpp rotate.cpp palette.cpp
+//   pool.cpp mapfile.c simd.cpp
+//
+// Run:
+//
+//   jpegprog [-n runs] file.jpg ...
+//
+// Best of 3 runs unless told otherwise.
+
+
+#include "harness.h"
+
+extern "C" {
+// readjpeg.c
+LLIMG * read_jpeg_file_scaled ( char * filename, int max_w, int max_h );
+LLIMG * read_jpeg_file_progressive ( char * filename, int max_w, int max_h,
+                                     void (*shown) (LLIMG *llimg,
+                                                    void *client),
+                                     void *client );
+}
+
+#define SCALED_W 700
+#define SCALED_H 500
+
+struct scans {
+  double start;
+  double first;                    /* ms to the first scan shown */
+  int shown;
+};
+
+static void
+scan_shown (LLIMG *, void *client)
+{
+  struct scans *s = (struct scans *) client;
+
+  if (!s->shown++)
+    s->first = harness_ms () - s->start;
+}
+
+int
+main (int argc, char **argv)
+{
+  struct scans s;
+  LLIMG *image, *plain;
+  int runs = 3, wrong = 0;
+  int i, pass, run, max_w, max_h, shown;
+  double t, best, best_plain, first;
+
+  for (i = 1; i < argc; i++) {
+    if (!strcmp (argv[i], "-n") && i + 1 < argc) {
+      runs = atoi (argv[++i]);
+      continue;
+    }
+    for (pass = 0; pass < 2; pass++) {
+      max_w = pass ? SCALED_W : 0;
+      max_h = pass ? SCALED_H : 0;
+      best = best_plain = first = 0;
+      shown = 0;
+      for (run = 0; run < runs; run++) {
+        s.shown = 0;
+        s.first = 0;
+        s.start = harness_ms ();
+        image = read_jpeg_file_progressive (argv[i], max_w, max_h,
+                                            scan_shown, &s);
+        t = harness_ms () - s.start;
+        if (!run || t < best) {
+          best = t;
+          first = s.first;
+          shown = s.shown;
+        }
+
+        t = harness_ms ();
+        plain = read_jpeg_file_scaled (argv[i], max_w, max_h);
+        t = harness_ms () - t;
+        if (!run || t < best_plain)
+          best_plain = t;
+
+        if (!run && !harness_same (image, plain)) {
+          printf ("%s: not the plain read's image\n", argv[i]);
+          wrong++;
+        }
+        if (image)
+          llimg_release_llimg (image);
+        if (plain)
+          llimg_release_llimg (plain);
+      }
+      printf ("%s %s: %d shown, first at %7.2f ms, done %7.2f ms, "
+              "plain %7.2f ms\n", argv[i], pass ? "scaled" : "full  ",
+              shown, first, best, best_plain);
+    }
+  }
+  return wrong ? 1 : 0;
+}
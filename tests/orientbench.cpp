@@ -0,0 +1,285 @@
+/*******************************************************************************
+ * Copyright 2002, 2003, 2004, 2005, 2006, 2012 Kent Stork
+ *
+ * orientbench.cpp is part of Osiva.
+ *
+ * Osiva is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Osiva is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Osiva.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+///////////////////////////////////////////////////////////////////////////
+//
+// File: orientbench.cpp
+//
+// Checks the eight orientations (llimg_orient, the quarter turn
+// wrappers and llimg_orient_row) against each one worked out a pixel at
+// a time from what it means, on sizes that leave part tiles and part
+// blocks at every edge, 8 and 24 bit.  Then times the quarter turns of
+// 12, 24 and 48 MP images.  Both are done for each set of kernels the
+// build has and the processor runs, down to plain C, picked with
+// llimg_cpu_limit, so every set is checked and their times are side by
+// side.  The SSSE3 kernels are only built with -mssse3, or with
+// LLIMG_SIMD on VC 2008 or later (see ll_simd.h).
+//
+// Build (see harness.h):
+//
+//   tests/orientbench.cpp rotate.cpp pool.cpp simd.cpp
+//
+// Run:
+//
+//   orientbench [-n runs]
+//
+// Best of 3 runs unless told otherwise.
+
+
+#include "harness.h"
+#include "ll_simd.h"
+
+// rotate.cpp
+extern LLIMG *
+llimg_orient (LLIMG *image, int transform);
+extern int
+llimg_rotate24bitR (LLIMG *image, LLIMG *rotated);
+extern int
+llimg_rotate8bitR (LLIMG *image, LLIMG *rotated);
+extern int
+llimg_rotate24bitL (LLIMG *image, LLIMG *rotated);
+extern int
+llimg_rotate8bitL (LLIMG *image, LLIMG *rotated);
+
+/////////////////////////////////////////////////////////////////////////
+//
+// The source pixel that (x, y) of image shown through transform shows,
+// where image is w by h
+
+static void
+source_of (int transform, int x, int y, int w, int h, int *sx, int *sy)
+{
+  switch (transform) {
+  case LLIMG_ORIENT_FLIP_H:     *sx = w - 1 - x; *sy = y;         break;
+  case LLIMG_ORIENT_180:        *sx = w - 1 - x; *sy = h - 1 - y; break;
+  case LLIMG_ORIENT_FLIP_V:     *sx = x;         *sy = h - 1 - y; break;
+  case LLIMG_ORIENT_TRANSPOSE:  *sx = y;         *sy = x;         break;
+  case LLIMG_ORIENT_CW:         *sx = y;         *sy = h - 1 - x; break;
+  case LLIMG_ORIENT_TRANSVERSE: *sx = w - 1 - y; *sy = h - 1 - x; break;
+  case LLIMG_ORIENT_CCW:        *sx = w - 1 - y; *sy = x;         break;
+  default:                      *sx = x;         *sy = y;         break;
+  }
+}
+
+// Whether oriented is image shown through transform
+static int
+is_oriented (LLIMG *image, int transform, LLIMG *oriented)
+{
+  int bytes = image->bits_per_pixel / 8;
+  int x, y, sx, sy;
+
+  if (!oriented || oriented->bits_per_pixel != image->bits_per_pixel)
+    return 0;
+  if (transform >= LLIMG_ORIENT_TRANSPOSE
+      ? oriented->width != image->height || oriented->height != image->width
+      : oriented->width != image->width || oriented->height != image->height)
+    return 0;
+  for (y = 0; y < oriented->height; y++) {
+    for (x = 0; x < oriented->width; x++) {
+      source_of (transform, x, y, image->width, image->height, &sx, &sy);
+      if (memcmp (oriented->line[y] + x * bytes,
+                  image->line[sy] + sx * bytes, bytes))
+        return 0;
+    }
+  }
+  return 1;
+}
+
+// image through transform a row at a time, as the kernels turn theirs
+static LLIMG *
+orient_by_rows (LLIMG *image, int transform)
+{
+  LLIMG *oriented;
+  int y;
+
+  if (transform >= LLIMG_ORIENT_TRANSPOSE)
+    oriented = llimg_alloc (image->height, image->width,
+                            image->bits_per_pixel);
+  else
+    oriented = llimg_alloc (image->width, image->height,
+                            image->bits_per_pixel);
+  for (y = 0; y < image->height; y++)
+    llimg_orient_row (oriented, transform, image->line[y], y,
+                      image->width, image->height);
+  return oriented;
+}
+
+// The kernels built in
+static const int built = 0
+#ifdef LLIMG_SSE2
+  | LLIMG_CPU_SSE2
+#endif
+#ifdef LLIMG_SSSE3
+  | LLIMG_CPU_SSSE3
+#endif
+  ;
+
+static const char *
+kernel_name (int sets)
+{
+  return sets & LLIMG_CPU_SSSE3 ? "SSSE3" : sets & LLIMG_CPU_SSE2 ? "SSE2"
+    : "plain";
+}
+
+// Checks every orientation of every size with the kernels llimg_cpu
+// allows; how many were wrong
+static int
+check_all (int *checked)
+{
+  static int sizes[][2] = {
+    { 1, 1 }, { 1, 37 }, { 37, 1 }, { 4, 4 }, { 16, 16 }, { 17, 15 },
+    { 32, 32 }, { 33, 31 }, { 67, 45 }, { 100, 129 }, { 129, 100 }
+  };
+  LLIMG *image, *oriented, turned;
+  int k, bits, t, wrong = 0;
+
+  for (k = 0; k < (int) (sizeof (sizes) / sizeof (sizes[0])); k++) {
+    for (bits = 8; bits <= 24; bits += 16) {
+      image = harness_image (sizes[k][0], sizes[k][1], bits, k);
+      for (t = LLIMG_ORIENT_NORMAL; t <= LLIMG_ORIENT_CCW; t++) {
+        oriented = llimg_orient (image, t);
+        if (!is_oriented (image, t, oriented)) {
+          printf ("%dx%d %d bit, transform %d: wrong\n",
+                  sizes[k][0], sizes[k][1], bits, t);
+          wrong++;
+        }
+        if (oriented)
+          llimg_release_llimg (oriented);
+        oriented = orient_by_rows (image, t);
+        if (!is_oriented (image, t, oriented)) {
+          printf ("%dx%d %d bit, transform %d by rows: wrong\n",
+                  sizes[k][0], sizes[k][1], bits, t);
+          wrong++;
+        }
+        llimg_release_llimg (oriented);
+        *checked += 2;
+      }
+      if ((bits == 8 ? llimg_rotate8bitR (image, &turned)
+           : llimg_rotate24bitR (image, &turned))
+          || !is_oriented (image, LLIMG_ORIENT_CW, &turned)) {
+        printf ("%dx%d %d bit, R: wrong\n", sizes[k][0], sizes[k][1], bits);
+        wrong++;
+      }
+      llimg_prune_llimg (&turned);
+      if ((bits == 8 ? llimg_rotate8bitL (image, &turned)
+           : llimg_rotate24bitL (image, &turned))
+          || !is_oriented (image, LLIMG_ORIENT_CCW, &turned)) {
+        printf ("%dx%d %d bit, L: wrong\n", sizes[k][0], sizes[k][1], bits);
+        wrong++;
+      }
+      llimg_prune_llimg (&turned);
+      *checked += 2;
+      llimg_release_llimg (image);
+    }
+  }
+  return wrong;
+}
+
+// The best of runs quarter turns right and left of image
+static void
+time_turns (LLIMG *image, int runs, double *best_r, double *best_l)
+{
+  LLIMG turned;
+  double ms;
+  int run;
+
+  *best_r = *best_l = 0;
+  for (run = 0; run < runs; run++) {
+    ms = harness_ms ();
+    if (image->bits_per_pixel == 8)
+      llimg_rotate8bitR (image, &turned);
+    else
+      llimg_rotate24bitR (image, &turned);
+    ms = harness_ms () - ms;
+    llimg_prune_llimg (&turned);
+    if (!run || ms < *best_r)
+      *best_r = ms;
+
+    ms = harness_ms ();
+    if (image->bits_per_pixel == 8)
+      llimg_rotate8bitL (image, &turned);
+    else
+      llimg_rotate24bitL (image, &turned);
+    ms = harness_ms () - ms;
+    llimg_prune_llimg (&turned);
+    if (!run || ms < *best_l)
+      *best_l = ms;
+  }
+}
+
+int
+main (int argc, char **argv)
+{
+  static int megapixels[][2] = { { 4000, 3000 }, { 6000, 4000 },
+                                 { 8000, 6000 } };
+  LLIMG *image;
+  int runs = 3, checked, wrong = 0;
+  int i, k, s, n, bits, sets[3];
+  double best_r, best_l;
+
+  for (i = 1; i < argc; i++) {
+    if (!strcmp (argv[i], "-n") && i + 1 < argc)
+      runs = atoi (argv[++i]);
+  }
+
+  // Each set of kernels there is to run, the most first
+  sets[0] = llimg_cpu () & built;
+  n = 1;
+  if (sets[0] & LLIMG_CPU_SSSE3)
+    sets[n++] = LLIMG_CPU_SSE2;
+  if (sets[0])
+    sets[n++] = 0;
+
+  for (s = 0; s < n; s++) {
+    llimg_cpu_limit (sets[s]);
+    checked = 0;
+    k = check_all (&checked);
+    printf ("%-5s kernels: %d checked, %d wrong\n", kernel_name (sets[s]),
+            checked, k);
+    wrong += k;
+  }
+
+  printf ("\n%-12s", "");
+  for (s = 0; s < n; s++)
+    printf ("  %-5s R/L ms      ", kernel_name (sets[s]));
+  printf ("\n");
+  for (k = 0; k < (int) (sizeof (megapixels) / sizeof (megapixels[0]));
+       k++) {
+    for (bits = 8; bits <= 24; bits += 16) {
+      image = harness_image (megapixels[k][0], megapixels[k][1], bits, 1);
+      if (!image) {
+        printf ("no memory for %dx%d\n", megapixels[k][0],
+                megapixels[k][1]);
+        continue;
+      }
+      printf ("%2d MP %2d bit:",
+              megapixels[k][0] * megapixels[k][1] / 1000000, bits);
+      for (s = 0; s < n; s++) {
+        llimg_cpu_limit (sets[s]);
+        time_turns (image, runs, &best_r, &best_l);
+        printf ("  %7.2f/%7.2f     ", best_r, best_l);
+      }
+      printf ("\n");
+      llimg_release_llimg (image);
+    }
+  }
+  llimg_cpu_limit (~0);
+  return wrong ? 1 : 0;
+}
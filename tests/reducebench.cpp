@@ -0,0 +1,222 @@
+/*******************************************************************************
+ * Copyright 2002, 2003, 2004, 2005, 2006, 2012 Kent Stork
+ *
+ * reducebench.cpp is part of Osiva.
+ *
+ * Osiva is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Osiva is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Osiva.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+///////////////////////////////////////////////////////////////////////////
+//
+// File: reducebench.cpp
+//
+// Checks the box reductions against a plain average of each footprint,
+// on odd sized noise images at every factor from 1 to 13 and at 31, 24
+// bit and gray 8 bit, then times the 24 bit reduction of a big image at
+// factors 2 through 9.  Each is done with the fixed factor kernels and,
+// with llimg_reduce_fixed off, the runtime one they stand in for, and
+// for each set of vector kernels the build has and the processor runs,
+// down to plain C (llimg_cpu_limit picks), so the times are side by
+// side.  The AVX2 kernels are only built with -mavx2, or with
+// LLIMG_SIMD on VC 2012 or later (see ll_simd.h).
+//
+// Build (see harness.h):
+//
+//   tests/reducebench.cpp reduce.cpp rotate.cpp palette.cpp pool.cpp
+//   simd.cpp
+//
+// Run:
+//
+//   reducebench [-n runs] [width height]
+//
+// 6000 by 4000, best of 7, unless told otherwise.
+
+
+#include "harness.h"
+#include "ll_simd.h"
+
+// reduce.cpp
+extern int
+llimg_reduce24bit (LLIMG *image, int reduction, LLIMG *reduced);
+extern int
+llimg_reduce256 (LLIMG *image, int reduction, LLIMG *reduced);
+
+/////////////////////////////////////////////////////////////////////////
+//
+// Whether reduced is image averaged over reduction squares, bytes
+// bytes to a pixel, the sums divided down
+
+static int
+plain_average (LLIMG *image, int reduction, int bytes, LLIMG *reduced)
+{
+  long sum;
+  int x, y, c, i, j;
+  int area = reduction * reduction;
+
+  if (reduced->width != image->width / reduction
+      || reduced->height != image->height / reduction
+      || reduced->bits_per_pixel != 8 * bytes)
+    return 0;
+  for (y = 0; y < reduced->height; y++) {
+    for (x = 0; x < reduced->width; x++) {
+      for (c = 0; c < bytes; c++) {
+        sum = 0;
+        for (j = 0; j < reduction; j++) {
+          for (i = 0; i < reduction; i++)
+            sum += image->line[y * reduction + j]
+              [(x * reduction + i) * bytes + c];
+        }
+        if (reduced->line[y][x * bytes + c] != sum / area)
+          return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+// The kernels built in
+static const int built = 0
+#ifdef LLIMG_SSE2
+  | LLIMG_CPU_SSE2
+#endif
+#ifdef LLIMG_AVX2
+  | LLIMG_CPU_AVX2
+#endif
+  ;
+
+static const char *
+kernel_name (int sets)
+{
+  return sets & LLIMG_CPU_AVX2 ? "AVX2" : sets & LLIMG_CPU_SSE2 ? "SSE2"
+    : "plain";
+}
+
+// Every factor against the plain average, with the kernels as they are
+// set; how many were wrong
+static int
+check_all (const int *factors, int n)
+{
+  LLIMG *image, reduced;
+  int wrong = 0;
+  int i, k, f;
+
+  for (k = 0; k < n; k++) {
+    f = factors[k];
+    image = harness_image (7 * f + 5, 3 * f + 2, 24, f);
+    if (llimg_reduce24bit (image, f, &reduced)
+        || !plain_average (image, f, 3, &reduced)) {
+      printf ("24 bit, factor %d: not the plain average\n", f);
+      wrong++;
+    }
+    llimg_prune_llimg (&reduced);
+    llimg_release_llimg (image);
+
+    image = harness_image (11 * f + 3, 5 * f + 4, 8, f);
+    for (i = 0; i < 256; i++)
+      image->color[i].blue = image->color[i].green = image->color[i].red =
+        (unsigned char) i;
+    if (llimg_reduce256 (image, f, &reduced)
+        || !plain_average (image, f, 1, &reduced)) {
+      printf ("gray, factor %d: not the plain average\n", f);
+      wrong++;
+    }
+    llimg_prune_llimg (&reduced);
+    llimg_release_llimg (image);
+  }
+  return wrong;
+}
+
+// The best of runs 24 bit reductions of image by f
+static double
+time_reduce (LLIMG *image, int f, int runs)
+{
+  LLIMG reduced;
+  double t, best = 0;
+  int run;
+
+  for (run = 0; run < runs; run++) {
+    t = harness_ms ();
+    llimg_reduce24bit (image, f, &reduced);
+    t = harness_ms () - t;
+    llimg_prune_llimg (&reduced);
+    if (!run || t < best)
+      best = t;
+  }
+  return best;
+}
+
+int
+main (int argc, char **argv)
+{
+  static int factors[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 31 };
+  LLIMG *image;
+  int width = 6000, height = 4000, runs = 7, wrong = 0;
+  int i, k, f, s, n, fixed, sets[3];
+
+  for (i = 1; i < argc; i++) {
+    if (!strcmp (argv[i], "-n") && i + 1 < argc)
+      runs = atoi (argv[++i]);
+    else if (i + 1 < argc) {
+      width = atoi (argv[i]);
+      height = atoi (argv[++i]);
+    }
+  }
+
+  // Each set of kernels there is to run, the most first
+  sets[0] = llimg_cpu () & built;
+  n = 1;
+  if (sets[0] & LLIMG_CPU_AVX2)
+    sets[n++] = LLIMG_CPU_SSE2;
+  if (sets[0])
+    sets[n++] = 0;
+
+  for (s = 0; s < n; s++) {
+    llimg_cpu_limit (sets[s]);
+    for (fixed = 1; fixed >= 0; fixed--) {
+      llimg_reduce_fixed (fixed);
+      k = check_all (factors, (int) (sizeof (factors) / sizeof (int)));
+      printf ("%-5s kernels, %s: %d factors checked, %d wrong\n",
+              kernel_name (sets[s]), fixed ? "fixed  " : "runtime",
+              (int) (sizeof (factors) / sizeof (int)), k);
+      wrong += k;
+    }
+  }
+
+  // Then the times
+  image = harness_image (width, height, 24, 1);
+  if (!image) {
+    printf ("no memory for %dx%d\n", width, height);
+    return 2;
+  }
+  printf ("\n%dx%d 24 bit, fixed/runtime ms\n%-9s", width, height, "");
+  for (s = 0; s < n; s++)
+    printf ("  %-5s            ", kernel_name (sets[s]));
+  printf ("\n");
+  for (f = 2; f <= 9; f++) {
+    printf ("factor %d:", f);
+    for (s = 0; s < n; s++) {
+      llimg_cpu_limit (sets[s]);
+      llimg_reduce_fixed (1);
+      printf ("  %7.2f/", time_reduce (image, f, runs));
+      llimg_reduce_fixed (0);
+      printf ("%7.2f   ", time_reduce (image, f, runs));
+    }
+    printf ("\n");
+  }
+  llimg_cpu_limit (~0);
+  llimg_reduce_fixed (1);
+  llimg_release_llimg (image);
+  return wrong ? 1 : 0;
+}
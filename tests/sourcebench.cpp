@@ -0,0 +1,314 @@
+/*******************************************************************************
+ * Copyright 2002, 2003, 2004, 2005, 2006, 2012 Kent Stork
+ *
+ * sourcebench.cpp is part of Osiva.
+ *
+ * Osiva is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Osiva is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Osiva.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+///////////////////////////////////////////////////////////////////////////
+//
+// File: sourcebench.cpp
+//
+// Weighs keeping a file's bytes (ooptions->keep_source, ks:1) against
+// keeping its raster, for JPEGs shown small in a layout.  For each file
+// named it reads the small image (300 by 200) and the full size both
+// from the file, as raster mode does, and from its kept bytes, as
+// source mode does, checks each pair comes out the same and prints the
+// times.
+//
+// Then it lays out that many windows, the files taken in turn, each
+// holding what a SnapShotW holds, and measures the memory in use
+// (harness_mem) once they are loaded and once every window has been to
+// 1:1 and back:
+//
+//   raster  the small image; once browsed, the full size too, the
+//           longest since viewed let go past the budget (keep_budget)
+//   source  the small image and the file's bytes, shared by the
+//           windows on the same file (llimg_keep_file); the full size
+//           is read from them and goes once the small one shows again
+//
+// Beside each it prints what SnapShotW::held_bytes would count.  The
+// pool keeps nothing, so what is let go shows.  With -b 0 browsing in
+// raster mode needs the memory for every full size at once.
+//
+// Build (see harness.h, for those that read JPEGs):
+//
+//   tests/sourcebench.cpp readjpeg.c resizer.cpp rotate.cpp palette.cpp
+//   pool.cpp mapfile.c simd.cpp
+//
+// Run:
+//
+//   sourcebench [-n runs] [-w windows] [-b budget_mb] file.jpg ...
+//
+// Best of 3 runs, 500 windows and a 512 MB budget unless told otherwise.
+
+
+#include "harness.h"
+#include "mapfile.h"
+
+extern "C" {
+// readjpeg.c
+LLIMG * read_jpeg_file_scaled ( char * filename, int max_w, int max_h );
+LLIMG * read_jpeg_data_scaled ( const unsigned char * data, long size,
+                                int max_w, int max_h );
+// pool.cpp
+void llimg_pool_cap (long bytes);
+}
+
+#define SMALL_W 300
+#define SMALL_H 200
+#define MB (1024.0 * 1024.0)
+
+// What a window holds
+struct window {
+  char *file;
+  LLIMG *small;
+  LLIMG *full;
+  LLKEPT *kept;
+};
+
+// Bytes of img's pixels, as held_bytes counts them
+static double
+image_bytes (const LLIMG *img)
+{
+  if (!img)
+    return 0;
+  return (double) llimg_stride (img->width, img->bits_per_pixel)
+    * abs (img->height);
+}
+
+// The best of runs reads, file (kept NULL) or kept bytes, into held
+// bytes; 0 if it doesn't read, or doesn't make the same image as same
+static double
+time_read (char *filename, LLKEPT *kept, int max_w, int max_h, int runs,
+           LLIMG *same, double *held)
+{
+  LLIMG *image;
+  double t, best = 0;
+  int run;
+
+  for (run = 0; run < runs; run++) {
+    t = harness_ms ();
+    if (kept)
+      image = read_jpeg_data_scaled (kept->data, kept->size, max_w, max_h);
+    else
+      image = read_jpeg_file_scaled (filename, max_w, max_h);
+    t = harness_ms () - t;
+    if (!image || (same && !harness_same (image, same))) {
+      if (image)
+        llimg_release_llimg (image);
+      return 0;
+    }
+    *held = image_bytes (image);
+    llimg_release_llimg (image);
+    if (!run || t < best)
+      best = t;
+  }
+  return best;
+}
+
+// What held_bytes would count for the windows
+static double
+counted (struct window *win, int windows)
+{
+  double bytes = 0;
+  int i;
+
+  for (i = 0; i < windows; i++) {
+    bytes += image_bytes (win[i].small) + image_bytes (win[i].full);
+    if (win[i].kept)
+      bytes += (double) win[i].kept->size / win[i].kept->refs;
+  }
+  return bytes;
+}
+
+// Lets go of all the windows hold
+static void
+close_all (struct window *win, int windows)
+{
+  int i;
+
+  for (i = 0; i < windows; i++) {
+    llimg_release_llimg (win[i].small);
+    llimg_release_llimg (win[i].full);
+    llimg_unkeep_file (win[i].kept);
+    win[i].small = win[i].full = NULL;
+    win[i].kept = NULL;
+  }
+}
+
+// Loads the windows, raster or source; 0 or -1
+static int
+load_all (struct window *win, int windows, int source)
+{
+  int i;
+
+  for (i = 0; i < windows; i++) {
+    if (source) {
+      win[i].kept = llimg_keep_file (win[i].file);
+      if (!win[i].kept)
+        return -1;
+      win[i].small = read_jpeg_data_scaled (win[i].kept->data,
+                                            win[i].kept->size,
+                                            SMALL_W, SMALL_H);
+    }
+    else
+      win[i].small = read_jpeg_file_scaled (win[i].file, SMALL_W, SMALL_H);
+    if (!win[i].small)
+      return -1;
+  }
+  return 0;
+}
+
+// Takes each window to 1:1 and back, in turn; 0 or -1
+static int
+browse_all (struct window *win, int windows, int source, double budget)
+{
+  double held;
+  int i, oldest = 0;
+
+  for (i = 0; i < windows; i++) {
+    if (source) {
+      win[i].full = read_jpeg_data_scaled (win[i].kept->data,
+                                           win[i].kept->size, 0, 0);
+      if (!win[i].full)
+        return -1;
+      // Let go as soon as the small one shows (shown_small)
+      llimg_release_llimg (win[i].full);
+      win[i].full = NULL;
+      continue;
+    }
+    win[i].full = read_jpeg_file_scaled (win[i].file, 0, 0);
+    if (!win[i].full)
+      return -1;
+    if (budget <= 0)
+      continue;
+    held = counted (win, windows);
+    while (held > budget && oldest < i) {
+      held -= image_bytes (win[oldest].full);
+      llimg_release_llimg (win[oldest].full);
+      win[oldest].full = NULL;
+      oldest++;
+    }
+  }
+  return 0;
+}
+
+int
+main (int argc, char **argv)
+{
+  static const char *mode[2] = { "raster (ks:0)", "source (ks:1)" };
+  struct window *win;
+  LLIMG *small, *full;
+  LLKEPT *kept;
+  char **good;
+  int runs = 3, windows = 500, budget_mb = 512, files = 0, wrong = 0;
+  int i, source;
+  double small_bytes, full_bytes, t[4], base, loaded, browsed;
+
+  for (i = 1; i < argc; i++) {
+    if (!strcmp (argv[i], "-n") && i + 1 < argc)
+      runs = atoi (argv[++i]);
+    else if (!strcmp (argv[i], "-w") && i + 1 < argc)
+      windows = atoi (argv[++i]);
+    else if (!strcmp (argv[i], "-b") && i + 1 < argc)
+      budget_mb = atoi (argv[++i]);
+  }
+  llimg_pool_cap (0);
+  good = (char **) malloc (argc * sizeof (char *));
+  if (!good)
+    return 1;
+
+  printf ("%-24s %9s %9s %9s  %-17s %-17s\n", "", "small MB", "full MB",
+          "file MB", "1:1 file/bytes", "small file/bytes");
+  for (i = 1; i < argc; i++) {
+    if (argv[i][0] == '-') {
+      i++;
+      continue;
+    }
+    kept = llimg_keep_file (argv[i]);
+    small = read_jpeg_file_scaled (argv[i], SMALL_W, SMALL_H);
+    full = read_jpeg_file_scaled (argv[i], 0, 0);
+    if (!kept || !small || !full) {
+      printf ("%s: doesn't read\n", argv[i]);
+      wrong++;
+    }
+    else {
+      t[0] = time_read (argv[i], NULL, 0, 0, runs, full, &full_bytes);
+      t[1] = time_read (argv[i], kept, 0, 0, runs, full, &full_bytes);
+      t[2] = time_read (argv[i], NULL, SMALL_W, SMALL_H, runs, small,
+                        &small_bytes);
+      t[3] = time_read (argv[i], kept, SMALL_W, SMALL_H, runs, small,
+                        &small_bytes);
+      if (!t[0] || !t[1] || !t[2] || !t[3]) {
+        printf ("%s: not the same image from the file and its bytes\n",
+                argv[i]);
+        wrong++;
+      }
+      else {
+        printf ("%-24s %9.2f %9.2f %9.2f  %7.2f/%7.2f ms %7.2f/%7.2f ms\n",
+                argv[i], small_bytes / MB, full_bytes / MB, kept->size / MB,
+                t[0], t[1], t[2], t[3]);
+        good[files++] = argv[i];
+      }
+    }
+    llimg_unkeep_file (kept);
+    llimg_release_llimg (small);
+    llimg_release_llimg (full);
+  }
+  if (!files || windows <= 0) {
+    free (good);
+    return wrong ? 1 : 0;
+  }
+
+  win = (struct window *) calloc (windows, sizeof (struct window));
+  if (!win) {
+    free (good);
+    return 1;
+  }
+  for (i = 0; i < windows; i++)
+    win[i].file = good[i % files];
+
+  printf ("\n%d windows on %d files, %d MB budget: measured (counted) MB\n",
+          windows, files, budget_mb);
+  printf ("  %-14s %-21s %-21s\n", "", "layout loaded", "after browsing all");
+  for (source = 0; source < 2; source++) {
+    base = harness_mem ();
+    if (load_all (win, windows, source)) {
+      printf ("  %-14s doesn't load\n", mode[source]);
+      wrong++;
+    }
+    else {
+      loaded = harness_mem () - base;
+      printf ("  %-14s %8.0f (%8.0f)   ", mode[source], loaded / MB,
+              counted (win, windows) / MB);
+      fflush (stdout);
+      if (browse_all (win, windows, source, budget_mb * MB)) {
+        printf ("doesn't browse\n");
+        wrong++;
+      }
+      else {
+        browsed = harness_mem () - base;
+        printf ("%8.0f (%8.0f)\n", browsed / MB,
+                counted (win, windows) / MB);
+      }
+    }
+    close_all (win, windows);
+  }
+  free (win);
+  free (good);
+  return wrong ? 1 : 0;
+}
@@ -38,6 +38,7 @@
 #include <vector>
 using namespace std;
 #include "wndmgr.h"
+#include "probe.h"    // Layout files are sniffed with the images
 
 #include <sys/types.h> // Used to seed random window distribution
 #include <sys/timeb.h> // Used to seed random window distribution
@@ -57,6 +58,7 @@ using namespace std;
 
 // The iconbar acts as the messaging window for WndMgr
 static const int DISSOLVE_TIMER = (IconBar::CLIENT_TIMER + 1);
+static const int LOAD_TIMER = (IconBar::CLIENT_TIMER + 2);
 
 // Message received from ooptions
 static const int OPTIONS_CHANGED = 1;
@@ -74,6 +76,12 @@ extern HWND hw_help;
 extern FlipDialog *flip_dialog;
 extern TransDialog *trans_dialog;
 
+// Dissolve effect
+extern LLIMG *
+llimg_alloc (int width, int height, int bits_per_pixel);
+extern LLIMG *
+llimg_dub (LLIMG *img);
+
 
   /////////
 // WndMgr //////////////////////////////////
@@ -158,6 +166,14 @@ init(HINSTANCE hInstance) {
   };
   
   _hInstance = hInstance;
+
+  // Let llimg_probe tell a layout file from an image
+  LLCODEC layout_codec = {
+    LLIMG_FMT_LAYOUT, "layout", (const unsigned char *) layout_header,
+    strlen (layout_header), NULL, NULL
+  };
+  llimg_register_codec (&layout_codec);
+
   iconbar.create (_hInstance);
   iconbar.set_images (IDR_BAR, IDR_BAR_MO, IDR_BAR_MD, IDR_BAR_NA);
   LLIMG *bar = iconbar.get_image();
@@ -228,11 +244,12 @@ init(HINSTANCE hInstance) {
 
 HWND WndMgr::
 new_window (HINSTANCE hInstance, LPSTR lpCmdLine, 
-            int nCmdShow) {
+            int nCmdShow, int max_w, int max_h, int preview,
+            const LLPROBE *probed) {
 
   SnapShotW *ssw = new SnapShotW;
   ssw->set_wndmgr (this);
-  ssw->init (hInstance, lpCmdLine, nCmdShow);
+  ssw->init (hInstance, lpCmdLine, nCmdShow, max_w, max_h, preview, probed);
   snapwin.push_back(ssw);
   if (snapwin.size() > 1) {
     for (int i = 0; i < group_icon.size(); i++)
@@ -241,6 +258,34 @@ new_window (HINSTANCE hInstance, LPSTR lpCmdLine,
   return ssw->get_hwnd();
   
 }
+
+  /////////
+// WndMgr //////////////////////////////////
+/////////
+
+// One look at the file says which it is, and the window reads the
+// image by what it found
+
+void WndMgr::open_file (char *path, int nCmdShow, int preview) {
+  LLPROBE probe;
+  llimg_probe (path, &probe);
+  if (probe.format == LLIMG_FMT_LAYOUT)
+    load_layout_file (path);
+  else
+    new_window (_hInstance, path, nCmdShow, 0, 0, preview, &probe);
+}
+  /////////
+// WndMgr //////////////////////////////////
+/////////
+
+// A preview window shows a placeholder until its image is read.  They
+// are read one a timer tick, in the order the windows came, so the
+// placeholders all go up first and the screen keeps painting.
+
+void WndMgr::defer_load () {
+  SetTimer (iconbar.get_hwnd(), LOAD_TIMER, 1, NULL);
+}
+
   /////////
 // WndMgr //////////////////////////////////
 /////////
@@ -887,13 +932,7 @@ iconbar_notify (int client, int type, UINT u, WPARAM w, LPARAM l) {
       break;
       
     case IconBar::DDE_FILENAME:
-      {
-        int lfile = wm->is_layout_file ((char *)l);
-        if (lfile) 
-          wm->load_layout_file ((char *)l);
-        else
-          wm->new_window (wm->_hInstance, (LPSTR) l, SW_SHOW);
-      }
+      wm->open_file ((char *) l, SW_SHOW);
       break;
   } // switch on type 
 }
@@ -1177,6 +1216,20 @@ void WndMgr::handle_timer (WPARAM wparam, LPARAM lparam) {
       }
     }
     break;
+  case LOAD_TIMER:
+    {
+      KillTimer (iconbar.get_hwnd(), LOAD_TIMER);
+      int i, left = 0;
+      for (i = 0; i < snapwin.size(); i++) {
+        if (!snapwin[i]->get_placeholder())
+          continue;
+        if (!left++)
+          snapwin[i]->finish_load ();
+      }
+      if (left > 1)
+        defer_load ();
+    }
+    break;
   } // switch on wparam, the TIMER ID
   
 }
@@ -1466,35 +1519,26 @@ void WndMgr::set_flip (int type) {
 // WndMgr //////////////////////////////////
 /////////
 
-// Returns version -- negative for relative paths
-
-int WndMgr::is_layout_file (char *path) {
+// The version a layout file's first line gives -- negative for relative
+// paths, 0 if it isn't one.  Whether to open the file at all is
+// llimg_probe's call (see open_file).
 
-  FILE *fp = fopen (path, "r");
-  if (!fp) return 0;
+static int layout_version (char *line) {
 
-  char *buff = new char [80];
-  fgets (buff, 80, fp);
-  fclose (fp);
-  if (buff[strlen(buff)-1] == '\n')
-    buff[strlen(buff)-1] = 0;
+  int linelen = strlen (line);
+  if (linelen && line[linelen-1] == '\n')
+    line[--linelen] = 0;
 
   int cmplen = strlen (layout_header);
-  int res = strncmp (buff, layout_header, cmplen); 
-  if (res) {
-    delete [] buff;
+  if (strncmp (line, layout_header, cmplen))
     return 0;
-  }
 
-  int bufflen = strlen (buff);
   int version = 1;
-  if (bufflen > cmplen) {
-    version = atoi (buff+cmplen);
-    if (buff[bufflen - 1] == 'R')
+  if (linelen > cmplen) {
+    version = atoi (line+cmplen);
+    if (line[linelen - 1] == 'R')
       version = -version;
   }
-  
-  delete [] buff;
   return version;
 }
 
@@ -1530,9 +1574,18 @@ static int parseN (char *line, int N, char *toks[]) {
 
 void WndMgr::load_layout_file (char *path) {
 
-  int version = is_layout_file (path);
-  if (!version)
+  char buff[256];
+  FILE *fp = fopen (path, "r");
+  if (!fp)
     return;
+  // First line has the file type
+  int version = 0;
+  if (fgets (buff, 256, fp))
+    version = layout_version (buff);
+  if (!version) {
+    fclose (fp);
+    return;
+  }
   int relative = 0;
   if (version < 0) {
     relative = 1;
@@ -1550,9 +1603,6 @@ void WndMgr::load_layout_file (char *path) {
     rbuff = (char *) malloc (max_path + 1);
   }
 
-  char buff[256];
-  FILE *fp = fopen (path, "r");
-  fgets (buff, 256, fp); // First line has the file type
   int n;
   HWND hwnd;
   SnapShotW *ssw;
@@ -1581,7 +1631,6 @@ void WndMgr::load_layout_file (char *path) {
     else {
       imgpath = toks[0];
     }
-    hwnd = new_window (_hInstance, imgpath, SW_HIDE);
     int left = atoi (toks[1]);
     int top = atoi (toks[2]);
     int width = atoi (toks[3]);
@@ -1594,23 +1643,23 @@ void WndMgr::load_layout_file (char *path) {
     if (n > 9)
       rotation = atoi (toks[9]);
 
+    // Only read as much of the image as the saved size needs.
+    // The image is read before it is rotated.
+    if (rotation & 1)
+      hwnd = new_window (_hInstance, imgpath, SW_HIDE, height, width, 1);
+    else
+      hwnd = new_window (_hInstance, imgpath, SW_HIDE, width, height, 1);
+
     ssw = (SnapShotW *) GetWindowLong (hwnd, GWL_USERDATA);
-    switch (rotation) {
-    case 2:
-      ssw->rotate ();
-    case 1:
-      ssw->rotate ();
-      break;
-    case 3:
-      ssw->rotate (0);
-      break;
-    }   
+    ssw->turn (rotation);
     rect.left = left;
     rect.top = top;
     rect.right = left + width - 1;
     rect.bottom = rect.top + height - 1;
     ssw->move_img (&rect, 0);
     if (trans) {
+      // The mask is made from the image, not its placeholder
+      ssw->finish_load ();
       ooptions->bg_diff = bg_tol;
       ooptions->erosions = erosion;
       ooptions->depth = mask_depth;
@@ -1630,6 +1679,47 @@ void WndMgr::load_layout_file (char *path) {
 // WndMgr //////////////////////////////////
 /////////
 
+// Keeps the windows' images within ooptions->budget_mb (0 for no limit)
+// by letting go of full size images, the longest since viewed first,
+// for what each window shows; see SnapShotW::drop_full.  keep, the
+// window that wants the room, is left be.
+
+void WndMgr::keep_budget (SnapShotW *keep) {
+  double budget, held;
+  int *order;
+  int i, j, n, sss;
+
+  if (ooptions->budget_mb <= 0)
+    return;
+  budget = ooptions->budget_mb * 1024.0 * 1024.0;
+  sss = snapwin.size();
+  held = 0;
+  for (i = 0; i < sss; i++)
+    held += snapwin[i]->held_bytes ();
+  if (held <= budget)
+    return;
+
+  // The windows that might let go, oldest viewed first
+  order = new int [sss];
+  n = 0;
+  for (i = 0; i < sss; i++) {
+    if (snapwin[i] == keep || snapwin[i]->get_dropped ())
+      continue;
+    for (j = n; j > 0 && snapwin[order[j-1]]->get_viewed ()
+                           > snapwin[i]->get_viewed (); j--)
+      order[j] = order[j-1];
+    order[j] = i;
+    n++;
+  }
+  for (j = 0; j < n && held > budget; j++)
+    held -= snapwin[order[j]]->drop_full ();
+  delete [] order;
+}
+
+  /////////
+// WndMgr //////////////////////////////////
+/////////
+
 // Write current status information into the help dialog
 // This is for debug and test
 
@@ -1647,13 +1737,27 @@ void WndMgr::dump_info () {
   SendMessage (hw_edit, EM_REPLACESEL, 0, (LPARAM) "\r\n");
   SendMessage (hw_edit, EM_REPLACESEL, 0, (LPARAM) "Image Paths:\r\n");
   SnapShotW *ssw;
-  int sss = snapwin.size();
-  for (int i = 0; i < sss; i++) {
+  int i, sss = snapwin.size();
+  for (i = 0; i < sss; i++) {
     ssw = snapwin[i];
     SendMessage (hw_edit, EM_REPLACESEL, 0,
       (LPARAM) ssw->get_file_path());
     SendMessage (hw_edit, EM_REPLACESEL, 0, (LPARAM) "\r\n");
   }
+
+  // What the images take, against the budget
+  char buff[128];
+  double held = 0;
+  int dropped = 0;
+  for (i = 0; i < sss; i++) {
+    held += snapwin[i]->held_bytes ();
+    dropped += snapwin[i]->get_dropped ();
+  }
+  SendMessage (hw_edit, EM_REPLACESEL, 0, (LPARAM) "\r\n");
+  SendMessage (hw_edit, EM_REPLACESEL, 0, (LPARAM) "Image Memory:\r\n");
+  sprintf (buff, "%.1f MB held, budget %d MB, %d of %d full sizes let go\r\n",
+           held / (1024.0 * 1024.0), ooptions->budget_mb, dropped, sss);
+  SendMessage (hw_edit, EM_REPLACESEL, 0, (LPARAM) buff);
 }
 
   /////////
@@ -1741,19 +1845,32 @@ void WndMgr::dissolve_init () {
   // Grab the screen from above the next window -- the current frame
   // Then TAB to the next window (with the screen placed in it)
 
+  // future and screen share the windows' pixels; only frame is written
+
   llimg_release_llimg (future);
   future = next_ssw->dub_image ();
-  llimg_release_llimg (frame);
-  frame = next_ssw->dub_image ();  // A lazy way to create the buffer
   next_ssw->show_screen ();        // Copies the screen into the window
   llimg_release_llimg (screen);
   screen = next_ssw->dub_image (); // Dissolve is from "screen" to "future"
+  llimg_release_llimg (frame);
+  frame = NULL;
+  if (future && screen) {
+    // What of future the screen doesn't reach is never dissolved to
+    if (screen->width < future->width || screen->height < future->height)
+      frame = llimg_dub (future);
+    else
+      frame = llimg_alloc (future->width, future->height, 24);
+  }
   hwnd = next_ssw->get_hwnd();
   SetWindowPos (hwnd, HWND_TOP, 0, 0, 0, 0,
      SWP_NOACTIVATE|SWP_NOMOVE|SWP_NOSIZE|SWP_NOREDRAW);
   InvalidateRect (hwnd, NULL, FALSE);
   UpdateWindow (hwnd);
   next_ssw->show_saved ();
+  if (!frame) {
+    set_flip (FLIP_OFF);
+    return;
+  }
     
   // ...
  
@@ -44,7 +44,12 @@ public:
   WndMgr();
   ~WndMgr();
   void init (HINSTANCE hInstance);
-  HWND new_window (HINSTANCE hInstance, LPSTR lpCmdLine, int nCmdShow);
+  HWND new_window (HINSTANCE hInstance, LPSTR lpCmdLine, int nCmdShow,
+                   int max_w = 0, int max_h = 0, int preview = 0,
+                   const struct LLPROBE *probed = NULL);
+  // A layout file is loaded, anything else gets a new window
+  void open_file (char *path, int nCmdShow, int preview = 0);
+  void defer_load ();
   void close_window (SnapShotW *sswindow);
   void tab (SnapShotW *sswindow, int activate = 1, int reverse = 0);
   void all_small (SnapShotW *exclude = NULL);
@@ -67,8 +72,9 @@ public:
   void dissolve_init ();
   void dissolve_frame ();
   void dissolve_clear ();
-  int is_layout_file (char *path);
   void load_layout_file (char *path);
+  // Lets go of full size images beyond the memory budget
+  void keep_budget (SnapShotW *keep = NULL);
   void dump_info ();
   void show (int flag = 1, HWND curr_hwnd = NULL);
 
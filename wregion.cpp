@@ -237,18 +237,16 @@ void WRegion::createMask (LLIMG * llimg, int xm, int ym) {
     return;
   
   mask = llimg_create_base ();
-  mask->width = 4*((llimg->width+3)/4);
+  mask->width = llimg->width;
   mask->height = llimg->height;
   mask->dib_height = -mask->height;
   mask->bits_per_pixel = 8;  // We need quick access and tag bits
-  mask->data = (unsigned char *) malloc (mask->width * mask->height);
-  if (!llimg->data) {
+  if (llimg_alloc_data (mask)) {
     llimg_release_llimg (mask);
+    mask = NULL;
     MessageBox (0, "Not enough memory for mask.", "osiva", MB_OK);
     return;
   }
-  llimg_make_line_array (mask);
-  mask->width = llimg->width;
   mask->color[0].blue = 255;
   mask->color[0].green = 255;
   mask->color[0].red = 255;
@@ -400,6 +398,13 @@ void WRegion::createMask (LLIMG * llimg, int xm, int ym) {
 
 ///////////////////////////////////////////////////////////////////////////
 
+void WRegion::useMask (LLIMG * llimg) {
+  llimg_release_llimg (mask);
+  mask = llimg;
+}
+
+///////////////////////////////////////////////////////////////////////////
+
 void WRegion::
 extractRegion () {
 
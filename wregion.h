@@ -35,6 +35,8 @@ class WRegion {
 public:
 
   void createMask (LLIMG *llimg, int xm=0, int ym=0);
+  // Takes a mask made elsewhere, 0 background and 1 region, to own
+  void useMask (LLIMG *llimg);
   LLIMG *get_mask() {return mask;}
   void extractRegion ();
   void extractRegions ();